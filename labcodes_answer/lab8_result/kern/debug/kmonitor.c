@@ -4,6 +4,8 @@
 #include <trap.h>
 #include <kmonitor.h>
 #include <kdebug.h>
+#include <spinlock.h>
+#include <sched.h>
 
 /* *
  * Simple command-line kernel monitor useful for controlling the
@@ -21,6 +23,8 @@ static struct command commands[] = {
     {"help", "Display this list of commands.", mon_help},
     {"kerninfo", "Display information about the kernel.", mon_kerninfo},
     {"backtrace", "Print backtrace of stack frame.", mon_backtrace},
+    {"locks", "Display the contention counters of the spinlocks.", mon_locks},
+    {"sched", "Display the scheduling counters of the processes.", mon_sched},
 };
 
 /* return if kernel is panic, in kern/debug/panic.c */
@@ -130,3 +134,23 @@ mon_backtrace(int argc, char **argv, struct trapframe *tf) {
     return 0;
 }
 
+/* *
+ * mon_locks - call print_spinlocks in kern/sync/spinlock.c to
+ * print how often the registered spinlocks were taken and contended.
+ * */
+int
+mon_locks(int argc, char **argv, struct trapframe *tf) {
+    print_spinlocks();
+    return 0;
+}
+
+/* *
+ * mon_sched - call print_schedstat in kern/schedule/sched.c to
+ * print the run queues and the scheduling counters of the processes.
+ * */
+int
+mon_sched(int argc, char **argv, struct trapframe *tf) {
+    print_schedstat();
+    return 0;
+}
+
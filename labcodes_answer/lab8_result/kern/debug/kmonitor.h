@@ -8,6 +8,8 @@ void kmonitor(struct trapframe *tf);
 int mon_help(int argc, char **argv, struct trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct trapframe *tf);
+int mon_locks(int argc, char **argv, struct trapframe *tf);
+int mon_sched(int argc, char **argv, struct trapframe *tf);
 int mon_continue(int argc, char **argv, struct trapframe *tf);
 int mon_step(int argc, char **argv, struct trapframe *tf);
 int mon_breakpoint(int argc, char **argv, struct trapframe *tf);
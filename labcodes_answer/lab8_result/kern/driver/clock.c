@@ -2,6 +2,7 @@
 #include <trap.h>
 #include <stdio.h>
 #include <picirq.h>
+#include <clock.h>
 
 /* *
  * Support for time-related hardware gadgets - the 8253 timer,
@@ -15,20 +16,82 @@
  * is the appropriate count to generate a frequency of freq Hz.
  * */
 
-#define TIMER_FREQ      1193182
+#define TIMER_FREQ      CLOCK_FREQ
 #define TIMER_DIV(x)    ((TIMER_FREQ + (x) / 2) / (x))
 
 #define TIMER_MODE      (IO_TIMER1 + 3)         // timer mode port
 #define TIMER_SEL0      0x00                    // select counter 0
+#define TIMER_ONESHOT   0x00                    // mode 0, interrupt on terminal count
 #define TIMER_RATEGEN   0x04                    // mode 2, rate generator
+#define TIMER_LATCH     0x00                    // latch the counter
 #define TIMER_16BIT     0x30                    // r/w counter 16 bits, LSB first
+#define TIMER_READBACK0 0xC2                    // read-back the status and the count of counter 0
+#define TIMER_OUT       0x80                    // the output pin in the status byte
+#define TIMER_NULLCOUNT 0x40                    // the count written is not loaded yet
+#define TIMER_MAXCOUNT  0xFFFF
+
+#define TICK_DIV        CLOCK_TICK_COUNT
+// back to the periodic mode if a one-shot ends this close after a tick
+#define TICK_SLACK      (TICK_DIV / 16)
+
+#define IO_TIMER2       0x042                   // 8253 Timer #3, gated by port 0x61
+#define TIMER_SEL2      0x80                    // select counter 2
+#define IO_PORTB        0x061                   // the gate of counter 2 and its output
+#define PORTB_GATE2     0x01
+#define PORTB_SPEAKER   0x02
+#define PORTB_OUT2      0x20
+
+#define TSC_CALIBRATE_MS    10
 
 volatile size_t ticks;
+uint32_t tsc_per_us;
+
+/* *
+ * The 8253 interrupts every tick in the periodic mode (mode 2). To wake up a sleeper
+ * between two ticks, or to let the idle process skip ticks, it is switched to one-shot
+ * counts (mode 0) instead, and goes back to the periodic mode at a tick once no
+ * sub-tick timer is left. Time is accounted by the counter, not by the interrupts: a
+ * mode 0 counter keeps counting down past its end, so reading it back also covers the
+ * time the interrupt took to be handled, and the one-shots do not drift.
+ * */
+
+// the count of the one-shot in flight, 0 while the clock is periodic
+static uint32_t oneshot_count;
+// the counts from the last tick to the start of the one-shot in flight, negative once
+// the one-shot has run past a tick
+static int oneshot_base;
+
+static void
+clock_set_count(uint8_t mode, uint32_t count) {
+    outb(TIMER_MODE, TIMER_SEL0 | mode | TIMER_16BIT);
+    outb(IO_TIMER1, count % 256);
+    outb(IO_TIMER1, count / 256);
+}
 
 long SYSTEM_READ_TIMER( void ){
     return ticks;
 }
 
+// tsc_calibrate - count the TSC cycles in TSC_CALIBRATE_MS ms, timed by counter 2
+static void
+tsc_calibrate(void) {
+    outb(IO_PORTB, (inb(IO_PORTB) & ~PORTB_SPEAKER) | PORTB_GATE2);
+    outb(TIMER_MODE, TIMER_SEL2 | TIMER_ONESHOT | TIMER_16BIT);
+    uint32_t count = TIMER_DIV(1000 / TSC_CALIBRATE_MS);
+    outb(IO_TIMER2, count % 256);
+    outb(IO_TIMER2, count / 256);
+
+    uint64_t start = rdtsc();
+    while (!(inb(IO_PORTB) & PORTB_OUT2)) {
+        /* do nothing */;
+    }
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    tsc_per_us = cycles / (TSC_CALIBRATE_MS * 1000);
+    if (tsc_per_us == 0) {
+        tsc_per_us = 1;
+    }
+}
+
 /* *
  * clock_init - initialize 8253 clock to interrupt 100 times per second,
  * and then enable IRQ_TIMER.
@@ -36,14 +99,130 @@ long SYSTEM_READ_TIMER( void ){
 void
 clock_init(void) {
     // set 8253 timer-chip
-    outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-    outb(IO_TIMER1, TIMER_DIV(100) % 256);
-    outb(IO_TIMER1, TIMER_DIV(100) / 256);
+    clock_set_count(TIMER_RATEGEN, TICK_DIV);
 
     // initialize time counter 'ticks' to zero
     ticks = 0;
+    oneshot_count = 0;
+
+    tsc_calibrate();
+    cprintf("tsc: %u cycles per us\n", tsc_per_us);
 
     cprintf("++ setup timer interrupts\n");
     pic_enable(IRQ_TIMER);
 }
 
+
+// oneshot_counted - the counts the one-shot in flight has run so far
+static uint32_t
+oneshot_counted(void) {
+    outb(TIMER_MODE, TIMER_READBACK0);
+    uint8_t status = inb(IO_TIMER1);
+    uint32_t count = inb(IO_TIMER1);
+    count |= inb(IO_TIMER1) << 8;
+    if (status & TIMER_NULLCOUNT) {
+        return 0;
+    }
+    if (status & TIMER_OUT) {
+        // the count has ended, and the counter wrapped around to 0xFFFF
+        return oneshot_count + ((0x10000 - count) & TIMER_MAXCOUNT);
+    }
+    return oneshot_count - count;
+}
+
+// clock_update - account the ticks the one-shot in flight has run past, returns the
+//              - number of them
+static unsigned int
+clock_update(void) {
+    unsigned int n = 0;
+    if (oneshot_count != 0) {
+        int now = oneshot_base + oneshot_counted();
+        for (; now >= TICK_DIV; now -= TICK_DIV, n ++) {
+            oneshot_base -= TICK_DIV;
+        }
+        ticks += n;
+    }
+    return n;
+}
+
+// clock_oneshot - interrupt count counts from now, which is now counts after the last tick
+static void
+clock_oneshot(uint32_t now, uint32_t count) {
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > TIMER_MAXCOUNT) {
+        count = TIMER_MAXCOUNT;
+    }
+    oneshot_base = now;
+    oneshot_count = count;
+    clock_set_count(TIMER_ONESHOT, count);
+}
+
+// clock_elapsed - the counts since the last tick, called with interrupts disabled. it may
+//               - reach CLOCK_TICK_COUNT if the interrupt of a tick is still pending
+uint32_t
+clock_elapsed(void) {
+    clock_update();
+    if (oneshot_count != 0) {
+        return oneshot_base + oneshot_counted();
+    }
+    outb(TIMER_MODE, TIMER_SEL0 | TIMER_LATCH);
+    uint32_t count = inb(IO_TIMER1);
+    count |= inb(IO_TIMER1) << 8;
+    uint32_t now = TICK_DIV - count;
+    if (pic_pending(IRQ_TIMER)) {
+        now += TICK_DIV;
+    }
+    return now;
+}
+
+// clock_tick - account the timer interrupt, called by trap_dispatch. returns the number
+//            - of ticks passed, 0 if a one-shot ended between two ticks
+unsigned int
+clock_tick(void) {
+    if (oneshot_count == 0) {
+        ticks ++;
+        return 1;
+    }
+    return clock_update();
+}
+
+// clock_set_event - interrupt sub counts after the last tick (sub < CLOCK_TICK_COUNT),
+//                 - or only at the ticks if sub is 0. called with interrupts disabled
+void
+clock_set_event(uint32_t sub) {
+    if (sub == 0 && oneshot_count == 0) {
+        return;
+    }
+    uint32_t now = clock_elapsed();
+    if (sub == 0) {
+        if (now < TICK_SLACK) {
+            // the few counts since the tick are lost, much less than a tick per switch
+            oneshot_count = 0;
+            clock_set_count(TIMER_RATEGEN, TICK_DIV);
+            return;
+        }
+        // run the one-shot to the next tick, and switch there
+        sub = TICK_DIV;
+    }
+    clock_oneshot(now, (sub > now) ? sub - now : 1);
+}
+
+// clock_idle - halt until an interrupt, at most until "until" counts after the last tick.
+//            - the caller (cpu_idle) disables interrupts, knows no timer expires before,
+//            - and sets the clock again afterwards
+void
+clock_idle(uint32_t until) {
+    uint32_t now = clock_elapsed();
+    if (until <= now) {
+        return;
+    }
+    clock_oneshot(now, until - now);
+
+    // sti takes effect after hlt, so no interrupt is lost in between
+    asm volatile ("sti; hlt; cli" ::: "memory");
+
+    // woken up early by another interrupt, account the ticks passed
+    clock_update();
+}
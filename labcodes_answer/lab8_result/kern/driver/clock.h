@@ -4,9 +4,36 @@
 #include <defs.h>
 
 extern volatile size_t ticks;
+extern uint32_t tsc_per_us;
+
+// the 8253 counts CLOCK_FREQ times a second, and CLOCK_TICK_COUNT times in a tick
+#define CLOCK_FREQ                      1193182
+#define CLOCK_HZ                        100
+#define CLOCK_TICK_COUNT                ((CLOCK_FREQ + CLOCK_HZ / 2) / CLOCK_HZ)
+#define CLOCK_TICK_US                   (1000000 / CLOCK_HZ)
+
+// the idle process halts at most this many ticks at once. the 16 bit count of the 8253
+// lasts about 55ms, a longer halt is made of several one-shots
+#define CLOCK_MAX_IDLE_TICKS            100
 
 void clock_init(void);
 
+// tsc_to_us - the microseconds of delta TSC cycles, 0 before the TSC is calibrated
+static inline uint32_t
+tsc_to_us(uint64_t delta) {
+    if (tsc_per_us == 0) {
+        return 0;
+    }
+    if ((delta >> 32) != 0) {
+        return 0xFFFFFFFF / tsc_per_us;
+    }
+    return (uint32_t)delta / tsc_per_us;
+}
+unsigned int clock_tick(void);
+uint32_t clock_elapsed(void);
+void clock_set_event(uint32_t sub);
+void clock_idle(uint32_t until);
+
 long SYSTEM_READ_TIMER( void );
 
 
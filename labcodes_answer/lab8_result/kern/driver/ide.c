@@ -154,17 +154,20 @@ ide_device_size(unsigned short ideno) {
     return 0;
 }
 
+// ide_readv_secs - read nbufs * nsecs sectors from secno with one command,
+//                - nsecs sectors into each of the buffers in dsts
 int
-ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs) {
-    assert(nsecs <= MAX_NSECS && VALID_IDE(ideno));
-    assert(secno < MAX_DISK_NSECS && secno + nsecs <= MAX_DISK_NSECS);
+ide_readv_secs(unsigned short ideno, uint32_t secno, void *dsts[], size_t nbufs, size_t nsecs) {
+    size_t total = nbufs * nsecs;
+    assert(total <= MAX_NSECS && VALID_IDE(ideno));
+    assert(secno < MAX_DISK_NSECS && secno + total <= MAX_DISK_NSECS);
     unsigned short iobase = IO_BASE(ideno), ioctrl = IO_CTRL(ideno);
 
     ide_wait_ready(iobase, 0);
 
     // generate interrupt
     outb(ioctrl + ISA_CTRL, 0);
-    outb(iobase + ISA_SECCNT, nsecs);
+    outb(iobase + ISA_SECCNT, total);
     outb(iobase + ISA_SECTOR, secno & 0xFF);
     outb(iobase + ISA_CYL_LO, (secno >> 8) & 0xFF);
     outb(iobase + ISA_CYL_HI, (secno >> 16) & 0xFF);
@@ -172,28 +175,35 @@ ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs) {
     outb(iobase + ISA_COMMAND, IDE_CMD_READ);
 
     int ret = 0;
-    for (; nsecs > 0; nsecs --, dst += SECTSIZE) {
-        if ((ret = ide_wait_ready(iobase, 1)) != 0) {
-            goto out;
+    size_t i, j;
+    for (i = 0; i < nbufs; i ++) {
+        void *dst = dsts[i];
+        for (j = 0; j < nsecs; j ++, dst += SECTSIZE) {
+            if ((ret = ide_wait_ready(iobase, 1)) != 0) {
+                goto out;
+            }
+            insl(iobase, dst, SECTSIZE / sizeof(uint32_t));
         }
-        insl(iobase, dst, SECTSIZE / sizeof(uint32_t));
     }
 
 out:
     return ret;
 }
 
+// ide_writev_secs - write nbufs * nsecs sectors to secno with one command,
+//                 - nsecs sectors from each of the buffers in srcs
 int
-ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nsecs) {
-    assert(nsecs <= MAX_NSECS && VALID_IDE(ideno));
-    assert(secno < MAX_DISK_NSECS && secno + nsecs <= MAX_DISK_NSECS);
+ide_writev_secs(unsigned short ideno, uint32_t secno, const void *srcs[], size_t nbufs, size_t nsecs) {
+    size_t total = nbufs * nsecs;
+    assert(total <= MAX_NSECS && VALID_IDE(ideno));
+    assert(secno < MAX_DISK_NSECS && secno + total <= MAX_DISK_NSECS);
     unsigned short iobase = IO_BASE(ideno), ioctrl = IO_CTRL(ideno);
 
     ide_wait_ready(iobase, 0);
 
     // generate interrupt
     outb(ioctrl + ISA_CTRL, 0);
-    outb(iobase + ISA_SECCNT, nsecs);
+    outb(iobase + ISA_SECCNT, total);
     outb(iobase + ISA_SECTOR, secno & 0xFF);
     outb(iobase + ISA_CYL_LO, (secno >> 8) & 0xFF);
     outb(iobase + ISA_CYL_HI, (secno >> 16) & 0xFF);
@@ -201,14 +211,28 @@ ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nse
     outb(iobase + ISA_COMMAND, IDE_CMD_WRITE);
 
     int ret = 0;
-    for (; nsecs > 0; nsecs --, src += SECTSIZE) {
-        if ((ret = ide_wait_ready(iobase, 1)) != 0) {
-            goto out;
+    size_t i, j;
+    for (i = 0; i < nbufs; i ++) {
+        const void *src = srcs[i];
+        for (j = 0; j < nsecs; j ++, src += SECTSIZE) {
+            if ((ret = ide_wait_ready(iobase, 1)) != 0) {
+                goto out;
+            }
+            outsl(iobase, src, SECTSIZE / sizeof(uint32_t));
         }
-        outsl(iobase, src, SECTSIZE / sizeof(uint32_t));
     }
 
 out:
     return ret;
 }
 
+int
+ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs) {
+    return ide_readv_secs(ideno, secno, &dst, 1, nsecs);
+}
+
+int
+ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nsecs) {
+    return ide_writev_secs(ideno, secno, &src, 1, nsecs);
+}
+
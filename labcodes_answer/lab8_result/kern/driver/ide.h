@@ -9,6 +9,8 @@ size_t ide_device_size(unsigned short ideno);
 
 int ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs);
 int ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nsecs);
+int ide_readv_secs(unsigned short ideno, uint32_t secno, void *dsts[], size_t nbufs, size_t nsecs);
+int ide_writev_secs(unsigned short ideno, uint32_t secno, const void *srcs[], size_t nbufs, size_t nsecs);
 
 #endif /* !__KERN_DRIVER_IDE_H__ */
 
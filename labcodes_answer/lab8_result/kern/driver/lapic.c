@@ -0,0 +1,172 @@
+#include <defs.h>
+#include <x86.h>
+#include <stdio.h>
+#include <trap.h>
+#include <pmm.h>
+#include <clock.h>
+#include <mp.h>
+#include <lapic.h>
+
+/* *
+ * The local APIC of each cpu, see the Intel SDM Vol. 3A, chapter 10. The boot cpu
+ * keeps getting the interrupts of the 8259A through LINT0 (the virtual wire mode
+ * the BIOS left), and the 8253 ticks for it. The application processors tick with
+ * their local APIC timer, and the cpus interrupt each other with IPIs (lapic_ipi).
+ * A uniprocessor does not use the local APIC at all.
+ * */
+
+// the registers, as indexes of 32 bit words
+#define ID                  (0x0020 / 4)    // ID
+#define VER                 (0x0030 / 4)    // Version
+#define TPR                 (0x0080 / 4)    // Task Priority
+#define EOI                 (0x00B0 / 4)    // EOI
+#define SVR                 (0x00F0 / 4)    // Spurious Interrupt Vector
+#define SVR_ENABLE          0x00000100      // Unit Enable
+#define ESR                 (0x0280 / 4)    // Error Status
+#define ICRLO               (0x0300 / 4)    // Interrupt Command
+#define ICR_FIXED           0x00000000
+#define ICR_INIT            0x00000500      // INIT/RESET
+#define ICR_STARTUP         0x00000600      // Startup IPI
+#define ICR_DELIVS          0x00001000      // Delivery status
+#define ICR_ASSERT          0x00004000      // Assert interrupt (vs deassert)
+#define ICR_LEVEL           0x00008000      // Level triggered
+#define ICR_BCAST           0x00080000      // Send to all APICs, including self.
+#define ICRHI               (0x0310 / 4)    // Interrupt Command [63:32]
+#define TIMER               (0x0320 / 4)    // Local Vector Table 0 (TIMER)
+#define TIMER_PERIODIC      0x00020000      // Periodic
+#define PCINT               (0x0340 / 4)    // Performance Counter LVT
+#define LINT0               (0x0350 / 4)    // Local Vector Table 1 (LINT0)
+#define LINT1               (0x0360 / 4)    // Local Vector Table 2 (LINT1)
+#define ERROR               (0x0370 / 4)    // Local Vector Table 3 (ERROR)
+#define LVT_MASKED          0x00010000      // Interrupt masked
+#define TICR                (0x0380 / 4)    // Timer Initial Count
+#define TCCR                (0x0390 / 4)    // Timer Current Count
+#define TDCR                (0x03E0 / 4)    // Timer Divide Configuration
+#define TDCR_X16            0x00000003      // divide counts by 16
+
+#define IO_RTC              0x70            // the CMOS, its shutdown code is at 0xF
+
+// the registers, mapped by lapic_init, NULL on a uniprocessor
+static volatile uint32_t *lapic;
+// the timer counts of a tick, counted by the first application processor
+static uint32_t lapic_tick_count;
+
+static void
+lapicw(int index, uint32_t value) {
+    lapic[index] = value;
+    lapic[ID];  // wait for write to finish, by reading
+}
+
+// microdelay - spin for us microseconds, timed by the TSC (see clock_init)
+static void
+microdelay(uint32_t us) {
+    uint64_t end = rdtsc() + (uint64_t)tsc_per_us * us;
+    while (rdtsc() < end) {
+        /* do nothing */;
+    }
+}
+
+// lapic_timer_init - interrupt every tick. the timer counts the bus clock, which is
+//                  - measured once against the TSC
+static void
+lapic_timer_init(void) {
+    lapicw(TDCR, TDCR_X16);
+    if (lapic_tick_count == 0) {
+        lapicw(TIMER, LVT_MASKED | (IRQ_OFFSET + IRQ_LTIMER));
+        lapicw(TICR, 0xFFFFFFFF);
+        microdelay(CLOCK_TICK_US);
+        lapic_tick_count = 0xFFFFFFFF - lapic[TCCR];
+        cprintf("lapic: %u timer counts per tick\n", lapic_tick_count);
+    }
+    lapicw(TIMER, TIMER_PERIODIC | (IRQ_OFFSET + IRQ_LTIMER));
+    lapicw(TICR, lapic_tick_count);
+}
+
+// lapic_init - enable the local APIC of the cpu we run on, the boot cpu maps the
+//            - registers first
+void
+lapic_init(void) {
+    if (lapic == NULL) {
+        lapic = mmio_map_region(lapic_addr, PGSIZE);
+    }
+
+    // enable the local APIC, and set the spurious interrupt vector
+    lapicw(SVR, SVR_ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
+
+    if (mycpu() != cpus) {
+        // only the boot cpu gets the 8259A interrupts
+        lapicw(LINT0, LVT_MASKED);
+        lapic_timer_init();
+    }
+    lapicw(LINT1, LVT_MASKED);
+
+    // mask the performance counter overflow interrupts, on the versions having them
+    if (((lapic[VER] >> 16) & 0xFF) >= 4) {
+        lapicw(PCINT, LVT_MASKED);
+    }
+
+    // map the error interrupt, and clear the error status (back-to-back writes)
+    lapicw(ERROR, IRQ_OFFSET + IRQ_ERROR);
+    lapicw(ESR, 0);
+    lapicw(ESR, 0);
+
+    // ack any outstanding interrupts
+    lapicw(EOI, 0);
+
+    // send an Init Level De-Assert to synchronise the arbitration ids
+    lapicw(ICRHI, 0);
+    lapicw(ICRLO, ICR_BCAST | ICR_INIT | ICR_LEVEL);
+    while (lapic[ICRLO] & ICR_DELIVS) {
+        /* do nothing */;
+    }
+
+    // enable interrupts on the APIC (but not on the processor)
+    lapicw(TPR, 0);
+}
+
+// lapic_eoi - acknowledge an interrupt the local APIC delivered
+void
+lapic_eoi(void) {
+    if (lapic != NULL) {
+        lapicw(EOI, 0);
+    }
+}
+
+// lapic_ipi - send interrupt vector to the cpu of apicid
+void
+lapic_ipi(uint8_t apicid, int vector) {
+    lapicw(ICRHI, apicid << 24);
+    lapicw(ICRLO, ICR_FIXED | vector);
+    while (lapic[ICRLO] & ICR_DELIVS) {
+        /* do nothing */;
+    }
+}
+
+// lapic_startap - start the application processor of apicid at addr, with the
+//               - INIT-SIPI-SIPI sequence of the MultiProcessor Specification, B.4
+void
+lapic_startap(uint8_t apicid, uintptr_t addr) {
+    // set the shutdown code to 0x0A and the warm reset vector (DWORD based at 40:67)
+    // to addr, for the processors which start from the BIOS after the INIT
+    outb(IO_RTC, 0xF);
+    outb(IO_RTC + 1, 0x0A);
+    uint16_t *wrv = KADDR((0x40 << 4) | 0x67);
+    wrv[0] = 0;
+    wrv[1] = addr >> 4;
+
+    // INIT (level-triggered) to reset the processor
+    lapicw(ICRHI, apicid << 24);
+    lapicw(ICRLO, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    microdelay(200);
+    lapicw(ICRLO, ICR_INIT | ICR_LEVEL);
+    microdelay(100);
+
+    // the Startup IPI (twice) starts it in real mode at addr, which must be page aligned
+    int i;
+    for (i = 0; i < 2; i ++) {
+        lapicw(ICRHI, apicid << 24);
+        lapicw(ICRLO, ICR_STARTUP | (addr >> 12));
+        microdelay(200);
+    }
+}
+
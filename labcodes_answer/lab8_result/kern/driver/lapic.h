@@ -0,0 +1,12 @@
+#ifndef __KERN_DRIVER_LAPIC_H__
+#define __KERN_DRIVER_LAPIC_H__
+
+#include <defs.h>
+
+void lapic_init(void);
+void lapic_eoi(void);
+void lapic_ipi(uint8_t apicid, int vector);
+void lapic_startap(uint8_t apicid, uintptr_t addr);
+
+#endif /* !__KERN_DRIVER_LAPIC_H__ */
+
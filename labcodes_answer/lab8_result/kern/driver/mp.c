@@ -0,0 +1,209 @@
+#include <defs.h>
+#include <string.h>
+#include <stdio.h>
+#include <x86.h>
+#include <sync.h>
+#include <pmm.h>
+#include <mp.h>
+
+/* *
+ * Find the processors from the MP configuration table of the BIOS, see the Intel
+ * MultiProcessor Specification v1.4. The MP floating pointer structure is in the
+ * first KB of the EBDA, the last KB of the base memory, or the BIOS ROM, and points
+ * to the configuration table with a processor entry for each cpu.
+ * */
+
+struct mpfp {
+    uint8_t signature[4];       // "_MP_"
+    uint32_t physaddr;          // the physical address of the configuration table
+    uint8_t length;             // 1, in 16 bytes
+    uint8_t specrev;            // 1 or 4
+    uint8_t checksum;           // all the bytes add up to 0
+    uint8_t type;               // the default configuration, 0 if there is a table
+    uint8_t imcrp;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct mpconf {
+    uint8_t signature[4];       // "PCMP"
+    uint16_t length;            // the length of the table
+    uint8_t version;            // 1 or 4
+    uint8_t checksum;           // all the bytes add up to 0
+    uint8_t product[20];
+    uint32_t oemtable;
+    uint16_t oemlength;
+    uint16_t entry;             // the number of the entries
+    uint32_t lapicaddr;         // the address of the local APIC
+    uint16_t xlength;
+    uint8_t xchecksum;
+    uint8_t reserved;
+    uint8_t entries[0];
+} __attribute__((packed));
+
+struct mpproc {
+    uint8_t type;               // MPPROC
+    uint8_t apicid;             // the local APIC id
+    uint8_t version;
+    uint8_t flags;
+    uint8_t signature[4];
+    uint32_t feature;
+    uint8_t reserved[8];
+} __attribute__((packed));
+
+// the types of the configuration table entries
+#define MPPROC                  0x00        // one per processor, 20 bytes
+#define MPBUS                   0x01        // one per bus, 8 bytes from here on
+#define MPIOAPIC                0x02        // one per I/O APIC
+#define MPIOINTR                0x03        // one per bus interrupt source
+#define MPLINTR                 0x04        // one per system interrupt source
+
+#define MPPROC_ENABLED          0x01        // the processor is usable
+#define MPPROC_BOOT             0x02        // the processor is the boot one
+
+struct cpu cpus[NCPU];
+int ncpu = 1;
+uintptr_t lapic_addr;
+
+spinlock_t kernel_lock = SPINLOCK_INIT("kernel");
+
+static uint8_t
+mp_sum(void *addr, size_t len) {
+    uint8_t sum = 0, *p = addr;
+    size_t i;
+    for (i = 0; i < len; i ++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+// mp_search1 - look for the MP floating pointer in [pa, pa + len)
+static struct mpfp *
+mp_search1(uintptr_t pa, size_t len) {
+    struct mpfp *mp = KADDR(pa), *end = KADDR(pa + len);
+    for (; mp < end; mp ++) {
+        if (memcmp(mp->signature, "_MP_", 4) == 0 && mp_sum(mp, sizeof(struct mpfp)) == 0) {
+            return mp;
+        }
+    }
+    return NULL;
+}
+
+static struct mpfp *
+mp_search(void) {
+    uint8_t *bda = KADDR(0x400);
+    struct mpfp *mp;
+    uintptr_t pa;
+    if ((pa = ((bda[0x0F] << 8) | bda[0x0E]) << 4) != 0) {
+        if ((mp = mp_search1(pa, 1024)) != NULL) {
+            return mp;
+        }
+    }
+    else {
+        pa = ((bda[0x14] << 8) | bda[0x13]) * 1024;
+        if ((mp = mp_search1(pa - 1024, 1024)) != NULL) {
+            return mp;
+        }
+    }
+    return mp_search1(0xF0000, 0x10000);
+}
+
+// mp_config - the checked MP configuration table, NULL if there is none
+static struct mpconf *
+mp_config(void) {
+    struct mpfp *mp;
+    if ((mp = mp_search()) == NULL || mp->physaddr == 0 || mp->type != 0) {
+        return NULL;
+    }
+    if (PPN(mp->physaddr) >= lowmem_npage) {
+        return NULL;
+    }
+    struct mpconf *conf = KADDR(mp->physaddr);
+    if (memcmp(conf->signature, "PCMP", 4) != 0 || (conf->version != 1 && conf->version != 4)) {
+        return NULL;
+    }
+    if (mp_sum(conf, conf->length) != 0) {
+        return NULL;
+    }
+    return conf;
+}
+
+// mp_init - find the cpus. the boot cpu is always cpus[0], the others are started by
+//         - boot_aps
+void
+mp_init(void) {
+    struct mpconf *conf;
+    ncpu = 1;
+    cpus[0].started = 1;
+    spin_lock_register(&kernel_lock);
+    if ((conf = mp_config()) == NULL) {
+        cprintf("mp: no MP configuration table, 1 cpu.\n");
+        return;
+    }
+    lapic_addr = conf->lapicaddr;
+
+    int i, found = 0;
+    uint8_t *p = conf->entries;
+    for (i = 0; i < conf->entry; i ++) {
+        if (*p == MPPROC) {
+            struct mpproc *proc = (struct mpproc *)p;
+            if (proc->flags & MPPROC_ENABLED) {
+                found ++;
+                if (proc->flags & MPPROC_BOOT) {
+                    cpus[0].apicid = proc->apicid;
+                }
+                else if (ncpu < NCPU) {
+                    cpus[ncpu].id = ncpu;
+                    cpus[ncpu ++].apicid = proc->apicid;
+                }
+            }
+            p += sizeof(struct mpproc);
+        }
+        else if (*p <= MPLINTR) {
+            p += 8;
+        }
+        else {
+            cprintf("mp: unknown configuration entry type %d.\n", *p);
+            break;
+        }
+    }
+    if (found > ncpu) {
+        cprintf("mp: %d cpus found, only %d are used.\n", found, ncpu);
+    }
+    else {
+        cprintf("mp: %d cpus found.\n", ncpu);
+    }
+}
+
+
+// lock_kernel - take the kernel lock with interrupts disabled, an interrupt handler
+//             - taking it again would wait for itself. a cpu spinning on it is in the
+//             - kernel and touches no user memory, so tlb_shootdown does not wait for
+//             - it, and it flushes its TLB here once it has the lock
+void
+lock_kernel(void) {
+    struct cpu *c = mycpu();
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        c->kernel_wait = 1;
+        spin_lock(&kernel_lock);
+        c->kernel_wait = 0;
+        tlb_flush_pending();
+    }
+    local_intr_restore(intr_flag);
+}
+
+void
+unlock_kernel(void) {
+    spin_unlock(&kernel_lock);
+}
+
+// cpu_halt - halt until an interrupt, without the kernel lock so that the other cpus run
+//          - meanwhile. called by the idle process with interrupts disabled
+void
+cpu_halt(void) {
+    unlock_kernel();
+    // sti takes effect after hlt, so no interrupt is lost in between
+    asm volatile ("sti; hlt; cli" ::: "memory");
+    lock_kernel();
+}
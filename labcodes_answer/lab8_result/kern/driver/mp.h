@@ -0,0 +1,69 @@
+#ifndef __KERN_DRIVER_MP_H__
+#define __KERN_DRIVER_MP_H__
+
+#include <defs.h>
+#include <mmu.h>
+#include <memlayout.h>
+#include <spinlock.h>
+
+#define NCPU                    8
+
+struct proc_struct;
+
+/* *
+ * The per-cpu data. The kernel runs with %gs on the SEG_KCPU segment of the cpu, whose
+ * base is the struct cpu of the cpu, so mycpu() is one load of %gs:0 (self) and does
+ * not depend on the kernel stack: a process may go to sleep on one cpu and wake up on
+ * another one.
+ * */
+struct cpu {
+    struct cpu *self;                   // the struct cpu itself, at %gs:0
+    struct proc_struct *proc;           // the process running on the cpu, current
+    struct proc_struct *idle;           // the idle process of the cpu
+    int id;                             // the index in cpus[]
+    uint8_t apicid;                     // the local APIC id of the cpu
+    volatile bool started;              // the cpu runs the kernel
+    volatile bool tlb_flush;            // another cpu asked for a TLB flush, see tlb_shootdown
+    volatile bool kernel_wait;          // the cpu spins on kernel_lock
+    struct taskstate ts;                // the TSS, its esp0 is the kernel stack of current
+    struct segdesc gdt[NSEGS];          // the GDT, with the TSS and %gs of the cpu
+};
+
+extern struct cpu cpus[NCPU];
+extern int ncpu;
+// the physical address of the local APICs, 0 if there is no MP configuration table
+extern uintptr_t lapic_addr;
+
+void mp_init(void);
+
+/* *
+ * The kernel lock: a cpu holds it while it runs in the kernel, and releases it when it
+ * returns to user mode (trap, forkret) or halts in the idle process (cpu_halt). So the
+ * kernel runs on one cpu at a time, and the code which protects its data with
+ * local_intr_save stays correct, while the user processes run on all the cpus.
+ * */
+extern spinlock_t kernel_lock;
+
+void lock_kernel(void);
+void unlock_kernel(void);
+void cpu_halt(void);
+
+static inline struct cpu *mycpu(void) __attribute__((always_inline));
+static inline int cpunum(void) __attribute__((always_inline));
+
+// mycpu - the struct cpu of the cpu we run on, see gdt_init
+static inline struct cpu *
+mycpu(void) {
+    struct cpu *c;
+    asm volatile ("movl %%gs:0, %0" : "=r" (c));
+    return c;
+}
+
+// cpunum - the index of the cpu we run on, the boot cpu is 0
+static inline int
+cpunum(void) {
+    return mycpu()->id;
+}
+
+#endif /* !__KERN_DRIVER_MP_H__ */
+
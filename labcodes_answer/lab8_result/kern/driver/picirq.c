@@ -84,3 +84,9 @@ pic_init(void) {
     }
 }
 
+// pic_pending - the irq (0-7) is raised but not delivered yet, interrupts are disabled
+bool
+pic_pending(unsigned int irq) {
+    // pic_init leaves OCW3 reading the IRR
+    return (inb(IO_PIC1) & (1 << irq)) != 0;
+}
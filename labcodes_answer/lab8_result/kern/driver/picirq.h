@@ -1,8 +1,11 @@
 #ifndef __KERN_DRIVER_PICIRQ_H__
 #define __KERN_DRIVER_PICIRQ_H__
 
+#include <defs.h>
+
 void pic_init(void);
 void pic_enable(unsigned int irq);
+bool pic_pending(unsigned int irq);
 
 #define IRQ_OFFSET      32
 
@@ -4,8 +4,27 @@
 #include <fs.h>
 #include <ide.h>
 #include <pmm.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <error.h>
 #include <assert.h>
 
+/* *
+ * The slots of the swap device are handed out by a bitmap allocator, one bit per slot,
+ * set while the slot is in use. Slot 0 is never used, a swap entry 0 would be an empty pte.
+ * swap_count[offset] is the number of references to the slot: the ptes holding its swap
+ * entry, plus one if the swap cache keeps a page with the same content. The slot is freed
+ * when the last reference goes.
+ * */
+static uint32_t *swap_bitmap;
+static uint16_t *swap_count;
+static size_t swap_bitmap_words;
+static size_t swap_nr_free;
+// the word of swap_bitmap where the next search starts
+static size_t swap_next_word;
+
+#define SWAP_COUNT_MAX                  0xFFFF
+
 void
 swapfs_init(void) {
     static_assert((PGSIZE % SECTSIZE) == 0);
@@ -13,15 +32,144 @@ swapfs_init(void) {
         panic("swap fs isn't available.\n");
     }
     max_swap_offset = ide_device_size(SWAP_DEV_NO) / (PGSIZE / SECTSIZE);
+
+    swap_bitmap_words = ROUNDUP(max_swap_offset, 32) / 32;
+    swap_bitmap = kmalloc(swap_bitmap_words * sizeof(uint32_t));
+    swap_count = kmalloc(max_swap_offset * sizeof(uint16_t));
+    if (swap_bitmap == NULL || swap_count == NULL) {
+        panic("swap fs: no memory for the slot bitmap.\n");
+    }
+    memset(swap_bitmap, 0, swap_bitmap_words * sizeof(uint32_t));
+    memset(swap_count, 0, max_swap_offset * sizeof(uint16_t));
+
+    // slot 0 and the bits after the last slot are never handed out
+    size_t offset;
+    set_bit(0, swap_bitmap);
+    for (offset = max_swap_offset; offset < swap_bitmap_words * 32; offset ++) {
+        set_bit(offset, swap_bitmap);
+    }
+    swap_nr_free = max_swap_offset - 1;
+    swap_next_word = 0;
 }
 
 int
 swapfs_read(swap_entry_t entry, struct Page *page) {
-    return ide_read_secs(SWAP_DEV_NO, swap_offset(entry) * PAGE_NSECT, page2kva(page), PAGE_NSECT);
+    return swapfs_read_cluster(entry, &page, 1);
 }
 
 int
 swapfs_write(swap_entry_t entry, struct Page *page) {
-    return ide_write_secs(SWAP_DEV_NO, swap_offset(entry) * PAGE_NSECT, page2kva(page), PAGE_NSECT);
+    return swapfs_write_cluster(entry, &page, 1);
+}
+
+// swapfs_write_buf - write a page sized kernel buffer to the slot of entry
+int
+swapfs_write_buf(swap_entry_t entry, const void *buf) {
+    return ide_write_secs(SWAP_DEV_NO, swap_offset(entry) * PAGE_NSECT, buf, PAGE_NSECT);
+}
+
+// swapfs_read_cluster - read the n adjacent slots from entry on into pages, with one ide command
+int
+swapfs_read_cluster(swap_entry_t entry, struct Page **pages, size_t n) {
+    assert(n <= SWAP_CLUSTER_MAX && swap_offset(entry) + n <= max_swap_offset);
+    void *dsts[SWAP_CLUSTER_MAX];
+    size_t i;
+    for (i = 0; i < n; i ++) {
+        dsts[i] = kmap(pages[i]);
+    }
+    int ret = ide_readv_secs(SWAP_DEV_NO, swap_offset(entry) * PAGE_NSECT, dsts, n, PAGE_NSECT);
+    for (i = 0; i < n; i ++) {
+        kunmap(dsts[i]);
+    }
+    return ret;
+}
+
+// swapfs_write_cluster - write pages to the n adjacent slots from entry on, with one ide command
+int
+swapfs_write_cluster(swap_entry_t entry, struct Page **pages, size_t n) {
+    assert(n <= SWAP_CLUSTER_MAX && swap_offset(entry) + n <= max_swap_offset);
+    void *srcs[SWAP_CLUSTER_MAX];
+    size_t i;
+    for (i = 0; i < n; i ++) {
+        srcs[i] = kmap(pages[i]);
+    }
+    int ret = ide_writev_secs(SWAP_DEV_NO, swap_offset(entry) * PAGE_NSECT, (const void **)srcs, n, PAGE_NSECT);
+    for (i = 0; i < n; i ++) {
+        kunmap(srcs[i]);
+    }
+    return ret;
 }
 
+// swapfs_alloc - allocate a free slot with one reference, and store its swap entry
+int
+swapfs_alloc(swap_entry_t *entry_store) {
+    return (swapfs_alloc_cluster(entry_store, 1) == 1) ? 0 : -E_NO_MEM;
+}
+
+// swapfs_alloc_cluster - allocate up to n adjacent free slots with one reference each,
+//                      - and store the swap entry of the first one
+//                      - the search goes on from the last allocated word, so the slots are
+//                      - used in turn and the free space ahead is mostly in long runs
+// return value: the number of slots allocated, 0 if the swap device is full
+size_t
+swapfs_alloc_cluster(swap_entry_t *entry_store, size_t n) {
+    assert(n > 0);
+    if (swap_nr_free == 0) {
+        return 0;
+    }
+    size_t i, word = swap_next_word;
+    for (i = 0; i < swap_bitmap_words; i ++) {
+        if (swap_bitmap[word] != 0xFFFFFFFF) {
+            size_t offset = word * 32 + __builtin_ctz(~swap_bitmap[word]), nr = 0;
+            while (nr < n && offset + nr < max_swap_offset && !test_bit(offset + nr, swap_bitmap)) {
+                set_bit(offset + nr, swap_bitmap);
+                swap_count[offset + nr] = 1;
+                nr ++;
+            }
+            swap_nr_free -= nr;
+            swap_next_word = (offset + nr) / 32;
+            if (swap_next_word == swap_bitmap_words) {
+                swap_next_word = 0;
+            }
+            *entry_store = swap_entry(offset);
+            return nr;
+        }
+        if (++ word == swap_bitmap_words) {
+            word = 0;
+        }
+    }
+    panic("swap fs: %d slots free, but none in the bitmap.\n", swap_nr_free);
+}
+
+// swapfs_dup - add a reference to the slot of entry, eg. a forked pte sharing it
+void
+swapfs_dup(swap_entry_t entry) {
+    size_t offset = swap_offset(entry);
+    assert(swap_count[offset] > 0 && swap_count[offset] < SWAP_COUNT_MAX);
+    swap_count[offset] ++;
+}
+
+// swapfs_free - drop a reference to the slot of entry, and free the slot with the last one
+// return value: the references left
+int
+swapfs_free(swap_entry_t entry) {
+    size_t offset = swap_offset(entry);
+    assert(swap_count[offset] > 0);
+    if (-- swap_count[offset] == 0) {
+        clear_bit(offset, swap_bitmap);
+        swap_nr_free ++;
+    }
+    return swap_count[offset];
+}
+
+// swapfs_count - the references to the slot of entry
+int
+swapfs_count(swap_entry_t entry) {
+    return swap_count[swap_offset(entry)];
+}
+
+// swapfs_nr_free - the number of free slots
+size_t
+swapfs_nr_free(void) {
+    return swap_nr_free;
+}
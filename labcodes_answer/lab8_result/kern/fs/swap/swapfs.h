@@ -7,6 +7,15 @@
 void swapfs_init(void);
 int swapfs_read(swap_entry_t entry, struct Page *page);
 int swapfs_write(swap_entry_t entry, struct Page *page);
+int swapfs_write_buf(swap_entry_t entry, const void *buf);
+int swapfs_read_cluster(swap_entry_t entry, struct Page **pages, size_t n);
+int swapfs_write_cluster(swap_entry_t entry, struct Page **pages, size_t n);
+int swapfs_alloc(swap_entry_t *entry_store);
+size_t swapfs_alloc_cluster(swap_entry_t *entry_store, size_t n);
+void swapfs_dup(swap_entry_t entry);
+int swapfs_free(swap_entry_t entry);
+int swapfs_count(swap_entry_t entry);
+size_t swapfs_nr_free(void);
 
 #endif /* !__KERN_FS_SWAP_SWAPFS_H__ */
 
@@ -13,10 +13,15 @@
 #include <swap.h>
 #include <proc.h>
 #include <fs.h>
+#include <futex.h>
+#include <mp.h>
+#include <lapic.h>
 
 int kern_init(void) __attribute__((noreturn));
+void mp_main(void) __attribute__((noreturn));
 
 static void lab1_switch_test(void);
+static void boot_aps(void);
 
 int
 kern_init(void) {
@@ -33,12 +38,15 @@ kern_init(void) {
     grade_backtrace();
 
     pmm_init();                 // init physical memory management
+    mp_init();                  // find the cpus
+    lock_kernel();              // the boot cpu runs the kernel
 
     pic_init();                 // init interrupt controller
     idt_init();                 // init interrupt descriptor table
 
     vmm_init();                 // init virtual memory management
     sched_init();               // init scheduler
+    futex_init();               // init futex wait queues
     proc_init();                // init process table
     
     ide_init();                 // init ide devices
@@ -46,6 +54,7 @@ kern_init(void) {
     fs_init();                  // init fs
     
     clock_init();               // init clock interrupt
+    boot_aps();                 // start the other cpus
     intr_enable();              // enable irq interrupt
 
     //LAB1: CAHLLENGE 1 If you try to do it, uncomment lab1_switch_test()
@@ -55,6 +64,63 @@ kern_init(void) {
     cpu_idle();                 // run idle process
 }
 
+// the cpu boot_aps starts, and the kernel stack and CR4 it starts with (see mpentry.S)
+static struct cpu *mpentry_cpu;
+uintptr_t mpentry_kstack;
+uint32_t mpentry_cr4;
+
+// boot_aps - start the application processors one at a time, each one runs mp_main
+static void
+boot_aps(void) {
+    extern char mpentry_start[], mpentry_end[];
+    if (ncpu == 1) {
+        return;
+    }
+    lapic_init();
+
+    // copy the entry code to unused memory at MPENTRY_PADDR, it turns on paging at its
+    // physical address, so map the low 4M there (not global) until all the cpus are up
+    memmove(KADDR(MPENTRY_PADDR), mpentry_start, mpentry_end - mpentry_start);
+    boot_pgdir[0] = boot_pgdir[PDX(KERNBASE)] & ~PTE_G;
+    mpentry_cr4 = rcr4();
+
+    int i;
+    for (i = 1; i < ncpu; i ++) {
+        struct Page *page;
+        if ((page = alloc_pages(KSTACKPAGE)) == NULL) {
+            panic("boot_aps: no memory for the kernel stack of cpu %d.\n", i);
+        }
+        mpentry_cpu = cpus + i;
+        mpentry_kstack = (uintptr_t)page2kva(page) + KSTACKSIZE;
+        lapic_startap(cpus[i].apicid, MPENTRY_PADDR);
+        // wait for mp_main, it uses the variables above
+        while (!cpus[i].started) {
+            cpu_relax();
+        }
+    }
+
+    boot_pgdir[0] = 0;
+    lcr3(boot_cr3);
+    cprintf("smp: %d cpus online.\n", ncpu);
+}
+
+// mp_main - an application processor starts here from mpentry.S. it sets up its GDT,
+//         - IDT, local APIC and idle process while boot_aps waits for it, then runs
+//         - cpu_idle once it has the kernel lock
+void
+mp_main(void) {
+    struct cpu *c = mpentry_cpu;
+    gdt_init(c, mpentry_kstack);
+    idt_load();
+    lapic_init();
+    idle_init(mpentry_kstack - KSTACKSIZE);
+    cprintf("smp: cpu %d (apic %d) started.\n", c->id, c->apicid);
+    c->started = 1;
+
+    lock_kernel();
+    cpu_idle();
+}
+
 void __attribute__((noinline))
 grade_backtrace2(int arg0, int arg1, int arg2, int arg3) {
     mon_backtrace(0, NULL, NULL);
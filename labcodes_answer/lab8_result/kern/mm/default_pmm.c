@@ -93,10 +93,11 @@
  *      Try to merge blocks at lower or higher addresses. Notice: This should
  *  change some pages' `p->property` correctly.
  */
-free_area_t free_area;
+// the free area of the zone being worked on, pmm.c points it at a zone before every call
+free_area_t *free_area;
 
-#define free_list (free_area.free_list)
-#define nr_free (free_area.nr_free)
+#define free_list (free_area->free_list)
+#define nr_free (free_area->nr_free)
 
 static void
 default_init(void) {
@@ -4,6 +4,5 @@
 #include <pmm.h>
 
 extern const struct pmm_manager default_pmm_manager;
-extern free_area_t free_area;
 #endif /* ! __KERN_MM_DEFAULT_PMM_H__ */
 
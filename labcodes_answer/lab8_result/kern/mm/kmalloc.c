@@ -40,8 +40,6 @@
 
 
 //some helper
-#define spin_lock_irqsave(l, f) local_intr_save(f)
-#define spin_unlock_irqrestore(l, f) local_intr_restore(f)
 typedef unsigned int gfp_t;
 #ifndef PAGE_SIZE
 #define PAGE_SIZE PGSIZE
@@ -76,6 +74,9 @@ typedef struct bigblock bigblock_t;
 static slob_t arena = { .next = &arena, .units = 1 };
 static slob_t *slobfree = &arena;
 static bigblock_t *bigblocks;
+// slob_lock protects the slob free list, block_lock the list of big blocks
+static spinlock_t slob_lock = SPINLOCK_INIT("slob");
+static spinlock_t block_lock = SPINLOCK_INIT("bigblock");
 
 
 static void* __slob_get_free_pages(gfp_t gfp, int order)
@@ -193,6 +194,8 @@ void check_slab(void) {
 void
 slab_init(void) {
   cprintf("use SLOB allocator\n");
+  spin_lock_register(&slob_lock);
+  spin_lock_register(&block_lock);
   check_slab();
 }
 
@@ -297,7 +300,7 @@ unsigned int ksize(const void *block)
 		spin_lock_irqsave(&block_lock, flags);
 		for (bb = bigblocks; bb; bb = bb->next)
 			if (bb->pages == block) {
-				spin_unlock_irqrestore(&slob_lock, flags);
+				spin_unlock_irqrestore(&block_lock, flags);
 				return PAGE_SIZE << bb->order;
 			}
 		spin_unlock_irqrestore(&block_lock, flags);
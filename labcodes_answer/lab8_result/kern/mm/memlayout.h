@@ -9,6 +9,8 @@
 #define SEG_UTEXT   3
 #define SEG_UDATA   4
 #define SEG_TSS     5
+#define SEG_KCPU    6       // the per-cpu data of the cpu, in %gs (see mycpu)
+#define NSEGS       7
 
 /* global descrptor numbers */
 #define GD_KTEXT    ((SEG_KTEXT) << 3)      // kernel text
@@ -16,6 +18,7 @@
 #define GD_UTEXT    ((SEG_UTEXT) << 3)      // user text
 #define GD_UDATA    ((SEG_UDATA) << 3)      // user data
 #define GD_TSS      ((SEG_TSS) << 3)        // task segment selector
+#define GD_KCPU     ((SEG_KCPU) << 3)       // kernel per-cpu data
 
 #define DPL_KERNEL  (0)
 #define DPL_USER    (3)
@@ -24,6 +27,7 @@
 #define KERNEL_DS   ((GD_KDATA) | DPL_KERNEL)
 #define USER_CS     ((GD_UTEXT) | DPL_USER)
 #define USER_DS     ((GD_UDATA) | DPL_USER)
+#define KERNEL_CPU  ((GD_KCPU) | DPL_KERNEL)
 
 /* *
  * Virtual memory map:                                          Permissions
@@ -33,11 +37,15 @@
  *                            |                                 |
  *                            |         Empty Memory (*)        |
  *                            |                                 |
- *                            +---------------------------------+ 0xFB000000
+ *                            +---------------------------------+ 0xFB400000
+ *                            |    Memory-mapped I/O (Kern)     | RW/-- PTSIZE
+ *     MMIO_BASE -----------> +---------------------------------+ 0xFB000000
  *                            |   Cur. Page Table (Kern, RW)    | RW/-- PTSIZE
  *     VPT -----------------> +---------------------------------+ 0xFAC00000
  *                            |        Invalid Memory (*)       | --/--
- *     KERNTOP -------------> +---------------------------------+ 0xF8000000
+ *                            +---------------------------------+ 0xF8400000
+ *                            |     Highmem Kmap Window         | RW/-- PTSIZE
+ *     KERNTOP, KMAP_BASE --> +---------------------------------+ 0xF8000000
  *                            |                                 |
  *                            |    Remapped Physical Memory     | RW/-- KMEMSIZE
  *                            |                                 |
@@ -71,6 +79,18 @@
 #define KMEMSIZE            0x38000000                  // the maximum amount of physical memory
 #define KERNTOP             (KERNBASE + KMEMSIZE)
 
+/* *
+ * Physical memory is split into zones:
+ *   DMA     [0, DMAMEMSIZE)           -- reachable by ISA/IDE bus-master DMA
+ *   NORMAL  [DMAMEMSIZE, KMEMSIZE)    -- always mapped at KERNBASE
+ *   HIGHMEM [KMEMSIZE, 4G)            -- not mapped, see kmap
+ * */
+#define DMAMEMSIZE          0x01000000                  // the 16M the ISA DMA can address
+
+/* highmem pages are mapped into the one page table at KMAP_BASE on demand */
+#define KMAP_BASE           KERNTOP
+#define KMAP_SIZE           PTSIZE
+
 /* *
  * Virtual page table. Entry PDX[VPT] in the PD (Page Directory) contains
  * a pointer to the page directory itself, thereby turning the PD into a page
@@ -79,6 +99,13 @@
  * */
 #define VPT                 0xFAC00000
 
+/* device memory, such as the local APICs, is mapped uncached here by mmio_map_region */
+#define MMIO_BASE           (VPT + PTSIZE)
+#define MMIO_SIZE           PTSIZE
+
+/* the application processors start at this physical address, see boot_aps */
+#define MPENTRY_PADDR       0x7000
+
 #define KSTACKPAGE          2                           // # of pages in kernel stack
 #define KSTACKSIZE          (KSTACKPAGE * PGSIZE)       // sizeof kernel stack
 
@@ -121,6 +148,8 @@ struct e820map {
     } __attribute__((packed)) map[E820MAX];
 };
 
+struct mm_struct;
+
 /* *
  * struct Page - Page descriptor structures. Each Page describes one
  * physical page. In kern/mm/pmm.h, you can find lots of useful functions
@@ -134,11 +163,17 @@ struct Page {
     list_entry_t page_link;         // free list link
     list_entry_t pra_page_link;     // used for pra (page replace algorithm)
     uintptr_t pra_vaddr;            // used for pra (page replace algorithm)
+    struct mm_struct *pra_mm;       // used for pra, the mm which maps the page at pra_vaddr
+    swap_entry_t swap_entry;        // the swap slot holding a copy of the page, valid if PageSwapCache
+    list_entry_t swap_link;         // the swap cache hash link
 };
 
 /* Flags describing the status of a page frame */
 #define PG_reserved                 0       // the page descriptor is reserved for kernel or unusable
 #define PG_property                 1       // the member 'property' is valid
+#define PG_swap                     2       // the page is managed by the swap manager (pra_* are valid)
+#define PG_active                   3       // the page is on the active list of the lru swap manager
+#define PG_swapcache                4       // the page is in the swap cache (swap_entry is valid)
 
 #define SetPageReserved(page)       set_bit(PG_reserved, &((page)->flags))
 #define ClearPageReserved(page)     clear_bit(PG_reserved, &((page)->flags))
@@ -146,6 +181,15 @@ struct Page {
 #define SetPageProperty(page)       set_bit(PG_property, &((page)->flags))
 #define ClearPageProperty(page)     clear_bit(PG_property, &((page)->flags))
 #define PageProperty(page)          test_bit(PG_property, &((page)->flags))
+#define SetPageSwap(page)           set_bit(PG_swap, &((page)->flags))
+#define ClearPageSwap(page)         clear_bit(PG_swap, &((page)->flags))
+#define PageSwap(page)              test_bit(PG_swap, &((page)->flags))
+#define SetPageActive(page)         set_bit(PG_active, &((page)->flags))
+#define ClearPageActive(page)       clear_bit(PG_active, &((page)->flags))
+#define PageActive(page)            test_bit(PG_active, &((page)->flags))
+#define SetPageSwapCache(page)      set_bit(PG_swapcache, &((page)->flags))
+#define ClearPageSwapCache(page)    clear_bit(PG_swapcache, &((page)->flags))
+#define PageSwapCache(page)         test_bit(PG_swapcache, &((page)->flags))
 
 // convert list entry to page
 #define le2page(le, member)                 \
@@ -240,6 +240,7 @@ struct taskstate {
 #define PTE_A           0x020                   // Accessed
 #define PTE_D           0x040                   // Dirty
 #define PTE_PS          0x080                   // Page Size
+#define PTE_G           0x100                   // Global, kept in TLB across cr3 reloads (CR4.PGE)
 #define PTE_MBZ         0x180                   // Bits must be zero
 #define PTE_AVAIL       0xE00                   // Available for software use
                                                 // The PTE_AVAIL bits aren't used by the kernel or interpreted by the
@@ -261,6 +262,7 @@ struct taskstate {
 #define CR0_PG          0x80000000              // Paging
 
 #define CR4_PCE         0x00000100              // Performance counter enable
+#define CR4_PGE         0x00000080              // Page Global Enable
 #define CR4_MCE         0x00000040              // Machine Check Enable
 #define CR4_PSE         0x00000010              // Page Size Extensions
 #define CR4_DE          0x00000008              // Debugging Extensions
@@ -268,5 +270,9 @@ struct taskstate {
 #define CR4_PVI         0x00000002              // Protected-Mode Virtual Interrupts
 #define CR4_VME         0x00000001              // V86 Mode Extensions
 
+/* cpuid feature flags (%edx of leaf 1) */
+#define CPUID_FEAT_PSE  0x00000008              // Page Size Extensions
+#define CPUID_FEAT_PGE  0x00002000              // Page Global Enable
+
 #endif /* !__KERN_MM_MMU_H__ */
 
@@ -11,6 +11,9 @@
 #include <swap.h>
 #include <vmm.h>
 #include <kmalloc.h>
+#include <proc.h>
+#include <mp.h>
+#include <lapic.h>
 
 /* *
  * Task State Segment:
@@ -31,13 +34,37 @@
  * contains the new ESP value for CPL = 0. When an interrupt happens in protected
  * mode, the x86 CPU will look in the TSS for SS0 and ESP0 and load their value
  * into SS and ESP respectively.
+ *
+ * Each cpu has its own TSS and GDT in its struct cpu (see mp.h), filled in by gdt_init.
  * */
-static struct taskstate ts = {0};
 
 // virtual address of physicall page array
 struct Page *pages;
 // amount of physical memory (in pages)
 size_t npage = 0;
+// amount of physical memory mapped at KERNBASE (in pages), the rest is highmem
+size_t lowmem_npage = 0;
+
+// the zones, their page frames are filled in by page_init
+struct zone zones[MAX_NR_ZONES] = {
+    [ZONE_DMA]      = {.name = "DMA"},
+    [ZONE_NORMAL]   = {.name = "Normal"},
+    [ZONE_HIGHMEM]  = {.name = "HighMem"},
+};
+
+// physical memory above this is not used, a pa must fit in 32 bits
+#define MAXPA                       ((uint64_t)1 << 32)
+// the min watermark of a zone is 1/ZONE_WMARK_RATIO of its pages
+#define ZONE_WMARK_RATIO            128
+
+// the ptes of the kmap window at KMAP_BASE, and the slot the next kmap looks at first
+static pte_t *kmap_ptes;
+static size_t kmap_next;
+// pmm_lock protects the zones and the zero pool, kmap_lock the kmap window
+static spinlock_t pmm_lock = SPINLOCK_INIT("pmm");
+static spinlock_t kmap_lock = SPINLOCK_INIT("kmap");
+// the page full of zeros, mapped read-only to all untouched anonymous memory (see do_pgfault)
+struct Page *zero_page;
 
 // virtual address of boot-time page directory
 extern pde_t __boot_pgdir;
@@ -48,6 +75,14 @@ uintptr_t boot_cr3;
 // physical memory management
 const struct pmm_manager *pmm_manager;
 
+// whether 4M pages (CR4.PSE) are used for the kernel linear map
+static bool pse_enabled = 0;
+// PTE_G if the kernel linear map is global (CR4.PGE), or 0
+static uint32_t kern_global = 0;
+
+// invalidating more pages than this one by one costs more than reloading cr3
+#define TLB_FLUSH_THRESHOLD         32
+
 /* *
  * The page directory entry corresponding to the virtual address range
  * [VPT, VPT + PTSIZE) points to the page directory itself. Thus, the page
@@ -76,21 +111,31 @@ pde_t * const vpd = (pde_t *)PGADDR(PDX(VPT), PDX(VPT), 0);
  *   - 0x18:  user code segment
  *   - 0x20:  user data segment
  *   - 0x28:  defined for tss, initialized in gdt_init
+ *   - 0x30:  the per-cpu data, initialized in gdt_init
+ * gdt is copied into the struct cpu of every cpu, which fills in the last two.
  * */
-static struct segdesc gdt[] = {
+static const struct segdesc gdt[NSEGS] = {
     SEG_NULL,
     [SEG_KTEXT] = SEG(STA_X | STA_R, 0x0, 0xFFFFFFFF, DPL_KERNEL),
     [SEG_KDATA] = SEG(STA_W, 0x0, 0xFFFFFFFF, DPL_KERNEL),
     [SEG_UTEXT] = SEG(STA_X | STA_R, 0x0, 0xFFFFFFFF, DPL_USER),
     [SEG_UDATA] = SEG(STA_W, 0x0, 0xFFFFFFFF, DPL_USER),
     [SEG_TSS]   = SEG_NULL,
+    [SEG_KCPU]  = SEG_NULL,
 };
 
-static struct pseudodesc gdt_pd = {
-    sizeof(gdt) - 1, (uintptr_t)gdt
-};
+// the idle process keeps up to ZERO_POOL_PAGES pre-zeroed pages in the pool
+#define ZERO_POOL_PAGES             64
+
+// the pre-zeroed pages, linked by page_link. They count as free pages, and
+// alloc_pages falls back on them when the pmm_manager runs out.
+static list_entry_t zero_pool;
+static size_t nr_zero_pool;
 
+static void enable_pse(void);
+static void boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, uintptr_t pa, uint32_t perm);
 static void check_alloc_page(void);
+static void check_zero_pool(void);
 static void check_pgdir(void);
 static void check_boot_pgdir(void);
 
@@ -101,7 +146,7 @@ static void check_boot_pgdir(void);
 static inline void
 lgdt(struct pseudodesc *pd) {
     asm volatile ("lgdt (%0)" :: "r" (pd));
-    asm volatile ("movw %%ax, %%gs" :: "a" (USER_DS));
+    asm volatile ("movw %%ax, %%gs" :: "a" (KERNEL_CPU));
     asm volatile ("movw %%ax, %%fs" :: "a" (USER_DS));
     asm volatile ("movw %%ax, %%es" :: "a" (KERNEL_DS));
     asm volatile ("movw %%ax, %%ds" :: "a" (KERNEL_DS));
@@ -111,95 +156,375 @@ lgdt(struct pseudodesc *pd) {
 }
 
 /* *
- * load_esp0 - change the ESP0 in default task state segment,
+ * load_esp0 - change the ESP0 in the task state segment of this cpu,
  * so that we can use different kernel stack when we trap frame
  * user to kernel.
  * */
 void
 load_esp0(uintptr_t esp0) {
-    ts.ts_esp0 = esp0;
+    mycpu()->ts.ts_esp0 = esp0;
 }
 
-/* gdt_init - initialize the default GDT and TSS */
-static void
-gdt_init(void) {
-    // set boot kernel stack and default SS0
-    load_esp0((uintptr_t)bootstacktop);
-    ts.ts_ss0 = KERNEL_DS;
+/* *
+ * gdt_init - initialize the GDT and TSS of cpu c, and load them on the cpu we run on.
+ * esp0 is the kernel stack of the cpu until it runs a process.
+ * */
+void
+gdt_init(struct cpu *c, uintptr_t esp0) {
+    c->self = c;
+    c->id = c - cpus;
 
-    // initialize the TSS filed of the gdt
-    gdt[SEG_TSS] = SEGTSS(STS_T32A, (uintptr_t)&ts, sizeof(ts), DPL_KERNEL);
+    // set kernel stack and default SS0
+    c->ts.ts_esp0 = esp0;
+    c->ts.ts_ss0 = KERNEL_DS;
+
+    // initialize the TSS and the per-cpu fields of the gdt
+    memcpy(c->gdt, gdt, sizeof(gdt));
+    c->gdt[SEG_TSS] = SEGTSS(STS_T32A, (uintptr_t)&(c->ts), sizeof(c->ts), DPL_KERNEL);
+    c->gdt[SEG_KCPU] = SEG(STA_W, (uintptr_t)c, 0xFFFFFFFF, DPL_KERNEL);
 
     // reload all segment registers
+    struct pseudodesc gdt_pd = {sizeof(c->gdt) - 1, (uintptr_t)(c->gdt)};
     lgdt(&gdt_pd);
 
     // load the TSS
     ltr(GD_TSS);
 }
 
-//init_pmm_manager - initialize a pmm_manager instance
+//init_pmm_manager - initialize a pmm_manager instance, with a free area for every zone
 static void
 init_pmm_manager(void) {
     pmm_manager = &default_pmm_manager;
     cprintf("memory management: %s\n", pmm_manager->name);
-    pmm_manager->init();
+    int i;
+    for (i = 0; i < MAX_NR_ZONES; i ++) {
+        free_area = &(zones[i].free_area);
+        pmm_manager->init();
+    }
+    free_area = &(zones[ZONE_NORMAL].free_area);
+}
+
+// page_zone - the zone the page belongs to
+static inline struct zone *
+page_zone(struct Page *page) {
+    size_t pfn = page2ppn(page);
+    struct zone *zone = zones;
+    while (pfn >= zone->end_pfn) {
+        zone ++;
+    }
+    return zone;
+}
+
+/* *
+ * The zone_* helpers point the pmm_manager at the free area of a zone for one call,
+ * and then point it back, so that between the calls free_area is always the normal
+ * zone (the pmm_manager checks rely on that). They are called with pmm_lock held.
+ * */
+static inline struct Page *
+zone_alloc(struct zone *zone, size_t n) {
+    free_area_t *area = free_area;
+    free_area = &(zone->free_area);
+    struct Page *page = pmm_manager->alloc_pages(n);
+    free_area = area;
+    return page;
+}
+
+static inline void
+zone_free(struct Page *base, size_t n) {
+    free_area_t *area = free_area;
+    free_area = &(page_zone(base)->free_area);
+    pmm_manager->free_pages(base, n);
+    free_area = area;
+}
+
+static inline size_t
+zone_nr_free(struct zone *zone) {
+    free_area_t *area = free_area;
+    free_area = &(zone->free_area);
+    size_t ret = pmm_manager->nr_free_pages();
+    free_area = area;
+    return ret;
 }
 
 //init_memmap - call pmm->init_memmap to build Page struct for free memory  
+//            - of one zone
 static void
 init_memmap(struct Page *base, size_t n) {
+    struct zone *zone = page_zone(base);
+    assert(page2ppn(base) + n <= zone->end_pfn);
+    free_area_t *area = free_area;
+    free_area = &(zone->free_area);
     pmm_manager->init_memmap(base, n);
+    free_area = area;
+    zone->managed += n;
 }
 
-//alloc_pages - call pmm->alloc_pages to allocate a continuous n*PAGESIZE memory 
+// zonelist - the zones an allocation with flags may use, the preferred one first,
+//          - terminated by -1
+static const int *
+zonelist(uint32_t flags) {
+    static const int dma[] = {ZONE_DMA, -1};
+    static const int normal[] = {ZONE_NORMAL, ZONE_DMA, -1};
+    static const int highmem[] = {ZONE_HIGHMEM, ZONE_NORMAL, ZONE_DMA, -1};
+    if (flags & ALLOC_DMA) {
+        return dma;
+    }
+    return (flags & ALLOC_HIGHMEM) ? highmem : normal;
+}
+
+// zero_pool_pop - take a page out of the zero pool, called with pmm_lock held
+static struct Page *
+zero_pool_pop(void) {
+    list_entry_t *le = list_next(&zero_pool);
+    list_del(le);
+    nr_zero_pool --;
+    return le2page(le, page_link);
+}
+
+// zero_pool_drain - give all the pages of the zero pool back to their zone,
+//                 - so that they can be merged into larger blocks again
+static void
+zero_pool_drain(void) {
+    while (nr_zero_pool > 0) {
+        zone_free(zero_pool_pop(), 1);
+    }
+}
+
+// zones_alloc - allocate n pages from the zonelist of flags, called with pmm_lock held.
+//             - the preferred zone may be emptied, a fallback zone is only used above its
+//             - low watermark, or above its min watermark once reclaim failed (reserve)
+static struct Page *
+zones_alloc(size_t n, uint32_t flags, bool reserve) {
+    const int *z = zonelist(flags);
+    struct Page *page;
+    int i;
+    for (i = 0; z[i] >= 0; i ++) {
+        struct zone *zone = zones + z[i];
+        if (i != 0) {
+            size_t wmark = reserve ? zone->wmark_min : zone->wmark_low;
+            if (zone_nr_free(zone) < n + wmark) {
+                continue;
+            }
+        }
+        if ((page = zone_alloc(zone, n)) != NULL) {
+            return page;
+        }
+    }
+    // the pages of the zero pool are normal pages
+    if (nr_zero_pool > 0 && !(flags & ALLOC_DMA)) {
+        if (n == 1) {
+            return zero_pool_pop();
+        }
+        zero_pool_drain();
+        return zones_alloc(n, flags, reserve);
+    }
+    return NULL;
+}
+
+//alloc_pages_flags - allocate a continuous n*PAGESIZE memory from the zones allowed by flags
 struct Page *
-alloc_pages(size_t n) {
+alloc_pages_flags(size_t n, uint32_t flags) {
     struct Page *page=NULL;
-    bool intr_flag;
+    bool intr_flag, drained = 0;
     
     while (1)
     {
-         local_intr_save(intr_flag);
+         spin_lock_irqsave(&pmm_lock, intr_flag);
          {
-              page = pmm_manager->alloc_pages(n);
+              page = zones_alloc(n, flags, 0);
          }
-         local_intr_restore(intr_flag);
+         spin_unlock_irqrestore(&pmm_lock, intr_flag);
 
-         if (page != NULL || n > 1 || swap_init_ok == 0) break;
+         if (swap_init_ok && nr_free_pages() < KSWAPD_LOW_PAGES) {
+              kswapd_wakeup();
+         }
+         if (page != NULL || (flags & ALLOC_NORECLAIM)) break;
+         // the cached kernel stacks are given back before anything is swapped out,
+         // they are contiguous so they may also satisfy n > 1
+         if (!drained) {
+              drained = 1;
+              if (kstack_cache_drain() != 0) {
+                   continue;
+              }
+         }
+         if (n > 1 || swap_init_ok == 0) break;
          
-         extern struct mm_struct *check_mm_struct;
          //cprintf("page %x, call swap_out in alloc_pages %d\n",page, n);
-         swap_out(check_mm_struct, n, 0);
+         // direct reclaim, the victim may belong to any mm
+         if (swap_out(NULL, n, 0) == 0) {
+              break;
+         }
+    }
+    if (page == NULL && !(flags & ALLOC_NORECLAIM)) {
+         // reclaim cannot help, dig into the reserves of the fallback zones
+         spin_lock_irqsave(&pmm_lock, intr_flag);
+         {
+              page = zones_alloc(n, flags, 1);
+         }
+         spin_unlock_irqrestore(&pmm_lock, intr_flag);
     }
     //cprintf("n %d,get page %x, No %d in alloc_pages\n",n,page,(page-pages));
     return page;
 }
 
+//alloc_pages - allocate a continuous n*PAGESIZE memory from the normal (or DMA) zone
+struct Page *
+alloc_pages(size_t n) {
+    return alloc_pages_flags(n, 0);
+}
+
 //free_pages - call pmm->free_pages to free a continuous n*PAGESIZE memory 
 void
 free_pages(struct Page *base, size_t n) {
     bool intr_flag;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&pmm_lock, intr_flag);
     {
-        pmm_manager->free_pages(base, n);
+        zone_free(base, n);
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&pmm_lock, intr_flag);
 }
 
 //nr_free_pages - call pmm->nr_free_pages to get the size (nr*PAGESIZE) 
-//of current free memory
+//of current free memory, in all the zones
 size_t
 nr_free_pages(void) {
-    size_t ret;
+    size_t ret = 0;
     bool intr_flag;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&pmm_lock, intr_flag);
     {
-        ret = pmm_manager->nr_free_pages();
+        int i;
+        for (i = 0; i < MAX_NR_ZONES; i ++) {
+            ret += zone_nr_free(zones + i);
+        }
+        ret += nr_zero_pool;
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&pmm_lock, intr_flag);
     return ret;
 }
 
+// alloc_zeroed_page_flags - allocate a page filled with zeros, from the zero pool if possible,
+//                         - so the caller does not pay for the memset
+struct Page *
+alloc_zeroed_page_flags(uint32_t flags) {
+    struct Page *page = NULL;
+    bool intr_flag;
+    spin_lock_irqsave(&pmm_lock, intr_flag);
+    {
+        // free highmem goes first for the pages that may live there, the pool is normal pages
+        if (nr_zero_pool > 0 && !(flags & ALLOC_DMA)
+            && (!(flags & ALLOC_HIGHMEM) || zone_nr_free(zones + ZONE_HIGHMEM) == 0)) {
+            page = zero_pool_pop();
+        }
+    }
+    spin_unlock_irqrestore(&pmm_lock, intr_flag);
+
+    if (page == NULL && (page = alloc_pages_flags(1, flags)) != NULL) {
+        void *kva = kmap(page);
+        memset(kva, 0, PGSIZE);
+        kunmap(kva);
+    }
+    return page;
+}
+
+// zero_pool_fill - zero one free normal page and put it into the zero pool, called by the
+//                - idle process. it returns 0 if the pool is full or the normal zone is too
+//                - low for the pool to grow.
+bool
+zero_pool_fill(void) {
+    struct Page *page = NULL;
+    bool intr_flag;
+    spin_lock_irqsave(&pmm_lock, intr_flag);
+    {
+        struct zone *zone = zones + ZONE_NORMAL;
+        if (nr_zero_pool < ZERO_POOL_PAGES && zone_nr_free(zone) >= KSWAPD_HIGH_PAGES) {
+            page = zone_alloc(zone, 1);
+        }
+    }
+    spin_unlock_irqrestore(&pmm_lock, intr_flag);
+
+    if (page == NULL) {
+        return 0;
+    }
+    // nobody else knows the page, so it is zeroed with interrupts enabled
+    memset(page2kva(page), 0, PGSIZE);
+
+    spin_lock_irqsave(&pmm_lock, intr_flag);
+    {
+        list_add(&zero_pool, &(page->page_link));
+        nr_zero_pool ++;
+    }
+    spin_unlock_irqrestore(&pmm_lock, intr_flag);
+    return 1;
+}
+
+// kmap - a kernel address for the page. a highmem page is mapped into a free slot of the
+//      - kmap window until kunmap, the window is small so a kmap must not be kept for long
+void *
+kmap(struct Page *page) {
+    if (!PageHighMem(page)) {
+        return page2kva(page);
+    }
+    void *kva = NULL;
+    bool intr_flag;
+    spin_lock_irqsave(&kmap_lock, intr_flag);
+    {
+        size_t i;
+        for (i = 0; i < NPTEENTRY; i ++, kmap_next = (kmap_next + 1) % NPTEENTRY) {
+            if (kmap_ptes[kmap_next] == 0) {
+                kmap_ptes[kmap_next] = page2pa(page) | PTE_P | PTE_W;
+                kva = (void *)(KMAP_BASE + kmap_next * PGSIZE);
+                invlpg(kva);
+                break;
+            }
+        }
+    }
+    spin_unlock_irqrestore(&kmap_lock, intr_flag);
+    if (kva == NULL) {
+        panic("kmap: no free slot in the kmap window.\n");
+    }
+    return kva;
+}
+
+// kunmap - release the address kmap returned, nothing to do for a lowmem page
+void
+kunmap(void *kva) {
+    uintptr_t va = (uintptr_t)kva;
+    if (va < KMAP_BASE || va >= KMAP_BASE + KMAP_SIZE) {
+        return ;
+    }
+    bool intr_flag;
+    spin_lock_irqsave(&kmap_lock, intr_flag);
+    {
+        kmap_ptes[PTX(va)] = 0;
+        invlpg(kva);
+    }
+    spin_unlock_irqrestore(&kmap_lock, intr_flag);
+}
+
+// zones_isolate - hide the free pages of all the zones except keep (NULL for none), for the
+//               - checks that need to run out of memory. zones_restore gives them back
+void
+zones_isolate(struct zone *keep, free_area_t store[]) {
+    int i;
+    for (i = 0; i < MAX_NR_ZONES; i ++) {
+        if (zones + i != keep) {
+            store[i] = zones[i].free_area;
+            list_init(&(zones[i].free_area.free_list));
+            zones[i].free_area.nr_free = 0;
+        }
+    }
+}
+
+void
+zones_restore(struct zone *keep, free_area_t store[]) {
+    int i;
+    for (i = 0; i < MAX_NR_ZONES; i ++) {
+        if (zones + i != keep) {
+            zones[i].free_area = store[i];
+        }
+    }
+}
+
 /* pmm_init - initialize the physical memory management */
 static void
 page_init(void) {
@@ -213,13 +538,13 @@ page_init(void) {
         cprintf("  memory: %08llx, [%08llx, %08llx], type = %d.\n",
                 memmap->map[i].size, begin, end - 1, memmap->map[i].type);
         if (memmap->map[i].type == E820_ARM) {
-            if (maxpa < end && begin < KMEMSIZE) {
+            if (maxpa < end && begin < MAXPA) {
                 maxpa = end;
             }
         }
     }
-    if (maxpa > KMEMSIZE) {
-        maxpa = KMEMSIZE;
+    if (maxpa > MAXPA) {
+        maxpa = MAXPA;
     }
 
     extern char end[];
@@ -227,11 +552,34 @@ page_init(void) {
     npage = maxpa / PGSIZE;
     pages = (struct Page *)ROUNDUP((void *)end, PGSIZE);
 
+    // entry.S only maps the first 4M, a larger pages array is mapped with 4M pages,
+    // without PSE the memory is cut down to what fits
+    uintptr_t freemem = PADDR((uintptr_t)pages + sizeof(struct Page) * npage);
+    if (freemem > PTSIZE) {
+        enable_pse();
+        if (pse_enabled) {
+            boot_map_segment(boot_pgdir, KERNBASE, ROUNDUP(freemem, PTSIZE), 0, PTE_W);
+            lcr3(boot_cr3);
+        }
+        else {
+            npage = (PTSIZE - PADDR(pages)) / sizeof(struct Page);
+            freemem = PADDR((uintptr_t)pages + sizeof(struct Page) * npage);
+            cprintf("page_init: no PSE, only %d pages are used.\n", npage);
+        }
+    }
+    lowmem_npage = (npage < KMEMSIZE / PGSIZE) ? npage : KMEMSIZE / PGSIZE;
+
     for (i = 0; i < npage; i ++) {
         SetPageReserved(pages + i);
     }
 
-    uintptr_t freemem = PADDR((uintptr_t)pages + sizeof(struct Page) * npage);
+    size_t zone_end[MAX_NR_ZONES] = {DMAMEMSIZE / PGSIZE, lowmem_npage, npage};
+    size_t pfn = 0;
+    for (i = 0; i < MAX_NR_ZONES; i ++) {
+        zones[i].start_pfn = pfn;
+        zones[i].end_pfn = pfn = (zone_end[i] < npage) ? zone_end[i] : npage;
+        zones[i].managed = 0;
+    }
 
     for (i = 0; i < memmap->nr_map; i ++) {
         uint64_t begin = memmap->map[i].addr, end = begin + memmap->map[i].size;
@@ -239,18 +587,56 @@ page_init(void) {
             if (begin < freemem) {
                 begin = freemem;
             }
-            if (end > KMEMSIZE) {
-                end = KMEMSIZE;
+            if (end > (uint64_t)npage * PGSIZE) {
+                end = (uint64_t)npage * PGSIZE;
             }
-            if (begin < end) {
-                begin = ROUNDUP(begin, PGSIZE);
-                end = ROUNDDOWN(end, PGSIZE);
-                if (begin < end) {
-                    init_memmap(pa2page(begin), (end - begin) / PGSIZE);
+            begin = ROUNDUP(begin, PGSIZE);
+            end = ROUNDDOWN(end, PGSIZE);
+            // a block never crosses a zone boundary
+            int j;
+            for (j = 0; j < MAX_NR_ZONES; j ++) {
+                uint64_t zbegin = (uint64_t)zones[j].start_pfn * PGSIZE;
+                uint64_t zend = (uint64_t)zones[j].end_pfn * PGSIZE;
+                zbegin = (zbegin < begin) ? begin : zbegin;
+                zend = (zend > end) ? end : zend;
+                if (zbegin < zend) {
+                    init_memmap(pa2page(zbegin), (zend - zbegin) / PGSIZE);
                 }
             }
         }
     }
+
+    for (i = 0; i < MAX_NR_ZONES; i ++) {
+        struct zone *zone = zones + i;
+        zone->wmark_min = zone->managed / ZONE_WMARK_RATIO;
+        zone->wmark_low = zone->wmark_min * 2;
+        cprintf("zone %s: [%08llx, %08llx), %d pages, watermark min %d low %d.\n", zone->name,
+                (uint64_t)zone->start_pfn * PGSIZE, (uint64_t)zone->end_pfn * PGSIZE,
+                zone->managed, zone->wmark_min, zone->wmark_low);
+    }
+}
+
+//enable_pse - turn on CR4.PSE if the cpu supports 4M pages
+static void
+enable_pse(void) {
+    uint32_t edx;
+    cpuid(1, NULL, NULL, NULL, &edx);
+    if (edx & CPUID_FEAT_PSE) {
+        lcr4(rcr4() | CR4_PSE);
+        pse_enabled = 1;
+    }
+}
+
+//enable_pge - turn on CR4.PGE if the cpu supports global pages, so the kernel
+//           - mappings survive the cr3 reload of every context switch
+static void
+enable_pge(void) {
+    uint32_t edx;
+    cpuid(1, NULL, NULL, NULL, &edx);
+    if (edx & CPUID_FEAT_PGE) {
+        lcr4(rcr4() | CR4_PGE);
+        kern_global = PTE_G;
+    }
 }
 
 //boot_map_segment - setup&enable the paging mechanism
@@ -259,16 +645,24 @@ page_init(void) {
 //  size: memory size
 //  pa:   physical address of this memory
 //  perm: permission of this memory  
+//note: if PSE is enabled, every 4M aligned chunk is mapped by a single large PDE,
+//      so no page table is allocated for it
 static void
 boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, uintptr_t pa, uint32_t perm) {
     assert(PGOFF(la) == PGOFF(pa));
     size_t n = ROUNDUP(size + PGOFF(la), PGSIZE) / PGSIZE;
     la = ROUNDDOWN(la, PGSIZE);
     pa = ROUNDDOWN(pa, PGSIZE);
-    for (; n > 0; n --, la += PGSIZE, pa += PGSIZE) {
+    while (n > 0) {
+        if (pse_enabled && la % PTSIZE == 0 && pa % PTSIZE == 0 && n >= NPTEENTRY) {
+            pgdir[PDX(la)] = pa | PTE_PS | PTE_P | perm;
+            n -= NPTEENTRY, la += PTSIZE, pa += PTSIZE;
+            continue;
+        }
         pte_t *ptep = get_pte(pgdir, la, 1);
-        assert(ptep != NULL);
+        assert(ptep != NULL && !(*ptep & PTE_PS));
         *ptep = pa | PTE_P | perm;
+        n --, la += PGSIZE, pa += PGSIZE;
     }
 }
 
@@ -291,6 +685,16 @@ pmm_init(void) {
     // We've already enabled paging
     boot_cr3 = PADDR(boot_pgdir);
 
+    // Since we are using bootloader's GDT,
+    // we should reload gdt to get user segments, the TSS and the per-cpu data of the
+    // boot cpu, mycpu() and current work from here on
+    // map virtual_addr 0 ~ 4G = linear_addr 0 ~ 4G
+    // then set kernel stack (ss:esp) in TSS, setup TSS in gdt, load TSS
+    gdt_init(cpus, (uintptr_t)bootstacktop);
+
+    list_init(&zero_pool);
+    nr_zero_pool = 0;
+
     //We need to alloc/free the physical memory (granularity is 4KB or other size). 
     //So a framework of physical memory manager (struct pmm_manager)is defined in pmm.h
     //First we should init a physical memory manager(pmm) based on the framework.
@@ -302,6 +706,10 @@ pmm_init(void) {
     // then use pmm->init_memmap to create free page list
     page_init();
 
+    // boot_pgdir belongs to no mm, its ptes are not accounted.
+    // the struct Page of boot_pgdir only exists from page_init on
+    kva2page(boot_pgdir)->pra_mm = NULL;
+
     //use pmm->check to verify the correctness of the alloc/free function in a pmm
     check_alloc_page();
 
@@ -315,13 +723,24 @@ pmm_init(void) {
 
     // map all physical memory to linear memory with base linear addr KERNBASE
     // linear_addr KERNBASE ~ KERNBASE + KMEMSIZE = phy_addr 0 ~ KMEMSIZE
-    boot_map_segment(boot_pgdir, KERNBASE, KMEMSIZE, 0, PTE_W);
-
-    // Since we are using bootloader's GDT,
-    // we should reload gdt (second time, the last time) to get user segments and the TSS
-    // map virtual_addr 0 ~ 4G = linear_addr 0 ~ 4G
-    // then set kernel stack (ss:esp) in TSS, setup TSS in gdt, load TSS
-    gdt_init();
+    // use 4M global pages when possible, this replaces the boot-time PDE of __boot_pt1,
+    // so the stale (non-global) 4K translations must be flushed
+    enable_pse();
+    enable_pge();
+    boot_map_segment(boot_pgdir, KERNBASE, KMEMSIZE, 0, PTE_W | kern_global);
+    lcr3(boot_cr3);
+
+    // the page table of the kmap window, shared by all the pgdirs copied from boot_pgdir
+    if ((kmap_ptes = get_pte(boot_pgdir, KMAP_BASE, 1)) == NULL) {
+        panic("pmm_init: no memory for the kmap window.\n");
+    }
+    kmap_next = 0;
+    // the page table of the MMIO window, likewise
+    if (get_pte(boot_pgdir, MMIO_BASE, 1) == NULL) {
+        panic("pmm_init: no memory for the MMIO window.\n");
+    }
+    spin_lock_register(&pmm_lock);
+    spin_lock_register(&kmap_lock);
 
     //now the basic virtual memory map(see memalyout.h) is established.
     //check the correctness of the basic virtual memory map.
@@ -331,6 +750,44 @@ pmm_init(void) {
     
     kmalloc_init();
 
+    // the kernel holds a reference to the zero page, so it is never freed
+    if ((zero_page = alloc_page()) == NULL) {
+        panic("pmm_init: no memory for the zero page.\n");
+    }
+    memset(page2kva(zero_page), 0, PGSIZE);
+    set_page_ref(zero_page, 1);
+
+    check_zero_pool();
+}
+
+// pgdir_mm - the mm owning pgdir, NULL for boot_pgdir. setup_pgdir links the page
+//          - of a pgdir back to its mm through pra_mm, pgdir pages are never swappable
+static inline struct mm_struct *
+pgdir_mm(pde_t *pgdir) {
+    return kva2page(pgdir)->pra_mm;
+}
+
+// pte_resident - the pte maps a page of its own (the zero page is not counted)
+static inline bool
+pte_resident(pte_t pte) {
+    return (pte & PTE_P) && pte2page(pte) != zero_page;
+}
+
+// pte_swapped - the pte holds a swap entry
+static inline bool
+pte_swapped(pte_t pte) {
+    return !(pte & PTE_P) && pte != 0;
+}
+
+// pte_account - a pte of pgdir changes from old to new, update the rss and swap
+//             - counters of the mm owning pgdir
+void
+pte_account(pde_t *pgdir, pte_t old, pte_t new) {
+    struct mm_struct *mm = pgdir_mm(pgdir);
+    if (mm != NULL) {
+        mm->rss += pte_resident(new) - pte_resident(old);
+        mm->swap_pages += pte_swapped(new) - pte_swapped(old);
+    }
 }
 
 //get_pte - get pte and return the kernel virtual address of this pte for la
@@ -340,6 +797,7 @@ pmm_init(void) {
 //  la:     the linear address need to map
 //  create: a logical value to decide if alloc a page for PT
 // return vaule: the kernel virtual address of this pte
+//note: if la is mapped by a 4M page (PTE_PS), the pde itself is returned
 pte_t *
 get_pte(pde_t *pgdir, uintptr_t la, bool create) {
     /* LAB2 EXERCISE 2: YOUR CODE
@@ -376,15 +834,21 @@ get_pte(pde_t *pgdir, uintptr_t la, bool create) {
     return NULL;          // (8) return page table entry
 #endif
     pde_t *pdep = &pgdir[PDX(la)];
+    if (*pdep & PTE_PS) {
+        return pdep;
+    }
     if (!(*pdep & PTE_P)) {
         struct Page *page;
-        if (!create || (page = alloc_page()) == NULL) {
+        if (!create || (page = alloc_zeroed_page()) == NULL) {
             return NULL;
         }
         set_page_ref(page, 1);
         uintptr_t pa = page2pa(page);
-        memset(KADDR(pa), 0, PGSIZE);
         *pdep = pa | PTE_U | PTE_W | PTE_P;
+        struct mm_struct *mm = pgdir_mm(pgdir);
+        if (mm != NULL) {
+            mm->pt_pages ++;
+        }
     }
     return &((pte_t *)KADDR(PDE_ADDR(*pdep)))[PTX(la)];
 }
@@ -402,6 +866,32 @@ get_page(pde_t *pgdir, uintptr_t la, pte_t **ptep_store) {
     return NULL;
 }
 
+//__page_remove_pte - drop the page (or swap slot) mapped by ptep and clear it, without touching the TLB
+// return value: 1 if a present pte was cleared
+static inline bool
+__page_remove_pte(pde_t *pgdir, pte_t *ptep) {
+    pte_account(pgdir, *ptep, 0);
+    if (*ptep & PTE_P) {
+        struct Page *page = pte2page(*ptep);
+        // the swap manager must forget the page before its pte goes away
+        if (PageSwap(page) && get_pte(page->pra_mm->pgdir, page->pra_vaddr, 0) == ptep) {
+            swap_set_unswappable(page->pra_mm, page->pra_vaddr);
+        }
+        if (page_ref_dec(page) == 0) {
+            swap_cache_release(page);
+            free_page(page);
+        }
+        *ptep = 0;
+        return 1;
+    }
+    if (*ptep != 0) {
+        // a swap entry, release its slot
+        swap_free(*ptep);
+        *ptep = 0;
+    }
+    return 0;
+}
+
 //page_remove_pte - free an Page sturct which is related linear address la
 //                - and clean(invalidate) pte which is related linear address la
 //note: PT is changed, so the TLB need to be invalidate 
@@ -432,32 +922,34 @@ page_remove_pte(pde_t *pgdir, uintptr_t la, pte_t *ptep) {
                                   //(6) flush tlb
     }
 #endif
-    if (*ptep & PTE_P) {
-        struct Page *page = pte2page(*ptep);
-        if (page_ref_dec(page) == 0) {
-            free_page(page);
-        }
-        *ptep = 0;
+    if (__page_remove_pte(pgdir, ptep)) {
         tlb_invalidate(pgdir, la);
     }
 }
 
+//unmap_range - free the pages mapped in [start, end), the TLB is flushed once at the end
 void
 unmap_range(pde_t *pgdir, uintptr_t start, uintptr_t end) {
     assert(start % PGSIZE == 0 && end % PGSIZE == 0);
     assert(USER_ACCESS(start, end));
 
+    uintptr_t la = start;
+    bool flush = 0;
     do {
-        pte_t *ptep = get_pte(pgdir, start, 0);
+        pte_t *ptep = get_pte(pgdir, la, 0);
         if (ptep == NULL) {
-            start = ROUNDDOWN(start + PTSIZE, PTSIZE);
+            la = ROUNDDOWN(la + PTSIZE, PTSIZE);
             continue ;
         }
         if (*ptep != 0) {
-            page_remove_pte(pgdir, start, ptep);
+            flush |= __page_remove_pte(pgdir, ptep);
         }
-        start += PGSIZE;
-    } while (start != 0 && start < end);
+        la += PGSIZE;
+    } while (la != 0 && la < end);
+
+    if (flush) {
+        tlb_invalidate_range(pgdir, start, end);
+    }
 }
 
 void
@@ -465,15 +957,25 @@ exit_range(pde_t *pgdir, uintptr_t start, uintptr_t end) {
     assert(start % PGSIZE == 0 && end % PGSIZE == 0);
     assert(USER_ACCESS(start, end));
 
-    start = ROUNDDOWN(start, PTSIZE);
+    uintptr_t la = ROUNDDOWN(start, PTSIZE);
+    bool flush = 0;
+    struct mm_struct *mm = pgdir_mm(pgdir);
     do {
-        int pde_idx = PDX(start);
+        int pde_idx = PDX(la);
         if (pgdir[pde_idx] & PTE_P) {
             free_page(pde2page(pgdir[pde_idx]));
             pgdir[pde_idx] = 0;
+            flush = 1;
+            if (mm != NULL) {
+                mm->pt_pages --;
+            }
         }
-        start += PTSIZE;
-    } while (start != 0 && start < end);
+        la += PTSIZE;
+    } while (la != 0 && la < end);
+
+    if (flush) {
+        tlb_invalidate_range(pgdir, ROUNDDOWN(start, PTSIZE), ROUNDUP(end, PTSIZE));
+    }
 }
 /* copy_range - copy content of memory (start, end) of one process A to another process B
  * @to:    the addr of process B's Page Directory
@@ -502,8 +1004,16 @@ copy_range(pde_t *to, pde_t *from, uintptr_t start, uintptr_t end, bool share) {
         uint32_t perm = (*ptep & PTE_USER);
         //get page from ptep
         struct Page *page = pte2page(*ptep);
+        // the zero page is shared, not copied
+        if (page == zero_page) {
+            if (page_insert(to, zero_page, start, perm) != 0) {
+                return -E_NO_MEM;
+            }
+            start += PGSIZE;
+            continue;
+        }
         // alloc a page for process B
-        struct Page *npage=alloc_page();
+        struct Page *npage=alloc_pages_flags(1, ALLOC_HIGHMEM);
         assert(page!=NULL);
         assert(npage!=NULL);
         int ret=0;
@@ -521,14 +1031,24 @@ copy_range(pde_t *to, pde_t *from, uintptr_t start, uintptr_t end, bool share) {
          * (3) memory copy from src_kvaddr to dst_kvaddr, size is PGSIZE
          * (4) build the map of phy addr of  nage with the linear addr start
          */
-        void * kva_src = page2kva(page);
-        void * kva_dst = page2kva(npage);
+        void * kva_src = kmap(page);
+        void * kva_dst = kmap(npage);
     
         memcpy(kva_dst, kva_src, PGSIZE);
+        kunmap(kva_src), kunmap(kva_dst);
 
         ret = page_insert(to, npage, start, perm);
         assert(ret == 0);
         }
+        else if (*ptep != 0) {
+            // a swapped out page, B shares its swap slot with A
+            if ((nptep = get_pte(to, start, 1)) == NULL) {
+                return -E_NO_MEM;
+            }
+            swap_duplicate(*ptep);
+            pte_account(to, *nptep, *ptep);
+            *nptep = *ptep;
+        }
         start += PGSIZE;
     } while (start != 0 && start < end);
     return 0;
@@ -567,18 +1087,89 @@ page_insert(pde_t *pgdir, struct Page *page, uintptr_t la, uint32_t perm) {
             page_remove_pte(pgdir, la, ptep);
         }
     }
-    *ptep = page2pa(page) | PTE_P | perm;
+    pte_t pte = page2pa(page) | PTE_P | perm;
+    pte_account(pgdir, *ptep, pte);
+    *ptep = pte;
     tlb_invalidate(pgdir, la);
     return 0;
 }
 
+// mmio_map_region - map the device memory [pa, pa + size) uncached into the MMIO
+//                 - window, returns its kernel address
+void *
+mmio_map_region(uintptr_t pa, size_t size) {
+    static uintptr_t base = MMIO_BASE;
+    size = ROUNDUP(size + PGOFF(pa), PGSIZE);
+    if (base + size > MMIO_BASE + MMIO_SIZE) {
+        panic("mmio_map_region: the MMIO window is full.\n");
+    }
+    boot_map_segment(boot_pgdir, base, size, ROUNDDOWN(pa, PGSIZE), PTE_W | PTE_PCD | PTE_PWT);
+    void *va = (void *)(base + PGOFF(pa));
+    base += size;
+    return va;
+}
+
+// tlb_flush_pending - flush the TLB of this cpu if another one asked for it
+void
+tlb_flush_pending(void) {
+    struct cpu *c = mycpu();
+    if (c->tlb_flush) {
+        c->tlb_flush = 0;
+        lcr3(rcr3());
+    }
+}
+
+// tlb_shootdown - flush the TLB of the other cpus running on pgdir, and wait until they
+//               - have. called with the kernel lock held, so no other cpu switches to
+//               - pgdir meanwhile, and a cpu spinning on the lock (kernel_wait) has left
+//               - user mode and flushes once it has the lock (see lock_kernel)
+static void
+tlb_shootdown(pde_t *pgdir) {
+    uintptr_t cr3 = PADDR(pgdir);
+    struct cpu *c;
+    for (c = cpus; c < cpus + ncpu; c ++) {
+        if (c != mycpu() && c->started && c->proc != NULL && c->proc->cr3 == cr3) {
+            c->tlb_flush = 1;
+            lapic_ipi(c->apicid, IRQ_OFFSET + IRQ_TLB);
+        }
+    }
+    for (c = cpus; c < cpus + ncpu; c ++) {
+        while (c->tlb_flush && !c->kernel_wait) {
+            cpu_relax();
+        }
+    }
+}
+
 // invalidate a TLB entry, but only if the page tables being
-// edited are the ones currently in use by the processor.
+// edited are the ones currently in use by the processor,
+// on this cpu or on the others
 void
 tlb_invalidate(pde_t *pgdir, uintptr_t la) {
     if (rcr3() == PADDR(pgdir)) {
         invlpg((void *)la);
     }
+    if (ncpu > 1) {
+        tlb_shootdown(pgdir);
+    }
+}
+
+// invalidate the TLB entries of [start, end), page by page for a small range,
+// or by reloading cr3 when the range is large. the kernel mappings are global,
+// so the reload only drops user translations.
+void
+tlb_invalidate_range(pde_t *pgdir, uintptr_t start, uintptr_t end) {
+    if (ncpu > 1) {
+        tlb_shootdown(pgdir);
+    }
+    if (rcr3() == PADDR(pgdir)) {
+        if ((end - start) / PGSIZE > TLB_FLUSH_THRESHOLD) {
+            lcr3(PADDR(pgdir));
+            return ;
+        }
+        for (; start < end; start += PGSIZE) {
+            invlpg((void *)start);
+        }
+    }
 }
 
 // pgdir_alloc_page - call alloc_page & page_insert functions to 
@@ -614,13 +1205,49 @@ pgdir_alloc_page(pde_t *pgdir, uintptr_t la, uint32_t perm) {
 
 static void
 check_alloc_page(void) {
+    // the checks run the normal zone out of memory, the other zones must not help
+    free_area_t store[MAX_NR_ZONES];
+    zones_isolate(zones + ZONE_NORMAL, store);
     pmm_manager->check();
+    zones_restore(zones + ZONE_NORMAL, store);
     cprintf("check_alloc_page() succeeded!\n");
 }
 
+static void
+check_zero_pool(void) {
+    size_t nr_free_store = nr_free_pages();
+    struct Page *p0, *p1;
+
+    // dirty a page, and make sure the pool zeroes it on the way in
+    assert((p0 = alloc_page()) != NULL);
+    memset(page2kva(p0), 0xa5, PGSIZE);
+    free_page(p0);
+    while (zero_pool_fill()) ;
+    assert(nr_zero_pool == ZERO_POOL_PAGES);
+    assert(nr_free_pages() == nr_free_store);
+
+    int i;
+    assert((p1 = alloc_zeroed_page()) != NULL);
+    for (i = 0; i < PGSIZE; i ++) {
+        assert(((char *)page2kva(p1))[i] == 0);
+    }
+    assert(nr_zero_pool == ZERO_POOL_PAGES - 1);
+    free_page(p1);
+
+    bool intr_flag;
+    spin_lock_irqsave(&pmm_lock, intr_flag);
+    {
+        zero_pool_drain();
+    }
+    spin_unlock_irqrestore(&pmm_lock, intr_flag);
+    assert(nr_free_pages() == nr_free_store);
+
+    cprintf("check_zero_pool() succeeded!\n");
+}
+
 static void
 check_pgdir(void) {
-    assert(npage <= KMEMSIZE / PGSIZE);
+    assert(lowmem_npage <= KMEMSIZE / PGSIZE);
     assert(boot_pgdir != NULL && (uint32_t)PGOFF(boot_pgdir) == 0);
     assert(get_page(boot_pgdir, 0x0, NULL) == NULL);
 
@@ -670,9 +1297,14 @@ static void
 check_boot_pgdir(void) {
     pte_t *ptep;
     int i;
-    for (i = 0; i < npage; i += PGSIZE) {
+    for (i = 0; i < lowmem_npage; i += PGSIZE) {
         assert((ptep = get_pte(boot_pgdir, (uintptr_t)KADDR(i), 0)) != NULL);
-        assert(PTE_ADDR(*ptep) == i);
+        if (*ptep & PTE_PS) {
+            assert(pse_enabled && PDE_ADDR(*ptep) == ROUNDDOWN(i, PTSIZE));
+        }
+        else {
+            assert(PTE_ADDR(*ptep) == i);
+        }
     }
 
     assert(PDE_ADDR(boot_pgdir[PDX(VPT)]) == PADDR(boot_pgdir));
@@ -700,14 +1332,15 @@ check_boot_pgdir(void) {
     cprintf("check_boot_pgdir() succeeded!\n");
 }
 
-//perm2str - use string 'u,r,w,-' to present the permission
+//perm2str - use string 'u,r,w,-' to present the permission, and 'L' for a 4M page
 static const char *
 perm2str(int perm) {
-    static char str[4];
+    static char str[5];
     str[0] = (perm & PTE_U) ? 'u' : '-';
     str[1] = 'r';
     str[2] = (perm & PTE_W) ? 'w' : '-';
-    str[3] = '\0';
+    str[3] = (perm & PTE_PS) ? 'L' : '\0';
+    str[4] = '\0';
     return str;
 }
 
@@ -734,8 +1367,8 @@ get_pgtable_items(size_t left, size_t right, size_t start, uintptr_t *table, siz
         if (left_store != NULL) {
             *left_store = start;
         }
-        int perm = (table[start ++] & PTE_USER);
-        while (start < right && (table[start] & PTE_USER) == perm) {
+        int perm = (table[start ++] & (PTE_USER | PTE_PS));
+        while (start < right && (table[start] & (PTE_USER | PTE_PS)) == perm) {
             start ++;
         }
         if (right_store != NULL) {
@@ -754,6 +1387,10 @@ print_pgdir(void) {
     while ((perm = get_pgtable_items(0, NPDEENTRY, right, vpd, &left, &right)) != 0) {
         cprintf("PDE(%03x) %08x-%08x %08x %s\n", right - left,
                 left * PTSIZE, right * PTSIZE, (right - left) * PTSIZE, perm2str(perm));
+        if (perm & PTE_PS) {
+            // a 4M page has no page table below it
+            continue;
+        }
         size_t l, r = left * NPTEENTRY;
         while ((perm = get_pgtable_items(left * NPTEENTRY, right * NPTEENTRY, r, vpt, &l, &r)) != 0) {
             cprintf("  |-- PTE(%05x) %08x-%08x %08x %s\n", r - l,
@@ -26,22 +26,63 @@ extern const struct pmm_manager *pmm_manager;
 extern pde_t *boot_pgdir;
 extern uintptr_t boot_cr3;
 
+// the zones of physical memory, see memlayout.h
+#define ZONE_DMA                0
+#define ZONE_NORMAL             1
+#define ZONE_HIGHMEM            2
+#define MAX_NR_ZONES            3
+
+// a zone has its own free area, the pmm_manager is pointed at it (by free_area) for
+// every call. Allocations fall back from the preferred zone to lower zones, but only
+// while the lower zone stays above its low watermark, so the DMA zone is not eaten
+// up by ordinary allocations.
+struct zone {
+    const char *name;
+    free_area_t free_area;          // the free blocks of the zone, kept by the pmm_manager
+    size_t start_pfn, end_pfn;      // the page frames [start_pfn, end_pfn) of the zone
+    size_t managed;                 // the pages given to the pmm_manager at boot
+    size_t wmark_min;               // the last pages, only handed out when reclaim failed
+    size_t wmark_low;               // fall back into the zone only above this
+};
+
+extern struct zone zones[MAX_NR_ZONES];
+extern free_area_t *free_area;
+
+// alloc_pages_flags flags
+#define ALLOC_DMA               0x1     // the pages must be in the DMA zone
+#define ALLOC_HIGHMEM           0x2     // highmem pages are fine, the caller uses kmap to reach them
+#define ALLOC_NORECLAIM         0x4     // fail rather than reclaim pages or dig into the reserves
+
 void pmm_init(void);
 
+struct Page *alloc_pages_flags(size_t n, uint32_t flags);
 struct Page *alloc_pages(size_t n);
 void free_pages(struct Page *base, size_t n);
 size_t nr_free_pages(void);
+struct Page *alloc_zeroed_page_flags(uint32_t flags);
+bool zero_pool_fill(void);
+void *kmap(struct Page *page);
+void kunmap(void *kva);
+void zones_isolate(struct zone *keep, free_area_t store[]);
+void zones_restore(struct zone *keep, free_area_t store[]);
 
 #define alloc_page() alloc_pages(1)
 #define free_page(page) free_pages(page, 1)
+#define alloc_zeroed_page() alloc_zeroed_page_flags(0)
 
 pte_t *get_pte(pde_t *pgdir, uintptr_t la, bool create);
 struct Page *get_page(pde_t *pgdir, uintptr_t la, pte_t **ptep_store);
+void pte_account(pde_t *pgdir, pte_t old, pte_t new);
 void page_remove(pde_t *pgdir, uintptr_t la);
 int page_insert(pde_t *pgdir, struct Page *page, uintptr_t la, uint32_t perm);
 
+struct cpu;
+void gdt_init(struct cpu *c, uintptr_t esp0);
 void load_esp0(uintptr_t esp0);
+void *mmio_map_region(uintptr_t pa, size_t size);
+void tlb_flush_pending(void);
 void tlb_invalidate(pde_t *pgdir, uintptr_t la);
+void tlb_invalidate_range(pde_t *pgdir, uintptr_t start, uintptr_t end);
 struct Page *pgdir_alloc_page(pde_t *pgdir, uintptr_t la, uint32_t perm);
 void unmap_range(pde_t *pgdir, uintptr_t start, uintptr_t end);
 void exit_range(pde_t *pgdir, uintptr_t start, uintptr_t end);
@@ -64,12 +105,12 @@ void print_pgdir(void);
 
 /* *
  * KADDR - takes a physical address and returns the corresponding kernel virtual
- * address. It panics if you pass an invalid physical address.
+ * address. It panics if you pass an invalid or a highmem physical address.
  * */
 #define KADDR(pa) ({                                                    \
             uintptr_t __m_pa = (pa);                                    \
             size_t __m_ppn = PPN(__m_pa);                               \
-            if (__m_ppn >= npage) {                                     \
+            if (__m_ppn >= lowmem_npage) {                              \
                 panic("KADDR called with invalid pa %08lx", __m_pa);    \
             }                                                           \
             (void *) (__m_pa + KERNBASE);                               \
@@ -77,6 +118,8 @@ void print_pgdir(void);
 
 extern struct Page *pages;
 extern size_t npage;
+extern size_t lowmem_npage;
+extern struct Page *zero_page;
 
 static inline ppn_t
 page2ppn(struct Page *page) {
@@ -96,6 +139,9 @@ pa2page(uintptr_t pa) {
     return &pages[PPN(pa)];
 }
 
+// PageHighMem - the page is above KMEMSIZE, it has no kernel address and needs kmap
+#define PageHighMem(page)       (page2ppn(page) >= lowmem_npage)
+
 static inline void *
 page2kva(struct Page *page) {
     return KADDR(page2pa(page));
@@ -1,6 +1,9 @@
 #include <swap.h>
 #include <swapfs.h>
+#include <error.h>
 #include <swap_fifo.h>
+#include <swap_clock.h>
+#include <swap_lru.h>
 #include <stdio.h>
 #include <string.h>
 #include <memlayout.h>
@@ -8,6 +11,10 @@
 #include <mmu.h>
 #include <default_pmm.h>
 #include <kdebug.h>
+#include <zswap.h>
+#include <proc.h>
+#include <sched.h>
+#include <stdlib.h>
 
 // the valid vaddr for check is between 0~CHECK_VALID_VADDR-1
 #define CHECK_VALID_VIR_PAGE_NUM 5
@@ -23,11 +30,16 @@ size_t max_swap_offset;
 
 volatile int swap_init_ok = 0;
 
+// the kernel thread reclaiming pages in the background
+struct proc_struct *kswapdproc = NULL;
+
 unsigned int swap_page[CHECK_VALID_VIR_PAGE_NUM];
 
 unsigned int swap_in_seq_no[MAX_SEQ_NO],swap_out_seq_no[MAX_SEQ_NO];
 
 static void check_swap(void);
+static void swap_cache_init(void);
+static int kswapd_main(void *arg);
 
 int
 swap_init(void)
@@ -40,7 +52,14 @@ swap_init(void)
      }
      
 
-     sm = &swap_manager_fifo;
+     swap_cache_init();
+     zswap_init();
+     // build with DEFS+=-DSWAP_CLOCK to use the enhanced clock manager
+#if defined(SWAP_CLOCK)
+     sm = &swap_manager_clock;
+#else
+     sm = &swap_manager_lru;
+#endif
      int r = sm->init();
      
      if (r == 0)
@@ -48,6 +67,13 @@ swap_init(void)
           swap_init_ok = 1;
           cprintf("SWAP: manager = %s\n", sm->name);
           check_swap();
+
+          int pid = kernel_thread(kswapd_main, NULL, 0);
+          if (pid <= 0) {
+               panic("create kswapd failed.\n");
+          }
+          kswapdproc = find_proc(pid);
+          set_proc_name(kswapdproc, "kswapd");
      }
 
      return r;
@@ -68,75 +94,385 @@ swap_tick_event(struct mm_struct *mm)
 int
 swap_map_swappable(struct mm_struct *mm, uintptr_t addr, struct Page *page, int swap_in)
 {
+     assert(!PageSwap(page) && page != zero_page);
+     page->pra_mm = mm;
+     page->pra_vaddr = addr;
+     SetPageSwap(page);
      return sm->map_swappable(mm, addr, page, swap_in);
 }
 
 int
 swap_set_unswappable(struct mm_struct *mm, uintptr_t addr)
 {
-     return sm->set_unswappable(mm, addr);
+     pte_t *ptep = get_pte(mm->pgdir, addr, 0);
+     if (ptep == NULL || !(*ptep & PTE_P) || !PageSwap(pte2page(*ptep))) {
+          return 0;
+     }
+     int r = sm->set_unswappable(mm, addr);
+     ClearPageSwap(pte2page(*ptep));
+     return r;
 }
 
 volatile unsigned int swap_out_num=0;
 
+/* *
+ * The swap cache keeps the pages swapped in whose slot is still allocated, hashed by
+ * their swap entry. Such a page holds one reference to its slot, so while its pte stays
+ * clean the slot still has the same content, and the next swap_out just drops the page
+ * without writing it again. Another pte sharing the slot (after fork) copies the cached
+ * page instead of reading the disk.
+ * */
+#define SWAP_CACHE_HASH_SHIFT           10
+#define SWAP_CACHE_HASH_LIST_SIZE       (1 << SWAP_CACHE_HASH_SHIFT)
+#define swap_cache_hashfn(x)            (hash32(x, SWAP_CACHE_HASH_SHIFT))
+
+static list_entry_t swap_cache_hash_list[SWAP_CACHE_HASH_LIST_SIZE];
+
+static void
+swap_cache_init(void) {
+     int i;
+     for (i = 0; i < SWAP_CACHE_HASH_LIST_SIZE; i ++) {
+          list_init(swap_cache_hash_list + i);
+     }
+}
+
+// swap_cache_add - put page into the swap cache, it takes over a reference to the slot of entry
+static void
+swap_cache_add(struct Page *page, swap_entry_t entry) {
+     assert(!PageSwapCache(page));
+     page->swap_entry = entry;
+     SetPageSwapCache(page);
+     list_add(swap_cache_hash_list + swap_cache_hashfn(entry), &(page->swap_link));
+}
+
+// swap_cache_del - take page out of the swap cache, and return the entry it referred to
+static swap_entry_t
+swap_cache_del(struct Page *page) {
+     assert(PageSwapCache(page));
+     list_del(&(page->swap_link));
+     ClearPageSwapCache(page);
+     return page->swap_entry;
+}
+
+static struct Page *
+swap_cache_lookup(swap_entry_t entry) {
+     list_entry_t *list = swap_cache_hash_list + swap_cache_hashfn(entry), *le = list;
+     while ((le = list_next(le)) != list) {
+          struct Page *page = le2page(le, swap_link);
+          if (page->swap_entry == entry) {
+               return page;
+          }
+     }
+     return NULL;
+}
+
+// swap_page_dirty - the page may differ from its copy in the swap slot
+static bool
+swap_page_dirty(struct Page *page) {
+     if (!PageSwap(page)) {
+          return 1;
+     }
+     pte_t *ptep = get_pte(page->pra_mm->pgdir, page->pra_vaddr, 0);
+     return ptep == NULL || (*ptep & PTE_D);
+}
+
+// swap_duplicate - a new pte shares the swap slot of entry
+void
+swap_duplicate(swap_entry_t entry) {
+     swapfs_dup(entry);
+}
+
+// swap_free - a pte holding entry goes away
+void
+swap_free(swap_entry_t entry) {
+     if (swapfs_free(entry) == 0) {
+          zswap_invalidate(entry);
+     }
+}
+
+// swap_read_page - read the content of the slot of entry, from zswap or from the disk
+static int
+swap_read_page(swap_entry_t entry, struct Page *page) {
+     if (zswap_load(entry, page)) {
+          return 0;
+     }
+     return swapfs_read(entry, page);
+}
+
+// swap_cache_release - called when page is freed, drop its slot if it is in the swap cache
+void
+swap_cache_release(struct Page *page) {
+     if (PageSwapCache(page)) {
+          swap_free(swap_cache_del(page));
+     }
+}
+
+// swap_out_page - replace the pte of the victim page with entry, and free the page
+static void
+swap_out_page(struct Page *page, swap_entry_t entry, int i) {
+     struct mm_struct *vmm = page->pra_mm;
+     uintptr_t v = page->pra_vaddr;
+     pte_t *ptep = get_pte(vmm->pgdir, v, 0);
+     cprintf("swap_out: i %d, store page in vaddr 0x%x to disk swap entry %d\n", i, v, swap_offset(entry));
+     pte_account(vmm->pgdir, *ptep, entry);
+     *ptep = entry;
+     free_page(page);
+     tlb_invalidate(vmm->pgdir, v);
+}
+
+// swap_out_cluster - write the n victims in cluster to adjacent slots, one ide command per run
+//                  - of free slots, and evict them
+// return value: the number of pages evicted
+static int
+swap_out_cluster(struct Page **cluster, int n, int i) {
+     int j = 0, k;
+     while (j < n) {
+          swap_entry_t entry;
+          size_t nr = swapfs_alloc_cluster(&entry, n - j);
+          if (nr == 0) {
+               cprintf("SWAP: no free swap slot\n");
+               break;
+          }
+          if (swapfs_write_cluster(entry, cluster + j, nr) != 0) {
+               cprintf("SWAP: failed to save\n");
+               for (k = 0; k < nr; k ++) {
+                    swap_free(entry + swap_entry(k));
+               }
+               break;
+          }
+          for (k = 0; k < nr; k ++, j ++) {
+               swap_out_page(cluster[j], entry + swap_entry(k), i + j);
+          }
+     }
+     // the pages not written go back to the swap manager
+     for (k = j; k < n; k ++) {
+          swap_map_swappable(cluster[k]->pra_mm, cluster[k]->pra_vaddr, cluster[k], 0);
+     }
+     return j;
+}
+
+// swap_out - evict n pages of mm, or of any mm if mm is NULL
+//          - the victims to be written are gathered into clusters of SWAP_CLUSTER_MAX
 int
 swap_out(struct mm_struct *mm, int n, int in_tick)
 {
-     int i;
-     for (i = 0; i != n; ++ i)
+     struct Page *cluster[SWAP_CLUSTER_MAX];
+     int i = 0, nr = 0;
+     while (i + nr != n)
      {
-          uintptr_t v;
           //struct Page **ptr_page=NULL;
           struct Page *page;
           // cprintf("i %d, SWAP: call swap_out_victim\n",i);
           int r = sm->swap_out_victim(mm, &page, in_tick);
           if (r != 0) {
-                    cprintf("i %d, swap_out: call swap_out_victim failed\n",i);
+                    cprintf("i %d, swap_out: call swap_out_victim failed\n",i + nr);
                   break;
           }          
           //assert(!PageReserved(page));
 
           //cprintf("SWAP: choose victim page 0x%08x\n", page);
           
-          v=page->pra_vaddr; 
-          pte_t *ptep = get_pte(mm->pgdir, v, 0);
+          assert(PageSwap(page));
+          ClearPageSwap(page);
+          pte_t *ptep = get_pte(page->pra_mm->pgdir, page->pra_vaddr, 0);
           assert((*ptep & PTE_P) != 0);
 
-          if (swapfs_write( (page->pra_vaddr/PGSIZE+1)<<8, page) != 0) {
-                    cprintf("SWAP: failed to save\n");
-                    sm->map_swappable(mm, v, page, 0);
+          if (PageSwapCache(page)) {
+               // the slot still has the content of a clean page, the pte takes over the
+               // reference of the swap cache
+               swap_entry_t entry = swap_cache_del(page);
+               if (!(*ptep & PTE_D)) {
+                    swap_out_page(page, entry, i ++);
                     continue;
+               }
+               swap_free(entry);
           }
-          else {
-                    cprintf("swap_out: i %d, store page in vaddr 0x%x to disk swap entry %d\n", i, v, page->pra_vaddr/PGSIZE+1);
-                    *ptep = (page->pra_vaddr/PGSIZE+1)<<8;
-                    free_page(page);
+          // a compressible page goes to zswap, the others are written to the disk in clusters
+          swap_entry_t entry;
+          if (zswap_store(page, &entry) == 0) {
+               swap_out_page(page, entry, i ++);
+               continue;
+          }
+          cluster[nr ++] = page;
+          if (nr == SWAP_CLUSTER_MAX) {
+               int done = swap_out_cluster(cluster, nr, i);
+               i += done;
+               if (done != nr) {
+                    return i;
+               }
+               nr = 0;
           }
-          
-          tlb_invalidate(mm->pgdir, v);
+     }
+     if (nr != 0) {
+          i += swap_out_cluster(cluster, nr, i);
      }
      return i;
 }
 
+// swap_readahead_pte - the pte of la if it is the swap entry of the slot at offset, and that
+//                    - slot is neither in the swap cache nor in zswap, so it is read ahead
+static pte_t *
+swap_readahead_pte(struct mm_struct *mm, uintptr_t la, size_t offset) {
+     pte_t *ptep = get_pte(mm->pgdir, la, 0);
+     if (ptep == NULL || (*ptep & PTE_P) || *ptep != swap_entry(offset)) {
+          return NULL;
+     }
+     return (swap_cache_lookup(*ptep) == NULL && !zswap_contains(*ptep)) ? ptep : NULL;
+}
+
+// swap_in_cluster - read the slots of addr and of its neighbours in the vma, whose slots are
+//                 - adjacent in the same order (as swap_out_cluster wrote them), with one
+//                 - ide command. The neighbours are mapped and given to the swap manager, the
+//                 - page of addr is returned for the caller to map.
+static int
+swap_in_cluster(struct mm_struct *mm, uintptr_t addr, struct Page **ptr_result) {
+     struct vma_struct *vma = find_vma(mm, addr);
+     swap_entry_t entry = *get_pte(mm->pgdir, addr, 0);
+     size_t offset = swap_offset(entry);
+     if (zswap_contains(entry)) {
+          struct Page *page = alloc_page();
+          if (page == NULL) {
+               return -E_NO_MEM;
+          }
+          zswap_load(entry, page);
+          // no other pte needs the slot, so free it and the memory in zswap
+          if (swapfs_count(entry) == 1) {
+               swap_free(entry);
+          }
+          else {
+               swap_cache_add(page, entry);
+          }
+          cprintf("swap_in: load zswap swap entry %d with swap_page in vadr 0x%x\n", offset, addr);
+          *ptr_result = page;
+          return 0;
+     }
+     uintptr_t start = addr, end = addr + PGSIZE;
+     // read ahead only with memory to spare, and never for check_swap which counts the faults
+     if (mm != check_mm_struct && vma != NULL && nr_free_pages() >= KSWAPD_HIGH_PAGES) {
+          while (end < vma->vm_end && (end - start) / PGSIZE < SWAP_CLUSTER_MAX
+                 && offset + (end - addr) / PGSIZE < max_swap_offset
+                 && swap_readahead_pte(mm, end, offset + (end - addr) / PGSIZE) != NULL) {
+               end += PGSIZE;
+          }
+          while (start > vma->vm_start && (end - start) / PGSIZE < SWAP_CLUSTER_MAX
+                 && (addr - start) / PGSIZE < offset - 1
+                 && swap_readahead_pte(mm, start - PGSIZE, offset - (addr - start) / PGSIZE - 1) != NULL) {
+               start -= PGSIZE;
+          }
+     }
+
+     struct Page *pages[SWAP_CLUSTER_MAX];
+     int n = (end - start) / PGSIZE, i, r;
+     for (i = 0; i < n; i ++) {
+          if ((pages[i] = alloc_page()) == NULL) {
+               r = -E_NO_MEM;
+               goto failed;
+          }
+     }
+     entry = swap_entry(offset - (addr - start) / PGSIZE);
+     if ((r = swapfs_read_cluster(entry, pages, n)) != 0) {
+          goto failed;
+     }
+
+     uint32_t perm = PTE_U;
+     if (vma != NULL && (vma->vm_flags & VM_WRITE)) {
+          perm |= PTE_W;
+     }
+     uintptr_t la;
+     for (i = 0, la = start; la < end; i ++, la += PGSIZE, entry += swap_entry(1)) {
+          // the reference of the pte goes to the swap cache
+          swap_cache_add(pages[i], entry);
+          if (la == addr) {
+               *ptr_result = pages[i];
+               continue;
+          }
+          page_insert(mm->pgdir, pages[i], la, perm);
+          if (swap_init_ok) {
+               swap_map_swappable(mm, la, pages[i], 1);
+          }
+     }
+     cprintf("swap_in: load disk swap entry %d with swap_page in vadr 0x%x\n", offset, addr);
+     return 0;
+
+failed:
+     while (-- i >= 0) {
+          free_page(pages[i]);
+     }
+     return r;
+}
+
 int
 swap_in(struct mm_struct *mm, uintptr_t addr, struct Page **ptr_result)
 {
-     struct Page *result = alloc_page();
-     assert(result!=NULL);
-
      pte_t *ptep = get_pte(mm->pgdir, addr, 0);
-     // cprintf("SWAP: load ptep %x swap entry %d to vaddr 0x%08x, page %x, No %d\n", ptep, (*ptep)>>8, addr, result, (result-pages));
-    
-     int r;
-     if ((r = swapfs_read((*ptep), result)) != 0)
-     {
-        assert(r!=0);
+     swap_entry_t entry = *ptep;
+     // cprintf("SWAP: load ptep %x swap entry %d to vaddr 0x%08x\n", ptep, (*ptep)>>8, addr);
+
+     struct Page *page = swap_cache_lookup(entry);
+     if (page == NULL) {
+          return swap_in_cluster(mm, addr, ptr_result);
+     }
+
+     struct Page *result = alloc_page();
+     if (result == NULL) {
+          return -E_NO_MEM;
+     }
+     if (!swap_page_dirty(page)) {
+          // another pte shares the slot, and its page still has the same content
+          void *dst = kmap(result), *src = kmap(page);
+          memcpy(dst, src, PGSIZE);
+          kunmap(src), kunmap(dst);
+     }
+     else {
+          int r;
+          if ((r = swap_read_page(entry, result)) != 0) {
+               free_page(result);
+               return r;
+          }
      }
-     cprintf("swap_in: load disk swap entry %d with swap_page in vadr 0x%x\n", (*ptep)>>8, addr);
+     // the slot is cached already, the reference of the pte just goes
+     swap_free(entry);
+     cprintf("swap_in: load disk swap entry %d with swap_page in vadr 0x%x\n", swap_offset(entry), addr);
      *ptr_result=result;
      return 0;
 }
 
+// kswapd_wakeup - kick kswapd to reclaim pages now, called when free memory is low
+void
+kswapd_wakeup(void)
+{
+     if (kswapdproc != NULL && kswapdproc->state == PROC_SLEEPING) {
+          wakeup_proc(kswapdproc);
+     }
+}
+
+// kswapd_main - age the pages every KSWAPD_INTERVAL ticks, and once free memory drops
+//             - below the low watermark, evict the coldest pages of all processes
+//             - until the high watermark is reached
+static int
+kswapd_main(void *arg)
+{
+     while (1) {
+          do_sleep(KSWAPD_INTERVAL);
+          swap_tick_event(NULL);
+
+          size_t nr_free = nr_free_pages();
+          if (nr_free >= KSWAPD_LOW_PAGES) {
+               continue;
+          }
+          // the cached kernel stacks go first, they cost no I/O
+          kstack_cache_drain();
+          nr_free = nr_free_pages();
+          while (nr_free < KSWAPD_HIGH_PAGES) {
+               if (swap_out(NULL, KSWAPD_HIGH_PAGES - nr_free, 0) == 0) {
+                    break;
+               }
+               nr_free = nr_free_pages();
+          }
+     }
+     return 0;
+}
+
 
 
 static inline void
@@ -171,23 +507,21 @@ struct Page * check_rp[CHECK_VALID_PHY_PAGE_NUM];
 pte_t * check_ptep[CHECK_VALID_PHY_PAGE_NUM];
 unsigned int check_swap_addr[CHECK_VALID_VIR_PAGE_NUM];
 
-extern free_area_t free_area;
-
-#define free_list (free_area.free_list)
-#define nr_free (free_area.nr_free)
-
 static void
 check_swap(void)
 {
     //backup mem env
-     int ret, count = 0, total = 0, i;
-     list_entry_t *le = &free_list;
-     while ((le = list_next(le)) != &free_list) {
-        struct Page *p = le2page(le, page_link);
-        assert(PageProperty(p));
-        count ++, total += p->property;
+     int ret, count = 0, total = 0, i, z;
+     for (z = 0; z < MAX_NR_ZONES; z ++) {
+          list_entry_t *free_list = &(zones[z].free_area.free_list), *le = free_list;
+          while ((le = list_next(le)) != free_list) {
+               struct Page *p = le2page(le, page_link);
+               assert(PageProperty(p));
+               count ++, total += p->property;
+          }
      }
      assert(total == nr_free_pages());
+     size_t nr_free_slots_store = swapfs_nr_free();
      cprintf("BEGIN check_swap: count %d, total %d\n",count,total);
      
      //now we set the phy pages env     
@@ -219,18 +553,15 @@ check_swap(void)
           assert(check_rp[i] != NULL );
           assert(!PageProperty(check_rp[i]));
      }
-     list_entry_t free_list_store = free_list;
-     list_init(&free_list);
-     assert(list_empty(&free_list));
-     
-     //assert(alloc_page() == NULL);
+     // hide the free pages of all the zones, only the check pages are left
+     free_area_t free_area_store[MAX_NR_ZONES];
+     zones_isolate(NULL, free_area_store);
+     assert(nr_free_pages() == 0);
      
-     unsigned int nr_free_store = nr_free;
-     nr_free = 0;
      for (i=0;i<CHECK_VALID_PHY_PAGE_NUM;i++) {
         free_pages(check_rp[i],1);
      }
-     assert(nr_free==CHECK_VALID_PHY_PAGE_NUM);
+     assert(nr_free_pages()==CHECK_VALID_PHY_PAGE_NUM);
      
      cprintf("set up init env for check_swap begin!\n");
      //setup initial vir_page<->phy_page environment for page relpacement algorithm 
@@ -239,7 +570,7 @@ check_swap(void)
      pgfault_num=0;
      
      check_content_set();
-     assert( nr_free == 0);         
+     assert( nr_free_pages() == 0);         
      for(i = 0; i<MAX_SEQ_NO ; i++) 
          swap_out_seq_no[i]=swap_in_seq_no[i]=-1;
      
@@ -257,10 +588,24 @@ check_swap(void)
      assert(ret==0);
      
      //restore kernel mem env
+     for (i=0;i<CHECK_VALID_VIR_PAGE_NUM;i++) {
+         pte_t *ptep = get_pte(pgdir, (i+1)*0x1000, 0);
+         if (*ptep & PTE_P) {
+             swap_cache_release(pte2page(*ptep));
+         }
+         else if (*ptep != 0) {
+             swap_free(*ptep);
+         }
+         *ptep = 0;
+     }
+     assert(swapfs_nr_free() == nr_free_slots_store);
      for (i=0;i<CHECK_VALID_PHY_PAGE_NUM;i++) {
          free_pages(check_rp[i],1);
      } 
 
+     // forget the pages of check_mm_struct
+     sm->init();
+
      //free_page(pte2page(*temp_ptep));
     free_page(pde2page(pgdir[0]));
      pgdir[0] = 0;
@@ -268,14 +613,15 @@ check_swap(void)
      mm_destroy(mm);
      check_mm_struct = NULL;
      
-     nr_free = nr_free_store;
-     free_list = free_list_store;
+     zones_restore(NULL, free_area_store);
 
      
-     le = &free_list;
-     while ((le = list_next(le)) != &free_list) {
-         struct Page *p = le2page(le, page_link);
-         count --, total -= p->property;
+     for (z = 0; z < MAX_NR_ZONES; z ++) {
+          list_entry_t *free_list = &(zones[z].free_area.free_list), *le = free_list;
+          while ((le = list_next(le)) != free_list) {
+               struct Page *p = le2page(le, page_link);
+               count --, total -= p->property;
+          }
      }
      cprintf("count is %d, total is %d\n",count,total);
      //assert(count == 0);
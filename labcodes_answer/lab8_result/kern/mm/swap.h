@@ -30,6 +30,27 @@ extern size_t max_swap_offset;
                __offset;                                            \
           })
 
+// swap_entry - the swap entry of the slot at offset
+#define swap_entry(offset)                      ((swap_entry_t)(offset) << 8)
+
+// swap_out writes up to SWAP_CLUSTER_MAX victims to adjacent slots with one ide command,
+// and swap_in reads up to as many adjacent slots of the same vma at once
+#define SWAP_CLUSTER_MAX                        8
+
+// kswapd reclaims pages when free memory drops below KSWAPD_LOW_PAGES,
+// until there are KSWAPD_HIGH_PAGES free pages again
+#define KSWAPD_LOW_PAGES                        128
+#define KSWAPD_HIGH_PAGES                       256
+// kswapd wakes up every KSWAPD_INTERVAL ticks to age the pages
+#define KSWAPD_INTERVAL                         100
+
+/* *
+ * The swap manager keeps all the swappable pages of all mm's. swap_map_swappable
+ * records the mm and vaddr mapping a page in page->pra_mm and page->pra_vaddr, so
+ * swap_out_victim may pick the victim from any mm, and swap_out evicts it from
+ * page->pra_mm. A non-NULL mm asks swap_out_victim for a page of that mm only, it
+ * is used to keep a mm within its resident limit.
+ * */
 struct swap_manager
 {
      const char *name;
@@ -37,7 +58,7 @@ struct swap_manager
      int (*init)            (void);
      /* Initialize the priv data inside mm_struct */
      int (*init_mm)         (struct mm_struct *mm);
-     /* Called when tick interrupt occured */
+     /* Called periodically by kswapd to age the pages */
      int (*tick_event)      (struct mm_struct *mm);
      /* Called when map a swappable page into the mm_struct */
      int (*map_swappable)   (struct mm_struct *mm, uintptr_t addr, struct Page *page, int swap_in);
@@ -58,6 +79,12 @@ int swap_map_swappable(struct mm_struct *mm, uintptr_t addr, struct Page *page,
 int swap_set_unswappable(struct mm_struct *mm, uintptr_t addr);
 int swap_out(struct mm_struct *mm, int n, int in_tick);
 int swap_in(struct mm_struct *mm, uintptr_t addr, struct Page **ptr_result);
+void kswapd_wakeup(void);
+void swap_duplicate(swap_entry_t entry);
+void swap_free(swap_entry_t entry);
+void swap_cache_release(struct Page *page);
+
+extern struct proc_struct *kswapdproc;
 
 //#define MEMBER_OFFSET(m,t) ((int)(&((t *)0)->m))
 //#define FROM_MEMBER(m,t,a) ((t *)((char *)(a) - MEMBER_OFFSET(m,t)))
@@ -0,0 +1,255 @@
+#include <defs.h>
+#include <x86.h>
+#include <stdio.h>
+#include <string.h>
+#include <error.h>
+#include <pmm.h>
+#include <swap.h>
+#include <swap_clock.h>
+#include <list.h>
+
+/* The enhanced CLOCK (second chance) Page Replacement Algorithm.
+ *
+ * The swappable pages are kept in a circular list in arrival order, and a clock hand
+ * points to the next page to examine. Each page is classified by the (accessed, dirty)
+ * bits of its pte, which the MMU sets on every read/write:
+ *   (0, 0) not recently used, clean  -- the best victim, nothing changed since it was loaded
+ *   (0, 1) not recently used, dirty  -- must be written back before it is reused
+ *   (1, 0) recently used, clean      -- probably used again soon
+ *   (1, 1) recently used, dirty      -- the worst victim
+ * swap_out_victim sweeps the list at most four times:
+ *   (1) look for (0, 0) without changing anything;
+ *   (2) look for (0, 1), clearing the accessed bit of every page it passes;
+ *   (3) and (4) repeat (1) and (2), which must succeed since all accessed bits are cleared now.
+ * New pages are linked just behind the hand, so they are examined last.
+ *
+ * tick_event ages the pages in the background: kswapd calls it every KSWAPD_INTERVAL
+ * ticks, it moves the hand over a few pages and clears their accessed bits, so a page
+ * has to be touched again between two sweeps to keep its second chance.
+ *
+ * The pages of a locked mm may have their ptes changed under us, they are skipped.
+ */
+
+// the number of pages the hand passes in one tick_event
+#define CLOCK_TICK_SCAN             4
+
+static list_entry_t pra_list_head;
+// the clock hand, &pra_list_head if the list is empty
+static list_entry_t *pra_hand;
+
+// clock_pte - get the pte of a swappable page
+static inline pte_t *
+clock_pte(struct Page *page) {
+    pte_t *ptep = get_pte(page->pra_mm->pgdir, page->pra_vaddr, 0);
+    assert(ptep != NULL && (*ptep & PTE_P));
+    return ptep;
+}
+
+// clock_hand_next - move the clock hand to the next page, skipping the list head
+static inline void
+clock_hand_next(void) {
+    if ((pra_hand = list_next(pra_hand)) == &pra_list_head) {
+        pra_hand = list_next(pra_hand);
+    }
+}
+
+// clock_clear_accessed - take the accessed bit of the page under the hand away
+static inline void
+clock_clear_accessed(struct Page *page) {
+    pte_t *ptep = clock_pte(page);
+    if (*ptep & PTE_A) {
+        *ptep &= ~PTE_A;
+        tlb_invalidate(page->pra_mm->pgdir, page->pra_vaddr);
+    }
+}
+
+// clock_eligible - the page may be evicted by a reclaim of mm (any mm if NULL)
+static inline bool
+clock_eligible(struct Page *page, struct mm_struct *mm) {
+    if (mm != NULL) {
+        return page->pra_mm == mm;
+    }
+    return !mm_is_locked(page->pra_mm);
+}
+
+static int
+_clock_init_mm(struct mm_struct *mm)
+{
+     mm->sm_priv = &pra_list_head;
+     return 0;
+}
+
+static int
+_clock_map_swappable(struct mm_struct *mm, uintptr_t addr, struct Page *page, int swap_in)
+{
+    list_entry_t *head = &pra_list_head;
+    list_entry_t *entry = &(page->pra_page_link);
+
+    // link the page just behind the hand, it is the last one the hand reaches
+    list_add_before(pra_hand, entry);
+    if (pra_hand == head) {
+        pra_hand = entry;
+    }
+    return 0;
+}
+
+static int
+_clock_swap_out_victim(struct mm_struct *mm, struct Page **ptr_page, int in_tick)
+{
+    list_entry_t *head = &pra_list_head;
+    assert(in_tick == 0);
+    if (list_empty(head) || (mm != NULL && mm_is_locked(mm))) {
+        return -E_NO_MEM;
+    }
+
+    int round, i, nr_pages = 0, nr_own = 0;
+    list_entry_t *le = head;
+    while ((le = list_next(le)) != head) {
+        nr_pages ++;
+        if (clock_eligible(le2page(le, pra_page_link), mm)) {
+            nr_own ++;
+        }
+    }
+    if (nr_own == 0) {
+        return -E_NO_MEM;
+    }
+
+    // a local reclaim sweeps over the pages of other mm's without looking at them
+    for (round = 0; round < 4; round ++) {
+        for (i = 0; i < nr_pages; i ++, clock_hand_next()) {
+            struct Page *page = le2page(pra_hand, pra_page_link);
+            if (!clock_eligible(page, mm)) {
+                continue;
+            }
+            pte_t *ptep = clock_pte(page);
+            if (round % 2 == 0) {
+                if (!(*ptep & (PTE_A | PTE_D))) {
+                    goto found;
+                }
+            }
+            else {
+                if (!(*ptep & PTE_A) && (*ptep & PTE_D)) {
+                    goto found;
+                }
+                clock_clear_accessed(page);
+            }
+        }
+    }
+    panic("clock: no victim after four sweeps.\n");
+
+found:
+    le = pra_hand;
+    clock_hand_next();
+    list_del(le);
+    if (pra_hand == le) {
+        pra_hand = head;
+    }
+    *ptr_page = le2page(le, pra_page_link);
+    return 0;
+}
+
+// clock_clear_bits - pretend the pages were written back and not used for a while
+static void
+clock_clear_bits(void) {
+    list_entry_t *head = &pra_list_head, *le = head;
+    while ((le = list_next(le)) != head) {
+        struct Page *page = le2page(le, pra_page_link);
+        pte_t *ptep = clock_pte(page);
+        *ptep &= ~(PTE_A | PTE_D);
+        tlb_invalidate(page->pra_mm->pgdir, page->pra_vaddr);
+    }
+}
+
+static int
+_clock_check_swap(void) {
+    // a, b, c and d are all recently used and dirty after check_content_set
+    clock_clear_bits();
+    cprintf("read Virt Page a in clock_check_swap\n");
+    assert(*(unsigned char *)0x1000 == 0x0a);
+    cprintf("write Virt Page b in clock_check_swap\n");
+    *(unsigned char *)0x2000 = 0x0b;
+    cprintf("write Virt Page c in clock_check_swap\n");
+    *(unsigned char *)0x3000 = 0x0c;
+    assert(pgfault_num==4);
+    // d is the only page neither accessed nor dirty
+    cprintf("write Virt Page e in clock_check_swap\n");
+    *(unsigned char *)0x5000 = 0x0e;
+    assert(pgfault_num==5);
+    cprintf("read Virt Page a in clock_check_swap\n");
+    assert(*(unsigned char *)0x1000 == 0x0a);
+    assert(pgfault_num==5);
+    // all accessed, the second sweep clears them, a is the only clean one
+    cprintf("write Virt Page d in clock_check_swap\n");
+    assert(*(unsigned char *)0x4000 == 0x0d);
+    *(unsigned char *)0x4000 = 0x0d;
+    assert(pgfault_num==6);
+    cprintf("write Virt Page b in clock_check_swap\n");
+    *(unsigned char *)0x2000 = 0x0b;
+    assert(pgfault_num==6);
+    // d and b were used again, c is the first one not accessed
+    cprintf("read Virt Page a in clock_check_swap\n");
+    assert(*(unsigned char *)0x1000 == 0x0a);
+    assert(pgfault_num==7);
+    cprintf("read Virt Page c in clock_check_swap\n");
+    assert(*(unsigned char *)0x3000 == 0x0c);
+    assert(pgfault_num==8);
+    // e went out last, and comes back intact
+    cprintf("read Virt Page e in clock_check_swap\n");
+    assert(*(unsigned char *)0x5000 == 0x0e);
+    assert(pgfault_num==9);
+    return 0;
+}
+
+static int
+_clock_init(void)
+{
+    list_init(&pra_list_head);
+    pra_hand = &pra_list_head;
+    return 0;
+}
+
+static int
+_clock_set_unswappable(struct mm_struct *mm, uintptr_t addr)
+{
+    pte_t *ptep = get_pte(mm->pgdir, addr, 0);
+    if (ptep == NULL || !(*ptep & PTE_P)) {
+        return -E_INVAL;
+    }
+    list_entry_t *le = &(pte2page(*ptep)->pra_page_link);
+    if (pra_hand == le) {
+        clock_hand_next();
+        if (pra_hand == le) {
+            pra_hand = &pra_list_head;
+        }
+    }
+    list_del_init(le);
+    return 0;
+}
+
+static int
+_clock_tick_event(struct mm_struct *mm)
+{
+    int i;
+    if (list_empty(&pra_list_head)) {
+        return 0;
+    }
+    for (i = 0; i < CLOCK_TICK_SCAN; i ++, clock_hand_next()) {
+        struct Page *page = le2page(pra_hand, pra_page_link);
+        if (!mm_is_locked(page->pra_mm)) {
+            clock_clear_accessed(page);
+        }
+    }
+    return 0;
+}
+
+struct swap_manager swap_manager_clock =
+{
+     .name            = "enhanced clock swap manager",
+     .init            = &_clock_init,
+     .init_mm         = &_clock_init_mm,
+     .tick_event      = &_clock_tick_event,
+     .map_swappable   = &_clock_map_swappable,
+     .set_unswappable = &_clock_set_unswappable,
+     .swap_out_victim = &_clock_swap_out_victim,
+     .check_swap      = &_clock_check_swap,
+};
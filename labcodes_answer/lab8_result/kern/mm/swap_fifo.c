@@ -2,6 +2,8 @@
 #include <x86.h>
 #include <stdio.h>
 #include <string.h>
+#include <error.h>
+#include <pmm.h>
 #include <swap.h>
 #include <swap_fifo.h>
 #include <list.h>
@@ -27,13 +29,12 @@
 
 list_entry_t pra_list_head;
 /*
- * (2) _fifo_init_mm: init pra_list_head and let  mm->sm_priv point to the addr of pra_list_head.
- *              Now, From the memory control struct mm_struct, we can access FIFO PRA
+ * (2) _fifo_init_mm: let mm->sm_priv point to the addr of pra_list_head.
+ *              pra_list_head is shared by all the mm's, so it is only initialized in _fifo_init.
  */
 static int
 _fifo_init_mm(struct mm_struct *mm)
 {     
-     list_init(&pra_list_head);
      mm->sm_priv = &pra_list_head;
      //cprintf(" mm->sm_priv %x in fifo_init_mm\n",mm->sm_priv);
      return 0;
@@ -44,7 +45,7 @@ _fifo_init_mm(struct mm_struct *mm)
 static int
 _fifo_map_swappable(struct mm_struct *mm, uintptr_t addr, struct Page *page, int swap_in)
 {
-    list_entry_t *head=(list_entry_t*) mm->sm_priv;
+    list_entry_t *head=&pra_list_head;
     list_entry_t *entry=&(page->pra_page_link);
  
     assert(entry != NULL && head != NULL);
@@ -61,8 +62,7 @@ _fifo_map_swappable(struct mm_struct *mm, uintptr_t addr, struct Page *page, int
 static int
 _fifo_swap_out_victim(struct mm_struct *mm, struct Page ** ptr_page, int in_tick)
 {
-     list_entry_t *head=(list_entry_t*) mm->sm_priv;
-         assert(head != NULL);
+     list_entry_t *head=&pra_list_head;
      assert(in_tick==0);
      /* Select the victim */
      /*LAB3 EXERCISE 2: YOUR CODE*/ 
@@ -70,7 +70,13 @@ _fifo_swap_out_victim(struct mm_struct *mm, struct Page ** ptr_page, int in_tick
      //(2)  assign the value of *ptr_page to the addr of this page
      /* Select the tail */
      list_entry_t *le = head->prev;
-     assert(head!=le);
+     // a local reclaim takes the earliest page of mm
+     while (le != head && mm != NULL && le2page(le, pra_page_link)->pra_mm != mm) {
+          le = le->prev;
+     }
+     if (head == le) {
+          return -E_NO_MEM;
+     }
      struct Page *p = le2page(le, pra_page_link);
      list_del(le);
      assert(p !=NULL);
@@ -124,12 +130,16 @@ _fifo_check_swap(void) {
 static int
 _fifo_init(void)
 {
+    list_init(&pra_list_head);
     return 0;
 }
 
 static int
 _fifo_set_unswappable(struct mm_struct *mm, uintptr_t addr)
 {
+    pte_t *ptep = get_pte(mm->pgdir, addr, 0);
+    assert(ptep != NULL && (*ptep & PTE_P));
+    list_del_init(&(pte2page(*ptep)->pra_page_link));
     return 0;
 }
 
@@ -0,0 +1,278 @@
+#include <defs.h>
+#include <x86.h>
+#include <stdio.h>
+#include <string.h>
+#include <error.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <swap.h>
+#include <swap_lru.h>
+#include <list.h>
+
+/* The global LRU Page Replacement Algorithm, approximated with two lists.
+ *
+ * All the swappable pages of all mm's are on one of two global lists:
+ *   active   -- pages used recently, new pages start here;
+ *   inactive -- candidates for eviction.
+ * Both lists have their newest pages at the head and oldest at the tail.
+ *
+ * lru_shrink_active keeps the inactive list at least as long as the active one. It moves
+ * pages from the active tail, and a page whose pte was accessed since the last look gets
+ * its accessed bit cleared and goes back to the active head instead.
+ * swap_out_victim scans the inactive tail. A page accessed again is promoted to the active
+ * list, the first unaccessed one is the victim. So a victim is a page nobody touched during
+ * a full trip through both lists, whichever process it belongs to, and an idle process
+ * gives up its cold pages before a busy one loses its working set.
+ *
+ * The working set of a mm is estimated with its page fault frequency (mm_pff). A mm
+ * faulting more than PFF_HIGH times per window is growing its working set, so its pages
+ * are skipped in the first scan of the inactive list, and only taken if no other process
+ * has a cold page.
+ *
+ * Pages of a mm locked with lock_mm are always skipped, their ptes may be in use (eg. by
+ * dup_mmap copying them).
+ *
+ * A local reclaim (swap_out_victim with a mm) only looks at the pages of that mm, from the
+ * inactive tail to the active head. It gives accessed pages one more pass, but ignores
+ * the pff, since the mm is over its resident limit however busy it is.
+ */
+
+// a mm with a higher page fault frequency keeps its inactive pages in the first scan
+#define PFF_HIGH                    16
+// the number of active pages tick_event looks at
+#define LRU_TICK_SCAN               32
+
+static list_entry_t lru_active, lru_inactive;
+static size_t nr_active, nr_inactive;
+
+// lru_pte - get the pte of a swappable page
+static inline pte_t *
+lru_pte(struct Page *page) {
+    pte_t *ptep = get_pte(page->pra_mm->pgdir, page->pra_vaddr, 0);
+    assert(ptep != NULL && (*ptep & PTE_P));
+    return ptep;
+}
+
+// lru_test_clear_accessed - clear the accessed bit of the page, and return its old value
+static inline bool
+lru_test_clear_accessed(struct Page *page) {
+    pte_t *ptep = lru_pte(page);
+    if (*ptep & PTE_A) {
+        *ptep &= ~PTE_A;
+        tlb_invalidate(page->pra_mm->pgdir, page->pra_vaddr);
+        return 1;
+    }
+    return 0;
+}
+
+static inline void
+lru_add_active(struct Page *page) {
+    SetPageActive(page);
+    list_add(&lru_active, &(page->pra_page_link));
+    nr_active ++;
+}
+
+static inline void
+lru_add_inactive(struct Page *page) {
+    ClearPageActive(page);
+    list_add(&lru_inactive, &(page->pra_page_link));
+    nr_inactive ++;
+}
+
+static inline void
+lru_del(struct Page *page) {
+    list_del_init(&(page->pra_page_link));
+    if (PageActive(page)) {
+        nr_active --;
+    }
+    else {
+        nr_inactive --;
+    }
+    ClearPageActive(page);
+}
+
+// lru_shrink_active - move the unaccessed pages from the active tail to the inactive list,
+//                   - until the inactive list is no shorter than the active one
+static void
+lru_shrink_active(void) {
+    size_t nr_scan = nr_active * 2;
+    while (nr_inactive < nr_active && nr_scan -- > 0) {
+        struct Page *page = le2page(list_prev(&lru_active), pra_page_link);
+        lru_del(page);
+        if (!mm_is_locked(page->pra_mm) && lru_test_clear_accessed(page)) {
+            lru_add_active(page);
+        }
+        else {
+            lru_add_inactive(page);
+        }
+    }
+}
+
+static int
+_lru_init_mm(struct mm_struct *mm)
+{
+    mm->sm_priv = NULL;
+    return 0;
+}
+
+static int
+_lru_map_swappable(struct mm_struct *mm, uintptr_t addr, struct Page *page, int swap_in)
+{
+    lru_add_active(page);
+    return 0;
+}
+
+// lru_local_victim - find the victim among the pages of mm
+static struct Page *
+lru_local_victim(struct mm_struct *mm) {
+    int pass, i;
+    for (pass = 0; pass < 2; pass ++) {
+        list_entry_t *lists[2] = {&lru_inactive, &lru_active};
+        for (i = 0; i < 2; i ++) {
+            list_entry_t *head = lists[i], *le = list_prev(head);
+            while (le != head) {
+                struct Page *page = le2page(le, pra_page_link);
+                le = list_prev(le);
+                if (page->pra_mm != mm) {
+                    continue;
+                }
+                // accessed pages stay where they are, so each one is looked at once a pass
+                if (pass == 0 && lru_test_clear_accessed(page)) {
+                    continue;
+                }
+                lru_del(page);
+                return page;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int
+_lru_swap_out_victim(struct mm_struct *mm, struct Page **ptr_page, int in_tick)
+{
+    assert(in_tick == 0);
+    if (mm != NULL) {
+        if (mm_is_locked(mm) || (*ptr_page = lru_local_victim(mm)) == NULL) {
+            return -E_NO_MEM;
+        }
+        return 0;
+    }
+    int pass;
+    for (pass = 0; pass < 2; pass ++) {
+        lru_shrink_active();
+        size_t nr_scan = nr_inactive;
+        while (nr_scan -- > 0) {
+            struct Page *page = le2page(list_prev(&lru_inactive), pra_page_link);
+            struct mm_struct *vmm = page->pra_mm;
+            lru_del(page);
+            if (mm_is_locked(vmm)) {
+                lru_add_inactive(page);
+                continue;
+            }
+            if (lru_test_clear_accessed(page)) {
+                lru_add_active(page);
+                continue;
+            }
+            if (pass == 0 && mm_pff(vmm) > PFF_HIGH) {
+                lru_add_inactive(page);
+                continue;
+            }
+            *ptr_page = page;
+            return 0;
+        }
+    }
+    return -E_NO_MEM;
+}
+
+static int
+_lru_check_swap(void) {
+    // a, b, c and d are on the active list after check_content_set, clear their bits
+    list_entry_t *le = &lru_active;
+    while ((le = list_next(le)) != &lru_active) {
+        struct Page *page = le2page(le, pra_page_link);
+        *lru_pte(page) &= ~(PTE_A | PTE_D);
+        tlb_invalidate(page->pra_mm->pgdir, page->pra_vaddr);
+    }
+    cprintf("read Virt Page b in lru_check_swap\n");
+    assert(*(unsigned char *)0x2000 == 0x0b);
+    cprintf("read Virt Page d in lru_check_swap\n");
+    assert(*(unsigned char *)0x4000 == 0x0d);
+    assert(pgfault_num==4);
+    // b and d stay active, the oldest of a and c goes
+    cprintf("write Virt Page e in lru_check_swap\n");
+    *(unsigned char *)0x5000 = 0x0e;
+    assert(pgfault_num==5);
+    assert(nr_active == 3 && nr_inactive == 1);
+    // c is on the inactive list, using it saves it from eviction
+    cprintf("read Virt Page c in lru_check_swap\n");
+    assert(*(unsigned char *)0x3000 == 0x0c);
+    assert(pgfault_num==5);
+    cprintf("read Virt Page a in lru_check_swap\n");
+    assert(*(unsigned char *)0x1000 == 0x0a);
+    assert(pgfault_num==6);
+    assert(nr_active == 4 && nr_inactive == 0);
+    cprintf("read Virt Page b in lru_check_swap\n");
+    assert(*(unsigned char *)0x2000 == 0x0b);
+    assert(pgfault_num==7);
+    cprintf("read Virt Page d in lru_check_swap\n");
+    assert(*(unsigned char *)0x4000 == 0x0d);
+    assert(pgfault_num==8);
+    cprintf("read Virt Page c in lru_check_swap\n");
+    assert(*(unsigned char *)0x3000 == 0x0c);
+    assert(pgfault_num==9);
+    cprintf("read Virt Page e in lru_check_swap\n");
+    assert(*(unsigned char *)0x5000 == 0x0e);
+    assert(pgfault_num==10);
+    return 0;
+}
+
+static int
+_lru_init(void)
+{
+    list_init(&lru_active);
+    list_init(&lru_inactive);
+    nr_active = nr_inactive = 0;
+    return 0;
+}
+
+static int
+_lru_set_unswappable(struct mm_struct *mm, uintptr_t addr)
+{
+    pte_t *ptep = get_pte(mm->pgdir, addr, 0);
+    assert(ptep != NULL && (*ptep & PTE_P));
+    lru_del(pte2page(*ptep));
+    return 0;
+}
+
+// _lru_tick_event - age the active list, so that the inactive list has candidates
+//                 - ready before memory runs out
+static int
+_lru_tick_event(struct mm_struct *mm)
+{
+    size_t nr_scan = (nr_active < LRU_TICK_SCAN) ? nr_active : LRU_TICK_SCAN;
+    while (nr_scan -- > 0) {
+        struct Page *page = le2page(list_prev(&lru_active), pra_page_link);
+        lru_del(page);
+        if (mm_is_locked(page->pra_mm) || lru_test_clear_accessed(page)
+            || nr_inactive >= nr_active) {
+            lru_add_active(page);
+        }
+        else {
+            lru_add_inactive(page);
+        }
+    }
+    return 0;
+}
+
+struct swap_manager swap_manager_lru =
+{
+     .name            = "global lru swap manager",
+     .init            = &_lru_init,
+     .init_mm         = &_lru_init_mm,
+     .tick_event      = &_lru_tick_event,
+     .map_swappable   = &_lru_map_swappable,
+     .set_unswappable = &_lru_set_unswappable,
+     .swap_out_victim = &_lru_swap_out_victim,
+     .check_swap      = &_lru_check_swap,
+};
@@ -8,6 +8,7 @@
 #include <x86.h>
 #include <swap.h>
 #include <kmalloc.h>
+#include <clock.h>
 
 /* 
   vmm design include two parts: mm_struct (mm) & vma_struct (vma)
@@ -28,6 +29,7 @@
      struct vma_struct * find_vma(struct mm_struct *mm, uintptr_t addr)
    local functions
      inline void check_vma_overlap(struct vma_struct *prev, struct vma_struct *next)
+     struct vma_struct *find_vma_after(struct mm_struct *mm, uintptr_t addr)
 ---------------
    check correctness functions
      void check_vmm(void);
@@ -46,6 +48,7 @@ mm_create(void) {
 
     if (mm != NULL) {
         list_init(&(mm->mmap_list));
+        mm->mmap_tree = NULL;
         mm->mmap_cache = NULL;
         mm->pgdir = NULL;
         mm->map_count = 0;
@@ -55,6 +58,10 @@ mm_create(void) {
         
         set_mm_count(mm, 0);
         sem_init(&(mm->mm_sem), 1);
+        mm->pgfault_count = mm->pgfault_rate = 0;
+        mm->pgfault_stamp = ticks;
+        mm->rss = mm->swap_pages = mm->pt_pages = 0;
+        mm->rss_limit = 0;
     }    
     return mm;
 }
@@ -73,6 +80,49 @@ vma_create(uintptr_t vm_start, uintptr_t vm_end, uint32_t vm_flags) {
 }
 
 
+// vma_compare - compare two vmas by start addr, used by the redblack tree of mm
+static inline int
+vma_compare(rb_node *node1, rb_node *node2) {
+    struct vma_struct *vma1 = rbn2vma(node1, rb_link);
+    struct vma_struct *vma2 = rbn2vma(node2, rb_link);
+    uintptr_t start1 = vma1->vm_start, start2 = vma2->vm_start;
+    return (start1 < start2) ? -1 : (start1 > start2) ? 1 : 0;
+}
+
+// find_vma_after - find the lowest vma with addr < vma->vm_end, NULL if there is none
+static struct vma_struct *
+find_vma_after(struct mm_struct *mm, uintptr_t addr) {
+    struct vma_struct *vma = NULL, *tmp;
+    if (mm->mmap_tree != NULL) {
+        rb_tree *tree = mm->mmap_tree;
+        rb_node *node = rb_node_root(tree);
+        while (node != NULL) {
+            tmp = rbn2vma(node, rb_link);
+            if (tmp->vm_end > addr) {
+                vma = tmp;
+                if (tmp->vm_start <= addr) {
+                    break;
+                }
+                node = rb_node_left(tree, node);
+            }
+            else {
+                node = rb_node_right(tree, node);
+            }
+        }
+    }
+    else {
+        list_entry_t *list = &(mm->mmap_list), *le = list;
+        while ((le = list_next(le)) != list) {
+            tmp = le2vma(le, list_link);
+            if (tmp->vm_end > addr) {
+                vma = tmp;
+                break;
+            }
+        }
+    }
+    return vma;
+}
+
 // find_vma - find a vma  (vma->vm_start <= addr <= vma_vm_end)
 struct vma_struct *
 find_vma(struct mm_struct *mm, uintptr_t addr) {
@@ -80,18 +130,10 @@ find_vma(struct mm_struct *mm, uintptr_t addr) {
     if (mm != NULL) {
         vma = mm->mmap_cache;
         if (!(vma != NULL && vma->vm_start <= addr && vma->vm_end > addr)) {
-                bool found = 0;
-                list_entry_t *list = &(mm->mmap_list), *le = list;
-                while ((le = list_next(le)) != list) {
-                    vma = le2vma(le, list_link);
-                    if (vma->vm_start<=addr && addr < vma->vm_end) {
-                        found = 1;
-                        break;
-                    }
-                }
-                if (!found) {
-                    vma = NULL;
-                }
+            vma = find_vma_after(mm, addr);
+            if (vma != NULL && vma->vm_start > addr) {
+                vma = NULL;
+            }
         }
         if (vma != NULL) {
             mm->mmap_cache = vma;
@@ -110,13 +152,29 @@ check_vma_overlap(struct vma_struct *prev, struct vma_struct *next) {
 }
 
 
-// insert_vma_struct -insert vma in mm's list link
+// insert_vma_rb - insert vma in the redblack tree, and find its predecessor in mm's list link
+static inline void
+insert_vma_rb(rb_tree *tree, struct vma_struct *vma, list_entry_t **le_prev_store) {
+    rb_node *node = &(vma->rb_link), *prev;
+    rb_insert(tree, node);
+    if (le_prev_store != NULL) {
+        if ((prev = rb_node_prev(tree, node)) != NULL) {
+            *le_prev_store = &(rbn2vma(prev, rb_link)->list_link);
+        }
+    }
+}
+
+// insert_vma_struct -insert vma in mm's list link (and redblack tree if there are many vmas)
 void
 insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
     assert(vma->vm_start < vma->vm_end);
     list_entry_t *list = &(mm->mmap_list);
     list_entry_t *le_prev = list, *le_next;
 
+    if (mm->mmap_tree != NULL) {
+        insert_vma_rb(mm->mmap_tree, vma, &le_prev);
+    }
+    else {
         list_entry_t *le = list;
         while ((le = list_next(le)) != list) {
             struct vma_struct *mmap_prev = le2vma(le, list_link);
@@ -125,6 +183,7 @@ insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
             }
             le_prev = le;
         }
+    }
 
     le_next = list_next(le_prev);
 
@@ -140,6 +199,39 @@ insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
     list_add_after(le_prev, &(vma->list_link));
 
     mm->map_count ++;
+    if (mm->mmap_tree == NULL && mm->map_count >= RB_MIN_MAP_COUNT) {
+        // build the tree from the list, keep using the list if out of memory
+        if ((mm->mmap_tree = rb_tree_create(vma_compare)) != NULL) {
+            list_entry_t *le = list;
+            while ((le = list_next(le)) != list) {
+                insert_vma_rb(mm->mmap_tree, le2vma(le, list_link), NULL);
+            }
+        }
+    }
+}
+
+// remove_vma_struct - unlink vma from mm's list link
+static void
+remove_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
+    assert(mm == vma->vm_mm);
+    if (mm->mmap_cache == vma) {
+        mm->mmap_cache = NULL;
+    }
+    if (mm->mmap_tree != NULL) {
+        rb_delete(mm->mmap_tree, &(vma->rb_link));
+    }
+    list_del_init(&(vma->list_link));
+    mm->map_count --;
+}
+
+// find_vma_intersection - find a vma which overlaps [start, end)
+static struct vma_struct *
+find_vma_intersection(struct mm_struct *mm, uintptr_t start, uintptr_t end) {
+    struct vma_struct *vma = find_vma_after(mm, start);
+    if (vma != NULL && vma->vm_start < end) {
+        return vma;
+    }
+    return NULL;
 }
 
 // mm_destroy - free mm and mm internal fields
@@ -152,10 +244,15 @@ mm_destroy(struct mm_struct *mm) {
         list_del(le);
         kfree(le2vma(le, list_link));  //kfree vma        
     }
+    if (mm->mmap_tree != NULL) {
+        rb_tree_destroy(mm->mmap_tree);
+    }
     kfree(mm); //kfree mm
     mm=NULL;
 }
 
+// mm_map - map [addr, addr + len) in mm, if an adjacent vma has the same flags
+//        - it is extended instead, and *vma_store gets the vma covering the range
 int
 mm_map(struct mm_struct *mm, uintptr_t addr, size_t len, uint32_t vm_flags,
        struct vma_struct **vma_store) {
@@ -168,16 +265,41 @@ mm_map(struct mm_struct *mm, uintptr_t addr, size_t len, uint32_t vm_flags,
 
     int ret = -E_INVAL;
 
-    struct vma_struct *vma;
-    if ((vma = find_vma(mm, start)) != NULL && end > vma->vm_start) {
+    struct vma_struct *vma, *prev = NULL, *next;
+    if (find_vma_intersection(mm, start, end) != NULL) {
         goto out;
     }
-    ret = -E_NO_MEM;
 
-    if ((vma = vma_create(start, end, vm_flags)) == NULL) {
-        goto out;
+    list_entry_t *list = &(mm->mmap_list), *le;
+    next = find_vma_after(mm, end);
+    le = list_prev((next != NULL) ? &(next->list_link) : list);
+    if (le != list) {
+        prev = le2vma(le, list_link);
+    }
+    bool merge_prev = (prev != NULL && prev->vm_end == start && prev->vm_flags == vm_flags);
+    bool merge_next = (next != NULL && next->vm_start == end && next->vm_flags == vm_flags);
+
+    if (merge_prev && merge_next) {
+        prev->vm_end = next->vm_end;
+        remove_vma_struct(mm, next);
+        kfree(next);
+        vma = prev;
+    }
+    else if (merge_prev) {
+        prev->vm_end = end;
+        vma = prev;
+    }
+    else if (merge_next) {
+        next->vm_start = start;
+        vma = next;
+    }
+    else {
+        ret = -E_NO_MEM;
+        if ((vma = vma_create(start, end, vm_flags)) == NULL) {
+            goto out;
+        }
+        insert_vma_struct(mm, vma);
     }
-    insert_vma_struct(mm, vma);
     if (vma_store != NULL) {
         *vma_store = vma;
     }
@@ -187,6 +309,79 @@ out:
     return ret;
 }
 
+// mm_unmap - remove the mapping of [addr, addr + len) from mm, splitting the
+//          - vma at the borders if the range only covers part of it
+int
+mm_unmap(struct mm_struct *mm, uintptr_t addr, size_t len) {
+    uintptr_t start = ROUNDDOWN(addr, PGSIZE), end = ROUNDUP(addr + len, PGSIZE);
+    if (!USER_ACCESS(start, end)) {
+        return -E_INVAL;
+    }
+
+    assert(mm != NULL);
+
+    struct vma_struct *vma, *nvma;
+    if ((vma = find_vma_after(mm, start)) == NULL) {
+        return 0;
+    }
+    list_entry_t *list = &(mm->mmap_list), *le = &(vma->list_link);
+    while (le != list) {
+        vma = le2vma(le, list_link);
+        le = list_next(le);
+        if (vma->vm_start >= end) {
+            break;
+        }
+        if (vma->vm_end <= start) {
+            continue;
+        }
+        uintptr_t un_start = (vma->vm_start > start) ? vma->vm_start : start;
+        uintptr_t un_end = (vma->vm_end < end) ? vma->vm_end : end;
+        if (vma->vm_start < un_start && un_end < vma->vm_end) {
+            // the hole is in the middle of vma, keep the upper part as a new vma
+            if ((nvma = vma_create(un_end, vma->vm_end, vma->vm_flags)) == NULL) {
+                return -E_NO_MEM;
+            }
+            vma->vm_end = un_start;
+            insert_vma_struct(mm, nvma);
+        }
+        else if (vma->vm_start < un_start) {
+            vma->vm_end = un_start;
+        }
+        else if (un_end < vma->vm_end) {
+            vma->vm_start = un_end;
+        }
+        else {
+            remove_vma_struct(mm, vma);
+            kfree(vma);
+        }
+        unmap_range(mm->pgdir, un_start, un_end);
+    }
+    return 0;
+}
+
+// get_unmapped_area - find a free range with len bytes, searching downwards from USERTOP
+uintptr_t
+get_unmapped_area(struct mm_struct *mm, size_t len) {
+    if (len == 0 || len > USERTOP - USERBASE) {
+        return 0;
+    }
+    uintptr_t start = USERTOP - len;
+    list_entry_t *list = &(mm->mmap_list), *le = list;
+    while ((le = list_prev(le)) != list) {
+        struct vma_struct *vma = le2vma(le, list_link);
+        if (start >= vma->vm_end) {
+            break;
+        }
+        if (start + len > vma->vm_start) {
+            if (vma->vm_start < USERBASE + len) {
+                return 0;
+            }
+            start = vma->vm_start - len;
+        }
+    }
+    return start;
+}
+
 int
 dup_mmap(struct mm_struct *to, struct mm_struct *from) {
     assert(to != NULL && from != NULL);
@@ -206,9 +401,35 @@ dup_mmap(struct mm_struct *to, struct mm_struct *from) {
             return -E_NO_MEM;
         }
     }
+    mm_map_swappable(to);
+    to->rss_limit = from->rss_limit;
     return 0;
 }
 
+// mm_map_swappable - hand all the present user pages of mm, which the swap manager
+//                  - does not know yet (except the zero page), over to the swap manager
+void
+mm_map_swappable(struct mm_struct *mm) {
+    if (!swap_init_ok) {
+        return ;
+    }
+    list_entry_t *list = &(mm->mmap_list), *le = list;
+    while ((le = list_next(le)) != list) {
+        struct vma_struct *vma = le2vma(le, list_link);
+        uintptr_t la;
+        for (la = vma->vm_start; la < vma->vm_end; la += PGSIZE) {
+            pte_t *ptep = get_pte(mm->pgdir, la, 0);
+            if (ptep == NULL) {
+                la = ROUNDDOWN(la, PTSIZE) + PTSIZE - PGSIZE;
+                continue;
+            }
+            if ((*ptep & PTE_P) && !PageSwap(pte2page(*ptep)) && pte2page(*ptep) != zero_page) {
+                swap_map_swappable(mm, la, pte2page(*ptep), 0);
+            }
+        }
+    }
+}
+
 void
 exit_mmap(struct mm_struct *mm) {
     assert(mm != NULL && mm_count(mm) == 0);
@@ -218,10 +439,9 @@ exit_mmap(struct mm_struct *mm) {
         struct vma_struct *vma = le2vma(le, list_link);
         unmap_range(pgdir, vma->vm_start, vma->vm_end);
     }
-    while ((le = list_next(le)) != list) {
-        struct vma_struct *vma = le2vma(le, list_link);
-        exit_range(pgdir, vma->vm_start, vma->vm_end);
-    }
+    // mm_unmap leaves the page tables of unmapped holes in place,
+    // so release every user page table, not only the ones under a vma
+    exit_range(pgdir, USERBASE, USERTOP);
 }
 
 bool
@@ -254,6 +474,7 @@ static void
 check_vmm(void) {
     size_t nr_free_pages_store = nr_free_pages();
     
+    check_rb_tree();
     check_vma_struct();
     check_pgfault();
 
@@ -317,6 +538,24 @@ check_vma_struct(void) {
         assert(vma_below_5 == NULL);
     }
 
+    assert(mm->mmap_tree != NULL);
+    mm_destroy(mm);
+
+    // adjacent mappings with the same flags are merged into one vma
+    mm = mm_create();
+    assert(mm != NULL);
+
+    struct vma_struct *vma;
+    assert(mm_map(mm, USERBASE, PGSIZE, VM_READ, NULL) == 0);
+    assert(mm_map(mm, USERBASE + PGSIZE * 2, PGSIZE, VM_READ, NULL) == 0);
+    assert(mm_map(mm, USERBASE + PGSIZE * 3, PGSIZE, VM_READ | VM_WRITE, NULL) == 0);
+    assert(mm->map_count == 3);
+    assert(mm_map(mm, USERBASE + PGSIZE, PGSIZE, VM_READ, &vma) == 0);
+    assert(mm->map_count == 2);
+    assert(vma->vm_start == USERBASE && vma->vm_end == USERBASE + PGSIZE * 3);
+    assert(find_vma(mm, USERBASE + PGSIZE * 2) == vma);
+    assert(mm_map(mm, USERBASE + PGSIZE, PGSIZE, VM_READ, NULL) == -E_INVAL);
+
     mm_destroy(mm);
 
   //  assert(nr_free_pages_store == nr_free_pages());
@@ -371,6 +610,105 @@ check_pgfault(void) {
 //page fault number
 volatile unsigned int pgfault_num=0;
 
+// an anonymous fault also maps the not-present pages of its aligned FAULT_AROUND_PAGES window
+#define FAULT_AROUND_PAGES          8
+// fault-around is speculative, so it is skipped when free memory drops below this (in pages)
+#define FAULT_AROUND_MIN_FREE       256
+
+// anon_page_insert - map a zeroed page at la for an anonymous fault, and make it swappable
+static struct Page *
+anon_page_insert(struct mm_struct *mm, uintptr_t la, uint32_t perm) {
+    struct Page *page;
+    if ((page = alloc_zeroed_page_flags(ALLOC_HIGHMEM)) == NULL) {
+        return NULL;
+    }
+    if (page_insert(mm->pgdir, page, la, perm) != 0) {
+        free_page(page);
+        return NULL;
+    }
+    if (swap_init_ok) {
+        swap_map_swappable(mm, la, page, 0);
+    }
+    return page;
+}
+
+// do_fault_around - populate the not-present ptes around addr inside vma, so that touching
+//                 - a fresh heap or stack region sequentially does not trap on every page
+//                 - after a read fault the neighbours get the zero page, which costs no memory
+static void
+do_fault_around(struct mm_struct *mm, struct vma_struct *vma, uintptr_t addr, uint32_t perm, bool write) {
+    // check_swap counts every single fault of check_mm_struct
+    if (mm == check_mm_struct || (write && nr_free_pages() < FAULT_AROUND_MIN_FREE)) {
+        return ;
+    }
+    uintptr_t start = ROUNDDOWN(addr, FAULT_AROUND_PAGES * PGSIZE);
+    uintptr_t end = start + FAULT_AROUND_PAGES * PGSIZE;
+    if (start < vma->vm_start) {
+        start = vma->vm_start;
+    }
+    if (end > vma->vm_end) {
+        end = vma->vm_end;
+    }
+    // the window never crosses a page table, which the fault on addr has already set up
+    pte_t *ptep = get_pte(mm->pgdir, start, 0);
+    assert(ptep != NULL);
+    uintptr_t la;
+    for (la = start; la < end; la += PGSIZE, ptep ++) {
+        if (la == addr || *ptep != 0) {
+            continue;
+        }
+        if (!write) {
+            if (page_insert(mm->pgdir, zero_page, la, perm & ~PTE_W) != 0) {
+                break;
+            }
+            continue;
+        }
+        if (anon_page_insert(mm, la, perm) == NULL) {
+            break;
+        }
+    }
+}
+
+// mm_pff_fault - count a page fault of mm in its PFF window
+static void
+mm_pff_fault(struct mm_struct *mm) {
+    if (ticks - mm->pgfault_stamp >= PFF_WINDOW) {
+        mm->pgfault_rate = (ticks - mm->pgfault_stamp < 2 * PFF_WINDOW) ? mm->pgfault_count : 0;
+        mm->pgfault_count = 0;
+        mm->pgfault_stamp = ticks;
+    }
+    mm->pgfault_count ++;
+}
+
+// mm_pff - the page fault frequency of mm, the larger of the current and the last window.
+//        - a mm with a high pff is growing its working set, one with pff 0 is idle
+int
+mm_pff(struct mm_struct *mm) {
+    size_t elapsed = ticks - mm->pgfault_stamp;
+    if (elapsed >= 2 * PFF_WINDOW) {
+        return 0;
+    }
+    if (elapsed >= PFF_WINDOW) {
+        return mm->pgfault_count;
+    }
+    return (mm->pgfault_rate > mm->pgfault_count) ? mm->pgfault_rate : mm->pgfault_count;
+}
+
+// mm_shrink_rss - evict pages of mm until it is within its resident limit again, a mm
+//               - over its limit pages against itself instead of pushing others into swap
+void
+mm_shrink_rss(struct mm_struct *mm) {
+    // a locked mm may have its ptes in use, it is shrunk on a later fault
+    if (!swap_init_ok || mm->rss_limit == 0 || mm_is_locked(mm)) {
+        return ;
+    }
+    while (mm->rss > mm->rss_limit) {
+        if (swap_out(mm, mm->rss - mm->rss_limit, 0) == 0) {
+            break;
+        }
+    }
+}
+
 /* do_pgfault - interrupt handler to process the page fault execption
  * @mm         : the control struct for a set of vma using the same PDT
  * @error_code : the error code recorded in trapframe->tf_err which is setted by x86 hardware
@@ -399,6 +737,7 @@ do_pgfault(struct mm_struct *mm, uint32_t error_code, uintptr_t addr) {
     struct vma_struct *vma = find_vma(mm, addr);
 
     pgfault_num++;
+    mm_pff_fault(mm);
     //If the addr is in the range of a mm's vma?
     if (vma == NULL || vma->vm_start > addr) {
         cprintf("not valid addr %x, and  can not find it in vma\n", addr);
@@ -504,12 +843,35 @@ do_pgfault(struct mm_struct *mm, uint32_t error_code, uintptr_t addr) {
         goto failed;
     }
     
-    if (*ptep == 0) { // if the phy addr isn't exist, then alloc a page & map the phy addr with logical addr
+    if (*ptep == 0 && !(error_code & 2) && mm != check_mm_struct) {
+        // a read of untouched memory, share the zero page until the first write
+        if (page_insert(mm->pgdir, zero_page, addr, perm & ~PTE_W) != 0) {
+            cprintf("page_insert of the zero page in do_pgfault failed\n");
+            goto failed;
+        }
+        do_fault_around(mm, vma, addr, perm, 0);
+    }
+    else if (*ptep == 0 && mm == check_mm_struct) {
+        // pgdir_alloc_page gives the pages of check_mm_struct to the swap manager
         if (pgdir_alloc_page(mm->pgdir, addr, perm) == NULL) {
             cprintf("pgdir_alloc_page in do_pgfault failed\n");
             goto failed;
         }
     }
+    else if (*ptep == 0) { // if the phy addr isn't exist, then alloc a zeroed page & map the phy addr with logical addr
+        if (anon_page_insert(mm, addr, perm) == NULL) {
+            cprintf("anon_page_insert in do_pgfault failed\n");
+            goto failed;
+        }
+        do_fault_around(mm, vma, addr, perm, 1);
+    }
+    else if ((*ptep & PTE_P) && pte2page(*ptep) == zero_page) {
+        // the first write after reading the zero page, copy on write to a page of its own
+        if (anon_page_insert(mm, addr, perm) == NULL) {
+            cprintf("anon_page_insert for the zero page copy in do_pgfault failed\n");
+            goto failed;
+        }
+    }
     else {
         struct Page *page=NULL;
         cprintf("do pgfault: ptep %x, pte %x\n",ptep, *ptep);
@@ -538,6 +900,9 @@ do_pgfault(struct mm_struct *mm, uint32_t error_code, uintptr_t addr) {
        swap_map_swappable(mm, addr, page, 1);
        page->pra_vaddr = addr;
    }
+   if (mm->rss_limit != 0 && mm->rss > mm->rss_limit) {
+       mm_shrink_rss(mm);
+   }
    ret = 0;
 failed:
     return ret;
@@ -7,6 +7,7 @@
 #include <sync.h>
 #include <proc.h>
 #include <sem.h>
+#include <rb_tree.h>
 
 //pre define
 struct mm_struct;
@@ -18,19 +19,27 @@ struct vma_struct {
     uintptr_t vm_end;        // end addr of vma
     uint32_t vm_flags;       // flags of vma
     list_entry_t list_link;  // linear list link which sorted by start addr of vma
+    rb_node rb_link;         // redblack link which sorted by start addr of vma
 };
 
 #define le2vma(le, member)                  \
     to_struct((le), struct vma_struct, member)
 
+#define rbn2vma(node, member)               \
+    to_struct((node), struct vma_struct, member)
+
 #define VM_READ                 0x00000001
 #define VM_WRITE                0x00000002
 #define VM_EXEC                 0x00000004
 #define VM_STACK                0x00000008
 
+// the redblack tree is only built once a mm holds this many vmas
+#define RB_MIN_MAP_COUNT        32
+
 // the control struct for a set of vma using the same PDT
 struct mm_struct {
     list_entry_t mmap_list;        // linear list link which sorted by start addr of vma
+    rb_tree *mmap_tree;            // redblack tree link which sorted by start addr of vma, NULL if few vmas
     struct vma_struct *mmap_cache; // current accessed vma, used for speed purpose
     pde_t *pgdir;                  // the PDT of these vma
     int map_count;                 // the count of these vma
@@ -38,9 +47,18 @@ struct mm_struct {
     int mm_count;                  // the number ofprocess which shared the mm
     semaphore_t mm_sem;            // mutex for using dup_mmap fun to duplicat the mm 
     int locked_by;                 // the lock owner process's pid
-
+    int pgfault_count;             // the page faults in the current PFF window
+    int pgfault_rate;              // the page faults in the last PFF window
+    size_t pgfault_stamp;          // the ticks when the current PFF window started
+    int rss;                       // the pages mapped by the PDT, except the zero page
+    int swap_pages;                // the ptes holding a swap entry
+    int pt_pages;                  // the page tables of the PDT
+    int rss_limit;                 // the resident limit in pages, 0 if unlimited
 };
 
+// the page fault frequency (PFF) of a mm is its number of page faults in PFF_WINDOW ticks
+#define PFF_WINDOW              100
+
 struct vma_struct *find_vma(struct mm_struct *mm, uintptr_t addr);
 struct vma_struct *vma_create(uintptr_t vm_start, uintptr_t vm_end, uint32_t vm_flags);
 void insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma);
@@ -58,6 +76,9 @@ int dup_mmap(struct mm_struct *to, struct mm_struct *from);
 void exit_mmap(struct mm_struct *mm);
 uintptr_t get_unmapped_area(struct mm_struct *mm, size_t len);
 int mm_brk(struct mm_struct *mm, uintptr_t addr, size_t len);
+int mm_pff(struct mm_struct *mm);
+void mm_map_swappable(struct mm_struct *mm);
+void mm_shrink_rss(struct mm_struct *mm);
 
 extern volatile unsigned int pgfault_num;
 extern struct mm_struct *check_mm_struct;
@@ -107,5 +128,10 @@ unlock_mm(struct mm_struct *mm) {
     }
 }
 
+static inline bool
+mm_is_locked(struct mm_struct *mm) {
+    return mm->mm_sem.value <= 0;
+}
+
 #endif /* !__KERN_MM_VMM_H__ */
 
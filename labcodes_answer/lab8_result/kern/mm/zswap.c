@@ -0,0 +1,352 @@
+#include <defs.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <error.h>
+#include <assert.h>
+#include <list.h>
+#include <lz.h>
+#include <pmm.h>
+#include <kmalloc.h>
+#include <swap.h>
+#include <swapfs.h>
+#include <zswap.h>
+
+/* *
+ * zswap - a compressed pool of swapped out pages in front of the swap device.
+ *
+ * swap_out offers every victim to zswap_store first. A zero-filled page only sets a bit of
+ * zswap_zero_bitmap. Otherwise the page is compressed with lz_compress, and kept if it
+ * fits into half a page: the pool pages, taken from alloc_pages, are split into two halves,
+ * each holding a struct zswap_object header followed by the compressed data. page_ref of
+ * a pool page counts its halves in use, the free halves are linked through their own
+ * memory into zswap_free_halves.
+ *
+ * The page still gets a swap slot, and its swap entry goes into the pte as usual, so the
+ * reference counts and the swap cache work the same whether the data of the slot is in
+ * the pool or on the disk. The pool only spills to the disk when it reaches its size
+ * limit: the least recently stored object is written to its slot and dropped.
+ *
+ * zswap is called from the reclaim path, so it takes its pool pages with ALLOC_NORECLAIM:
+ * a new pool page only comes from the free pages of the zones, never by reclaiming more.
+ * */
+
+struct zswap_object {
+    swap_entry_t entry;         // the swap slot the data belongs to
+    size_t len;                 // the length of the compressed data following the header
+    list_entry_t hash_link;     // the link in zswap_hash_list
+    list_entry_t lru_link;      // the link in zswap_lru, the most recently used at the head
+};
+
+#define ZSWAP_HALF_SIZE             (PGSIZE / 2)
+#define ZSWAP_MAX_LEN               (ZSWAP_HALF_SIZE - sizeof(struct zswap_object))
+
+#define ZSWAP_HASH_SHIFT            10
+#define ZSWAP_HASH_LIST_SIZE        (1 << ZSWAP_HASH_SHIFT)
+#define zswap_hashfn(x)             (hash32(x, ZSWAP_HASH_SHIFT))
+
+#define le2zobj(le, member)         \
+    to_struct((le), struct zswap_object, member)
+
+static list_entry_t zswap_hash_list[ZSWAP_HASH_LIST_SIZE];
+static list_entry_t zswap_lru;
+static list_entry_t zswap_free_halves;
+static uint32_t *zswap_zero_bitmap;
+
+static size_t zswap_max_pool_pages, zswap_nr_pool_pages;
+
+// the workspace of lz_compress, and the buffers for compressed and decompressed data
+static uint8_t zswap_work[LZ_WORK_SIZE];
+static uint8_t zswap_cbuf[ZSWAP_MAX_LEN];
+static uint8_t zswap_dbuf[PGSIZE];
+
+static struct zswap_object *
+zswap_lookup(swap_entry_t entry) {
+    list_entry_t *list = zswap_hash_list + zswap_hashfn(entry), *le = list;
+    while ((le = list_next(le)) != list) {
+        struct zswap_object *obj = le2zobj(le, hash_link);
+        if (obj->entry == entry) {
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+static inline struct Page *
+zswap_half2page(void *half) {
+    return kva2page((void *)ROUNDDOWN((uintptr_t)half, PGSIZE));
+}
+
+static void
+zswap_free_half(void *half) {
+    struct Page *page = zswap_half2page(half);
+    if (page_ref_dec(page) == 0) {
+        // the other half is free too, take it off the list and give the page back
+        void *other = (page2kva(page) == half) ? half + ZSWAP_HALF_SIZE : half - ZSWAP_HALF_SIZE;
+        list_del((list_entry_t *)other);
+        free_page(page);
+        zswap_nr_pool_pages --;
+    }
+    else {
+        list_add(&zswap_free_halves, (list_entry_t *)half);
+    }
+}
+
+static void
+zswap_drop(struct zswap_object *obj) {
+    list_del(&(obj->hash_link));
+    list_del(&(obj->lru_link));
+    zswap_free_half(obj);
+}
+
+// zswap_spill - write the least recently used object back to its slot, and free its half
+static int
+zswap_spill(void) {
+    if (list_empty(&zswap_lru)) {
+        return -E_NO_MEM;
+    }
+    struct zswap_object *obj = le2zobj(list_prev(&zswap_lru), lru_link);
+    int ret = lz_decompress(obj + 1, obj->len, zswap_dbuf, PGSIZE);
+    assert(ret == PGSIZE);
+    if ((ret = swapfs_write_buf(obj->entry, zswap_dbuf)) != 0) {
+        return ret;
+    }
+    zswap_drop(obj);
+    return 0;
+}
+
+// zswap_alloc_half - get a free half of a pool page, growing the pool or spilling to the disk
+static void *
+zswap_alloc_half(void) {
+    if (list_empty(&zswap_free_halves)) {
+        if (zswap_nr_pool_pages < zswap_max_pool_pages) {
+            struct Page *page;
+            if ((page = alloc_pages_flags(1, ALLOC_NORECLAIM)) == NULL) {
+                return NULL;
+            }
+            set_page_ref(page, 0);
+            zswap_nr_pool_pages ++;
+            list_add(&zswap_free_halves, (list_entry_t *)page2kva(page));
+            list_add(&zswap_free_halves, (list_entry_t *)(page2kva(page) + ZSWAP_HALF_SIZE));
+        }
+        else if (zswap_spill() != 0) {
+            return NULL;
+        }
+    }
+    list_entry_t *le = list_next(&zswap_free_halves);
+    list_del(le);
+    page_ref_inc(zswap_half2page(le));
+    return le;
+}
+
+static bool
+zswap_page_is_zero(const uint32_t *p) {
+    size_t i;
+    for (i = 0; i < PGSIZE / sizeof(uint32_t); i ++) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* *
+ * zswap_store - keep the content of page in the pool, under a newly allocated swap slot
+ * whose entry is stored in *entry_store.
+ * Returns -E_NO_MEM if the page does not compress well enough, or the pool has no room.
+ * */
+int
+zswap_store(struct Page *page, swap_entry_t *entry_store) {
+    if (zswap_max_pool_pages == 0) {
+        return -E_NO_MEM;
+    }
+    swap_entry_t entry;
+    void *kva = kmap(page);
+    if (zswap_page_is_zero(kva)) {
+        kunmap(kva);
+        if (swapfs_alloc(&entry) != 0) {
+            return -E_NO_MEM;
+        }
+        set_bit(swap_offset(entry), zswap_zero_bitmap);
+        *entry_store = entry;
+        return 0;
+    }
+
+    size_t len = lz_compress(kva, PGSIZE, zswap_cbuf, ZSWAP_MAX_LEN, zswap_work);
+    kunmap(kva);
+    if (len == 0) {
+        return -E_NO_MEM;
+    }
+    struct zswap_object *obj = zswap_alloc_half();
+    if (obj == NULL) {
+        return -E_NO_MEM;
+    }
+    if (swapfs_alloc(&entry) != 0) {
+        zswap_free_half(obj);
+        return -E_NO_MEM;
+    }
+    obj->entry = entry;
+    obj->len = len;
+    memcpy(obj + 1, zswap_cbuf, len);
+    list_add(zswap_hash_list + zswap_hashfn(entry), &(obj->hash_link));
+    list_add(&zswap_lru, &(obj->lru_link));
+    *entry_store = entry;
+    return 0;
+}
+
+// zswap_load - fill page with the content of the slot of entry, if the pool has it
+bool
+zswap_load(swap_entry_t entry, struct Page *page) {
+    void *kva;
+    if (test_bit(swap_offset(entry), zswap_zero_bitmap)) {
+        kva = kmap(page);
+        memset(kva, 0, PGSIZE);
+        kunmap(kva);
+        return 1;
+    }
+    struct zswap_object *obj = zswap_lookup(entry);
+    if (obj == NULL) {
+        return 0;
+    }
+    kva = kmap(page);
+    int ret = lz_decompress(obj + 1, obj->len, kva, PGSIZE);
+    kunmap(kva);
+    assert(ret == PGSIZE);
+    list_del(&(obj->lru_link));
+    list_add(&zswap_lru, &(obj->lru_link));
+    return 1;
+}
+
+bool
+zswap_contains(swap_entry_t entry) {
+    return test_bit(swap_offset(entry), zswap_zero_bitmap) || zswap_lookup(entry) != NULL;
+}
+
+// zswap_invalidate - the slot of entry is freed, drop its data from the pool
+void
+zswap_invalidate(swap_entry_t entry) {
+    struct zswap_object *obj;
+    clear_bit(swap_offset(entry), zswap_zero_bitmap);
+    if ((obj = zswap_lookup(entry)) != NULL) {
+        zswap_drop(obj);
+    }
+}
+
+static void
+check_lz(void) {
+    uint8_t *src = zswap_dbuf;
+    size_t i, len;
+    // a page of zeros and a page of short repeating text compress well, random data does not
+    memset(src, 0, PGSIZE);
+    len = lz_compress(src, PGSIZE, zswap_cbuf, ZSWAP_MAX_LEN, zswap_work);
+    assert(len != 0 && len < 128);
+    for (i = 0; i < PGSIZE; i ++) {
+        src[i] = "ucore zswap check "[i % 18] + i / 1024;
+    }
+    len = lz_compress(src, PGSIZE, zswap_cbuf, ZSWAP_MAX_LEN, zswap_work);
+    assert(len != 0);
+    memset(src, 0, PGSIZE);
+    assert(lz_decompress(zswap_cbuf, len, src, PGSIZE) == PGSIZE);
+    for (i = 0; i < PGSIZE; i ++) {
+        assert(src[i] == "ucore zswap check "[i % 18] + i / 1024);
+    }
+    srand(1);
+    for (i = 0; i < PGSIZE; i ++) {
+        src[i] = rand();
+    }
+    assert(lz_compress(src, PGSIZE, zswap_cbuf, ZSWAP_MAX_LEN, zswap_work) == 0);
+    cprintf("check_lz() succeeded!\n");
+}
+
+// check_zswap_fill - fill the page with text that compresses into half a page
+static void
+check_zswap_fill(struct Page *page, int seed) {
+    uint8_t *p = kmap(page);
+    size_t i;
+    for (i = 0; i < PGSIZE; i ++) {
+        p[i] = "ucore zswap check "[i % 18] + seed;
+    }
+    kunmap(p);
+}
+
+// check_zswap_same - the page holds what check_zswap_fill put there
+static bool
+check_zswap_same(struct Page *page, int seed) {
+    uint8_t *p = kmap(page);
+    size_t i;
+    for (i = 0; i < PGSIZE; i ++) {
+        if (p[i] != (uint8_t)("ucore zswap check "[i % 18] + seed)) {
+            break;
+        }
+    }
+    kunmap(p);
+    return i == PGSIZE;
+}
+
+static void
+check_zswap(void) {
+    size_t i, nr_free_slots_store = swapfs_nr_free(), max_pool_pages_store = zswap_max_pool_pages;
+    swap_entry_t entries[4], entry;
+    struct Page *page;
+    assert(zswap_max_pool_pages > 0 && (page = alloc_page()) != NULL);
+
+    // a zero-filled page only takes a bit
+    memset(page2kva(page), 0, PGSIZE);
+    assert(zswap_store(page, entries) == 0 && zswap_nr_pool_pages == 0);
+    check_zswap_fill(page, 0);
+    assert(zswap_load(entries[0], page) && zswap_page_is_zero(page2kva(page)));
+
+    // two compressed pages share a pool page
+    check_zswap_fill(page, 1);
+    assert(zswap_store(page, entries + 1) == 0 && zswap_nr_pool_pages == 1);
+    check_zswap_fill(page, 2);
+    assert(zswap_store(page, entries + 2) == 0 && zswap_nr_pool_pages == 1);
+    assert(zswap_load(entries[1], page) && check_zswap_same(page, 1));
+
+    // the pool is full, the least recently used object 2 is written to its slot
+    zswap_max_pool_pages = 1;
+    check_zswap_fill(page, 3);
+    assert(zswap_store(page, entries + 3) == 0 && zswap_nr_pool_pages == 1);
+    assert(zswap_contains(entries[1]) && !zswap_contains(entries[2]) && zswap_contains(entries[3]));
+    assert(swapfs_read(entries[2], page) == 0 && check_zswap_same(page, 2));
+    assert(zswap_load(entries[3], page) && check_zswap_same(page, 3));
+
+    // random data does not compress, and is left to the disk
+    srand(2);
+    for (i = 0; i < PGSIZE; i ++) {
+        ((uint8_t *)page2kva(page))[i] = rand();
+    }
+    assert(zswap_store(page, &entry) == -E_NO_MEM);
+
+    for (i = 0; i < 4; i ++) {
+        assert(swapfs_free(entries[i]) == 0);
+        zswap_invalidate(entries[i]);
+        assert(!zswap_contains(entries[i]));
+    }
+    assert(zswap_nr_pool_pages == 0 && list_empty(&zswap_lru) && list_empty(&zswap_free_halves));
+    assert(swapfs_nr_free() == nr_free_slots_store);
+    zswap_max_pool_pages = max_pool_pages_store;
+    free_page(page);
+    cprintf("check_zswap() succeeded!\n");
+}
+
+void
+zswap_init(void) {
+    int i;
+    for (i = 0; i < ZSWAP_HASH_LIST_SIZE; i ++) {
+        list_init(zswap_hash_list + i);
+    }
+    list_init(&zswap_lru);
+    list_init(&zswap_free_halves);
+    zswap_nr_pool_pages = 0;
+    zswap_max_pool_pages = lowmem_npage * ZSWAP_MAX_POOL_PERCENT / 100;
+
+    size_t size = ROUNDUP(max_swap_offset, 32) / 8;
+    if ((zswap_zero_bitmap = kmalloc(size)) == NULL) {
+        panic("zswap: no memory for the zero bitmap.\n");
+    }
+    memset(zswap_zero_bitmap, 0, size);
+    check_lz();
+    check_zswap();
+}
+
@@ -0,0 +1,17 @@
+#ifndef __KERN_MM_ZSWAP_H__
+#define __KERN_MM_ZSWAP_H__
+
+#include <defs.h>
+#include <memlayout.h>
+
+// the compressed pool takes at most this percentage of the physical pages, 0 disables it
+#define ZSWAP_MAX_POOL_PERCENT                  10
+
+void zswap_init(void);
+int zswap_store(struct Page *page, swap_entry_t *entry_store);
+bool zswap_load(swap_entry_t entry, struct Page *page);
+bool zswap_contains(swap_entry_t entry);
+void zswap_invalidate(swap_entry_t entry);
+
+#endif /* !__KERN_MM_ZSWAP_H__ */
+
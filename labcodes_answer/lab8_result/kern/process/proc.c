@@ -15,6 +15,9 @@
 #include <fs.h>
 #include <vfs.h>
 #include <sysfile.h>
+#include <swap.h>
+#include <memstat.h>
+#include <clock.h>
 
 /* ------------- process/thread mechanism design&implementation -------------
 (an simplified Linux process/thread mechanism )
@@ -65,19 +68,36 @@ SYS_getpid      : get the process's pid
 // the process set's list
 list_entry_t proc_list;
 
-#define HASH_SHIFT          10
-#define HASH_LIST_SIZE      (1 << HASH_SHIFT)
-#define pid_hashfn(x)       (hash32(x, HASH_SHIFT))
+// the hash list has (1 << hash_shift) buckets, it is doubled by do_fork once there are
+// more than HASH_LOAD processes per bucket, and halved by do_wait when it is mostly empty
+#define HASH_SHIFT_MIN      8
+#define HASH_SHIFT_MAX      14
+#define HASH_LOAD           2
+#define pid_hashfn(x)       (hash32(x, hash_shift))
 
 // has list for process set based on pid
-static list_entry_t hash_list[HASH_LIST_SIZE];
-
-// idle proc
-struct proc_struct *idleproc = NULL;
-// init proc
+static list_entry_t *hash_list;
+static int hash_shift;
+
+// at most max_process processes, their pids are below max_pid
+static int max_process, max_pid;
+// one process takes at least its kernel stack, its page directory and its proc_struct
+#define PROC_MIN_PAGES      (KSTACKPAGE + 2)
+
+// the pids in use, bit pid of pid_map is set from get_pid until put_pid
+static uint32_t *pid_map;
+// the last pid handed out, get_pid searches the next free pid from here
+static int last_pid = 0;
+
+// freed kernel stacks are kept for the next setup_kstack, linked by the page_link of
+// their first page, at most KSTACK_CACHE_MAX of them
+#define KSTACK_CACHE_MAX    16
+static list_entry_t kstack_cache;
+static int nr_kstack_cache = 0;
+static spinlock_t kstack_lock = SPINLOCK_INIT("kstack");
+
+// init proc, the idle proc and the current proc of a cpu are in its struct cpu
 struct proc_struct *initproc = NULL;
-// current proc
-struct proc_struct *current = NULL;
 
 static int nr_process = 0;
 
@@ -128,12 +148,25 @@ alloc_proc(void) {
         proc->wait_state = 0;
         proc->cptr = proc->optr = proc->yptr = NULL;
         proc->rq = NULL;
+        proc->cpu = 0;
         list_init(&(proc->run_link));
         proc->time_slice = 0;
         proc->lab6_run_pool.left = proc->lab6_run_pool.right = proc->lab6_run_pool.parent = NULL;
         proc->lab6_stride = 0;
         proc->lab6_priority = 0;
+        proc->mlfq_level = 0;
+        proc->nice = 0;
+        proc->vruntime = 0;
+        proc->policy = SCHED_NORMAL;
+        proc->rt_priority = 0;
+        proc->dl_runtime = proc->dl_period = proc->dl_budget = 0;
+        proc->dl_deadline = 0;
+        memset(&(proc->sched_stat), 0, sizeof(struct schedstat));
+        proc->sched_enqueued = 0;
+        proc->sched_woken = 0;
         proc->filesp = NULL;
+        proc->tgid = -1;
+        list_init(&(proc->thread_group));
     }
     return proc;
 }
@@ -181,39 +214,45 @@ remove_links(struct proc_struct *proc) {
     nr_process --;
 }
 
-// get_pid - alloc a unique pid for process
+// pid_find_free - find the first free pid in [start, end), return end if there is none.
+//                - the full words of pid_map are skipped, so a search costs O(max_pid / 32)
+//                - at most, not O(processes) as a scan of proc_list
 static int
-get_pid(void) {
-    static_assert(MAX_PID > MAX_PROCESS);
-    struct proc_struct *proc;
-    list_entry_t *list = &proc_list, *le;
-    static int next_safe = MAX_PID, last_pid = MAX_PID;
-    if (++ last_pid >= MAX_PID) {
-        last_pid = 1;
-        goto inside;
-    }
-    if (last_pid >= next_safe) {
-    inside:
-        next_safe = MAX_PID;
-    repeat:
-        le = list;
-        while ((le = list_next(le)) != list) {
-            proc = le2proc(le, list_link);
-            if (proc->pid == last_pid) {
-                if (++ last_pid >= next_safe) {
-                    if (last_pid >= MAX_PID) {
-                        last_pid = 1;
-                    }
-                    next_safe = MAX_PID;
-                    goto repeat;
-                }
-            }
-            else if (proc->pid > last_pid && next_safe > proc->pid) {
-                next_safe = proc->pid;
-            }
+pid_find_free(int start, int end) {
+    int ix = start / 32;
+    uint32_t avail = ~pid_map[ix] & ~((1 << (start % 32)) - 1);
+    while (avail == 0) {
+        if ((++ ix) * 32 >= end) {
+            return end;
         }
+        avail = ~pid_map[ix];
     }
-    return last_pid;
+    int pid = ix * 32 + __builtin_ctz(avail);
+    return (pid < end) ? pid : end;
+}
+
+// get_pid - alloc a unique pid for process, the pids are handed out in increasing order and
+//         - wrap around at max_pid, so a pid is not reused soon after it was freed
+static int
+get_pid(void) {
+    int pid = max_pid;
+    if (last_pid + 1 < max_pid) {
+        pid = pid_find_free(last_pid + 1, max_pid);
+    }
+    if (pid >= max_pid) {
+        pid = pid_find_free(1, max_pid);
+    }
+    // there are at most max_process processes, so a free pid is always left
+    assert(pid < max_pid);
+    set_bit(pid % 32, pid_map + pid / 32);
+    return last_pid = pid;
+}
+
+// put_pid - free the pid of a process, it can be handed out again by get_pid
+static void
+put_pid(int pid) {
+    assert(0 < pid && pid < max_pid && test_bit(pid % 32, pid_map + pid / 32));
+    clear_bit(pid % 32, pid_map + pid / 32);
 }
 
 // proc_run - make process "proc" running on cpu
@@ -239,6 +278,11 @@ proc_run(struct proc_struct *proc) {
 //       after switch_to, the current proc will execute here.
 static void
 forkret(void) {
+    schedule_tail();
+    // a new user process leaves the kernel here, without the kernel lock
+    if (!trap_in_kernel(current->tf)) {
+        unlock_kernel();
+    }
     forkrets(current->tf);
 }
 
@@ -254,10 +298,48 @@ unhash_proc(struct proc_struct *proc) {
     list_del(&(proc->hash_link));
 }
 
+// hash_alloc - alloc and init a hash list with (1 << shift) buckets
+static list_entry_t *
+hash_alloc(int shift) {
+    list_entry_t *list;
+    if ((list = kmalloc(sizeof(list_entry_t) << shift)) != NULL) {
+        int i;
+        for (i = 0; i < (1 << shift); i ++) {
+            list_init(list + i);
+        }
+    }
+    return list;
+}
+
+// hash_resize - move all the processes into a new hash list with (1 << shift) buckets,
+//             - the old hash list is kept if there is no memory for the new one
+static void
+hash_resize(int shift) {
+    list_entry_t *list, *old = hash_list;
+    if ((list = hash_alloc(shift)) == NULL) {
+        return;
+    }
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        int i, old_size = (1 << hash_shift);
+        hash_list = list, hash_shift = shift;
+        for (i = 0; i < old_size; i ++) {
+            list_entry_t *le;
+            while ((le = list_next(old + i)) != old + i) {
+                list_del(le);
+                hash_proc(le2proc(le, hash_link));
+            }
+        }
+    }
+    local_intr_restore(intr_flag);
+    kfree(old);
+}
+
 // find_proc - find proc frome proc hash_list according to pid
 struct proc_struct *
 find_proc(int pid) {
-    if (0 < pid && pid < MAX_PID) {
+    if (0 < pid && pid < max_pid) {
         list_entry_t *list = hash_list + pid_hashfn(pid), *le = list;
         while ((le = list_next(le)) != list) {
             struct proc_struct *proc = le2proc(le, hash_link);
@@ -278,6 +360,7 @@ kernel_thread(int (*fn)(void *), void *arg, uint32_t clone_flags) {
     memset(&tf, 0, sizeof(struct trapframe));
     tf.tf_cs = KERNEL_CS;
     tf.tf_ds = tf.tf_es = tf.tf_ss = KERNEL_DS;
+    tf.tf_gs = KERNEL_CPU;
     tf.tf_regs.reg_ebx = (uint32_t)fn;
     tf.tf_regs.reg_edx = (uint32_t)arg;
     tf.tf_eip = (uint32_t)kernel_thread_entry;
@@ -287,7 +370,19 @@ kernel_thread(int (*fn)(void *), void *arg, uint32_t clone_flags) {
 // setup_kstack - alloc pages with size KSTACKPAGE as process kernel stack
 static int
 setup_kstack(struct proc_struct *proc) {
-    struct Page *page = alloc_pages(KSTACKPAGE);
+    struct Page *page = NULL;
+    bool intr_flag;
+    spin_lock_irqsave(&kstack_lock, intr_flag);
+    if (nr_kstack_cache > 0) {
+        list_entry_t *le = list_next(&kstack_cache);
+        list_del(le);
+        nr_kstack_cache --;
+        page = le2page(le, page_link);
+    }
+    spin_unlock_irqrestore(&kstack_lock, intr_flag);
+    if (page == NULL) {
+        page = alloc_pages(KSTACKPAGE);
+    }
     if (page != NULL) {
         proc->kstack = (uintptr_t)page2kva(page);
         return 0;
@@ -295,21 +390,55 @@ setup_kstack(struct proc_struct *proc) {
     return -E_NO_MEM;
 }
 
-// put_kstack - free the memory space of process kernel stack
+// put_kstack - free the memory space of process kernel stack, or keep it in kstack_cache
 static void
 put_kstack(struct proc_struct *proc) {
-    free_pages(kva2page((void *)(proc->kstack)), KSTACKPAGE);
+    struct Page *page = kva2page((void *)(proc->kstack));
+    bool intr_flag;
+    spin_lock_irqsave(&kstack_lock, intr_flag);
+    if (nr_kstack_cache < KSTACK_CACHE_MAX) {
+        list_add(&kstack_cache, &(page->page_link));
+        nr_kstack_cache ++;
+        page = NULL;
+    }
+    spin_unlock_irqrestore(&kstack_lock, intr_flag);
+    if (page != NULL) {
+        free_pages(page, KSTACKPAGE);
+    }
+}
+
+// kstack_cache_drain - free all the kernel stacks in kstack_cache, called when memory is
+//                    - low. returns the number of stacks freed
+int
+kstack_cache_drain(void) {
+    int nr_freed = 0;
+    bool intr_flag;
+    spin_lock_irqsave(&kstack_lock, intr_flag);
+    while (nr_kstack_cache > 0) {
+        list_entry_t *le = list_next(&kstack_cache);
+        list_del(le);
+        nr_kstack_cache --;
+        spin_unlock_irqrestore(&kstack_lock, intr_flag);
+        free_pages(le2page(le, page_link), KSTACKPAGE);
+        nr_freed ++;
+        spin_lock_irqsave(&kstack_lock, intr_flag);
+    }
+    spin_unlock_irqrestore(&kstack_lock, intr_flag);
+    return nr_freed;
 }
 
 // setup_pgdir - alloc one page as PDT
 static int
 setup_pgdir(struct mm_struct *mm) {
     struct Page *page;
-    if ((page = alloc_page()) == NULL) {
+    if ((page = alloc_zeroed_page()) == NULL) {
         return -E_NO_MEM;
     }
+    // the user part is empty, only the kernel part is copied from boot_pgdir
+    // the page of a pgdir points back to its mm, for the rss accounting of pte_account
+    page->pra_mm = mm;
     pde_t *pgdir = page2kva(page);
-    memcpy(pgdir, boot_pgdir, PGSIZE);
+    memcpy(pgdir + PDX(KERNBASE), boot_pgdir + PDX(KERNBASE), (NPDEENTRY - PDX(KERNBASE)) * sizeof(pde_t));
     pgdir[PDX(VPT)] = PADDR(pgdir) | PTE_P | PTE_W;
     mm->pgdir = pgdir;
     return 0;
@@ -318,6 +447,7 @@ setup_pgdir(struct mm_struct *mm) {
 // put_pgdir - free the memory space of PDT
 static void
 put_pgdir(struct mm_struct *mm) {
+    kva2page(mm->pgdir)->pra_mm = NULL;
     free_page(kva2page(mm->pgdir));
 }
 
@@ -430,11 +560,19 @@ put_fs(struct proc_struct *proc) {
  */
 int
 do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf) {
-    int ret = -E_NO_FREE_PROC;
+    int ret = -E_INVAL;
     struct proc_struct *proc;
-    if (nr_process >= MAX_PROCESS) {
+    // a thread must share the address space of its thread group
+    if ((clone_flags & CLONE_THREAD) && !(clone_flags & CLONE_VM)) {
         goto fork_out;
     }
+    ret = -E_NO_FREE_PROC;
+    if (nr_process >= max_process) {
+        goto fork_out;
+    }
+    if (nr_process >= (HASH_LOAD << hash_shift) && hash_shift < HASH_SHIFT_MAX) {
+        hash_resize(hash_shift + 1);
+    }
     ret = -E_NO_MEM;
     //LAB4:EXERCISE2 YOUR CODE
     //LAB8:EXERCISE2 YOUR CODE  HINT:how to copy the fs in parent's proc_struct?
@@ -475,6 +613,12 @@ do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf) {
     }
 
     proc->parent = current;
+    proc->nice = current->nice;
+    // the bandwidth of a SCHED_DEADLINE process is not split with its children
+    if (current->policy != SCHED_DEADLINE) {
+        proc->policy = current->policy;
+        proc->rt_priority = current->rt_priority;
+    }
     assert(current->wait_state == 0);
 
     if (setup_kstack(proc) != 0) {
@@ -494,7 +638,11 @@ do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf) {
         proc->pid = get_pid();
         hash_proc(proc);
         set_links(proc);
-
+        proc->tgid = proc->pid;
+        if (clone_flags & CLONE_THREAD) {
+            proc->tgid = current->tgid;
+            list_add_before(&(current->thread_group), &(proc->thread_group));
+        }
     }
     local_intr_restore(intr_flag);
 
@@ -544,6 +692,7 @@ do_exit(int error_code) {
     struct proc_struct *proc;
     local_intr_save(intr_flag);
     {
+        list_del_init(&(current->thread_group));
         proc = current->parent;
         if (proc->wait_state == WT_CHILD) {
             wakeup_proc(proc);
@@ -700,18 +849,8 @@ load_icode(int fd, int argc, char **kargv) {
             start += size;
             assert((end < la && start == end) || (end >= la && start == la));
         }
-        while (start < end) {
-            if ((page = pgdir_alloc_page(mm->pgdir, la, perm)) == NULL) {
-                ret = -E_NO_MEM;
-                goto bad_cleanup_mmap;
-            }
-            off = start - la, size = PGSIZE - off, la += PGSIZE;
-            if (end < la) {
-                size -= la - end;
-            }
-            memset(page2kva(page) + off, 0, size);
-            start += size;
-        }
+        // the rest of the BSS is left unmapped, do_pgfault maps the zero page or a fresh
+        // page into it when it is first touched
     }
     sysfile_close(fd);
 
@@ -724,6 +863,9 @@ load_icode(int fd, int argc, char **kargv) {
     assert(pgdir_alloc_page(mm->pgdir, USTACKTOP-3*PGSIZE , PTE_USER) != NULL);
     assert(pgdir_alloc_page(mm->pgdir, USTACKTOP-4*PGSIZE , PTE_USER) != NULL);
     
+    // the pages loaded above can be swapped out from now on
+    mm_map_swappable(mm);
+
     mm_count_inc(mm);
     current->mm = mm;
     current->cr3 = PADDR(mm->pgdir);
@@ -834,6 +976,8 @@ do_execve(const char *name, int argc, const char **argv) {
         return ret;
     }
     path = argv[0];
+    // the resident limit stays with the process across exec
+    int rss_limit = (mm != NULL) ? mm->rss_limit : 0;
     unlock_mm(mm);
     files_closeall(current->filesp);
 
@@ -851,10 +995,14 @@ do_execve(const char *name, int argc, const char **argv) {
         }
         current->mm = NULL;
     }
+    // the new program image no longer shares mm with the old thread group
+    list_del_init(&(current->thread_group));
+    current->tgid = current->pid;
     ret= -E_NO_MEM;;
     if ((ret = load_icode(fd, argc, kargv)) != 0) {
         goto execve_exit;
     }
+    current->mm->rss_limit = rss_limit;
     put_kargv(argc, kargv);
     set_proc_name(current, local_name);
     return 0;
@@ -928,22 +1076,43 @@ found:
     {
         unhash_proc(proc);
         remove_links(proc);
+        put_pid(proc->pid);
     }
     local_intr_restore(intr_flag);
     put_kstack(proc);
     kfree(proc);
+    if (nr_process < (HASH_LOAD << hash_shift) / 8 && hash_shift > HASH_SHIFT_MIN) {
+        hash_resize(hash_shift - 1);
+    }
     return 0;
 }
 
+// __do_kill - set proc's flags with PF_EXITING and wake it up if it sleeps interruptibly
+static void
+__do_kill(struct proc_struct *proc) {
+    proc->flags |= PF_EXITING;
+    if (proc->wait_state & WT_INTERRUPTED) {
+        wakeup_proc(proc);
+    }
+}
+
 // do_kill - kill process with pid by set this process's flags with PF_EXITING
+//         - killing a thread group leader kills all the threads in its group too
 int
 do_kill(int pid) {
     struct proc_struct *proc;
     if ((proc = find_proc(pid)) != NULL) {
         if (!(proc->flags & PF_EXITING)) {
-            proc->flags |= PF_EXITING;
-            if (proc->wait_state & WT_INTERRUPTED) {
-                wakeup_proc(proc);
+            __do_kill(proc);
+            if (proc->tgid != proc->pid) {
+                return 0;
+            }
+            list_entry_t *list = &(proc->thread_group), *le = list;
+            while ((le = list_next(le)) != list) {
+                struct proc_struct *thread = le2proc(le, thread_group);
+                if (!(thread->flags & PF_EXITING)) {
+                    __do_kill(thread);
+                }
             }
             return 0;
         }
@@ -997,6 +1166,49 @@ user_main(void *arg) {
     panic("user_main execve failed.\n");
 }
 
+static int
+check_proc_hash_main(void *arg) {
+    return 0;
+}
+
+// check_proc_hash - fork kernel threads until the pid hash list grows, look them up, reap
+//                 - them so it shrinks again, and give back the kernel stacks they left
+static void
+check_proc_hash(void) {
+    int i, n = (HASH_LOAD << HASH_SHIFT_MIN) + 64, *pids;
+    struct proc_struct **procs;
+    assert(hash_shift == HASH_SHIFT_MIN && nr_process + n <= max_process);
+    assert((pids = kmalloc(n * sizeof(int))) != NULL);
+    assert((procs = kmalloc(n * sizeof(struct proc_struct *))) != NULL);
+
+    for (i = 0; i < n; i ++) {
+        assert((pids[i] = kernel_thread(check_proc_hash_main, NULL, 0)) > 0);
+        assert((procs[i] = find_proc(pids[i])) != NULL);
+    }
+    assert(hash_shift == HASH_SHIFT_MIN + 1);
+    for (i = 0; i < n; i ++) {
+        assert(find_proc(pids[i]) == procs[i] && procs[i]->pid == pids[i]);
+    }
+
+    for (i = 0; i < n; i ++) {
+        assert(do_wait(pids[i], NULL) == 0);
+    }
+    assert(hash_shift == HASH_SHIFT_MIN);
+    for (i = 0; i < n; i ++) {
+        assert(find_proc(pids[i]) == NULL);
+    }
+    assert(find_proc(initproc->pid) == initproc);
+
+    assert(nr_kstack_cache == KSTACK_CACHE_MAX);
+    size_t nr_free = nr_free_pages();
+    assert(kstack_cache_drain() == KSTACK_CACHE_MAX && nr_kstack_cache == 0);
+    assert(nr_free_pages() == nr_free + KSTACK_CACHE_MAX * KSTACKPAGE);
+
+    kfree(pids);
+    kfree(procs);
+    cprintf("check_proc_hash() succeeded!\n");
+}
+
 // init_main - the second kernel thread used to create user_main kernel threads
 static int
 init_main(void *arg) {
@@ -1004,6 +1216,7 @@ init_main(void *arg) {
     if ((ret = vfs_set_bootfs("disk0:")) != 0) {
         panic("set boot fs failed: %e.\n", ret);
     }
+    check_proc_hash();
     
     size_t nr_free_pages_store = nr_free_pages();
     size_t kernel_allocated_store = kallocated();
@@ -1020,47 +1233,81 @@ init_main(void *arg) {
     }
 
     fs_cleanup();
+    kstack_cache_drain();
         
     cprintf("all user-mode processes have quit.\n");
     assert(initproc->cptr == NULL && initproc->yptr == NULL && initproc->optr == NULL);
-    assert(nr_process == 2);
-    assert(list_next(&proc_list) == &(initproc->list_link));
-    assert(list_prev(&proc_list) == &(initproc->list_link));
+    // kswapd (if swap is enabled) lives on with initproc
+    assert(nr_process == 2 + (kswapdproc != NULL));
+    list_entry_t *le = &proc_list;
+    while ((le = list_next(le)) != &proc_list) {
+        struct proc_struct *proc = le2proc(le, list_link);
+        assert(proc == initproc || proc == kswapdproc);
+    }
     assert(nr_free_pages_store == nr_free_pages());
     assert(kernel_allocated_store == kallocated());
     cprintf("init check memory pass.\n");
     return 0;
 }
 
-// proc_init - set up the first kernel thread idleproc "idle" by itself and 
-//           - create the second kernel thread init_main
+// idle_init - set up the idle process of the cpu we run on, by itself on the kernel
+//           - stack kstack. the idle processes all have pid 0, the one of the boot cpu
+//           - is counted in nr_process
 void
-proc_init(void) {
-    int i;
-
-    list_init(&proc_list);
-    for (i = 0; i < HASH_LIST_SIZE; i ++) {
-        list_init(hash_list + i);
-    }
-
+idle_init(uintptr_t kstack) {
     if ((idleproc = alloc_proc()) == NULL) {
         panic("cannot alloc idleproc.\n");
     }
 
-    idleproc->pid = 0;
+    idleproc->pid = idleproc->tgid = 0;
     idleproc->state = PROC_RUNNABLE;
-    idleproc->kstack = (uintptr_t)bootstack;
+    idleproc->kstack = kstack;
     idleproc->need_resched = 1;
-    
+    idleproc->cpu = cpunum();
+
     if ((idleproc->filesp = files_create()) == NULL) {
         panic("create filesp (idleproc) failed.\n");
     }
     files_count_inc(idleproc->filesp);
-    
+
     set_proc_name(idleproc, "idle");
-    nr_process ++;
 
     current = idleproc;
+}
+
+// proc_init - set up the first kernel thread idleproc "idle" by itself and 
+//           - create the second kernel thread init_main
+void
+proc_init(void) {
+    list_init(&proc_list);
+    list_init(&kstack_cache);
+    spin_lock_register(&kstack_lock);
+
+    // the kernel stacks come from lowmem, so the limit counts the free lowmem pages
+    size_t nr_free = nr_free_pages();
+    if (nr_free > lowmem_npage) {
+        nr_free = lowmem_npage;
+    }
+    max_process = nr_free / PROC_MIN_PAGES;
+    if (max_process > MAX_PROCESS_LIMIT) {
+        max_process = MAX_PROCESS_LIMIT;
+    }
+    // twice as many pids as processes, rounded up to the words of pid_map
+    max_pid = ROUNDUP(max_process * 2, 32);
+    if ((pid_map = kmalloc(max_pid / 8)) == NULL) {
+        panic("cannot alloc pid_map.\n");
+    }
+    memset(pid_map, 0, max_pid / 8);
+
+    hash_shift = HASH_SHIFT_MIN;
+    if ((hash_list = hash_alloc(hash_shift)) == NULL) {
+        panic("cannot alloc hash_list.\n");
+    }
+    cprintf("proc: at most %d processes, %d pids.\n", max_process, max_pid);
+
+    idle_init((uintptr_t)bootstack);
+    set_bit(0, pid_map);
+    nr_process ++;
 
     int pid = kernel_thread(init_main, NULL, 0);
     if (pid <= 0) {
@@ -1074,13 +1321,36 @@ proc_init(void) {
     assert(initproc != NULL && initproc->pid == 1);
 }
 
-// cpu_idle - at the end of kern_init, the first kernel thread idleproc will do below works
+// cpu_idle - at the end of kern_init, the first kernel thread idleproc will do below works,
+//          - and so does the idle process of every other cpu at the end of mp_main
 void
 cpu_idle(void) {
     while (1) {
         if (current->need_resched) {
             schedule();
         }
+        // nothing to run, zero free pages for the next page faults
+        else if (!zero_pool_fill()) {
+            // nothing to do at all, halt until the next interrupt
+            bool intr_flag;
+            local_intr_save(intr_flag);
+            if (ncpu > 1) {
+                // the other cpus need the periodic tick, and the kernel lock
+                if (!current->need_resched) {
+                    cpu_halt();
+                }
+            }
+            else {
+                // without the periodic tick, until the next timer
+                uint32_t until = timer_next_event(CLOCK_MAX_IDLE_TICKS);
+                if (!current->need_resched) {
+                    clock_idle(until);
+                    // run the timers of the ticks halted, and set the clock again
+                    run_timer_list(0);
+                }
+            }
+            local_intr_restore(intr_flag);
+        }
     }
 }
 
@@ -1093,6 +1363,22 @@ lab6_set_priority(uint32_t priority)
     else current->lab6_priority = priority;
 }
 
+// sleep_timer - sleep until the timer expires
+static int
+sleep_timer(timer_t *timer) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    current->state = PROC_SLEEPING;
+    current->wait_state = WT_TIMER;
+    add_timer(timer);
+    local_intr_restore(intr_flag);
+
+    schedule();
+
+    del_timer(timer);
+    return 0;
+}
+
 // do_sleep - set current process state to sleep and add timer with "time"
 //          - then call scheduler. if process run again, delete timer first.
 int
@@ -1100,16 +1386,200 @@ do_sleep(unsigned int time) {
     if (time == 0) {
         return 0;
     }
+    timer_t __timer;
+    return sleep_timer(timer_init(&__timer, current, time));
+}
+
+// do_usleep - like do_sleep, for "usec" microseconds. a sleep ending between two ticks
+//           - is woken up by a one-shot of the 8253, see clock_set_event
+int
+do_usleep(unsigned int usec) {
+    if (usec == 0) {
+        return 0;
+    }
+    timer_t __timer;
+    return sleep_timer(timer_init_us(&__timer, current, usec));
+}
+
+// do_mmap - map an anonymous memory area into current process's address space
+//         - if *addr_store is 0, the kernel picks the address and stores it back
+int
+do_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags) {
+    struct mm_struct *mm = current->mm;
+    if (mm == NULL) {
+        panic("kernel thread call mmap!!.\n");
+    }
+    if (addr_store == NULL || len == 0) {
+        return -E_INVAL;
+    }
+
+    int ret = -E_INVAL;
+
+    uintptr_t addr;
+
+    lock_mm(mm);
+    if (!copy_from_user(mm, &addr, addr_store, sizeof(uintptr_t), 1)) {
+        goto out_unlock;
+    }
+
+    uintptr_t start = ROUNDDOWN(addr, PGSIZE), end = ROUNDUP(addr + len, PGSIZE);
+    addr = start, len = end - start;
+
+    uint32_t vm_flags = VM_READ;
+    if (mmap_flags & MMAP_WRITE) vm_flags |= VM_WRITE;
+    if (mmap_flags & MMAP_STACK) vm_flags |= VM_STACK;
+
+    ret = -E_NO_MEM;
+    if (addr == 0) {
+        if ((addr = get_unmapped_area(mm, len)) == 0) {
+            goto out_unlock;
+        }
+    }
+    if ((ret = mm_map(mm, addr, len, vm_flags, NULL)) == 0) {
+        *addr_store = addr;
+    }
+out_unlock:
+    unlock_mm(mm);
+    return ret;
+}
+
+// do_memstat - copy the memory usage of current process to stat
+int
+do_memstat(struct memstat *stat) {
+    struct mm_struct *mm = current->mm;
+    if (mm == NULL) {
+        panic("kernel thread call memstat!!.\n");
+    }
+    struct memstat ms;
+    ms.ms_rss = mm->rss;
+    ms.ms_swap = mm->swap_pages;
+    ms.ms_pgtable = mm->pt_pages;
+    ms.ms_rss_limit = mm->rss_limit;
+
+    int ret = -E_INVAL;
+    lock_mm(mm);
+    if (copy_to_user(mm, stat, &ms, sizeof(struct memstat))) {
+        ret = 0;
+    }
+    unlock_mm(mm);
+    return ret;
+}
+
+// do_rsslimit - limit the resident pages of current process, 0 for no limit. pages
+//             - above the limit are evicted right away
+int
+do_rsslimit(int limit) {
+    struct mm_struct *mm = current->mm;
+    if (mm == NULL) {
+        panic("kernel thread call rsslimit!!.\n");
+    }
+    if (limit < 0) {
+        return -E_INVAL;
+    }
+    mm->rss_limit = limit;
+    mm_shrink_rss(mm);
+    return 0;
+}
+
+// do_setnice - set the nice value of current process, the CFS scheduler gives it CPU
+//            - time in proportion to the weight of the value
+int
+do_setnice(int nice) {
+    if (nice < NICE_MIN || nice > NICE_MAX) {
+        return -E_INVAL;
+    }
+    current->nice = nice;
+    return 0;
+}
+
+// do_setsched - set the scheduling policy of current process. priority is used by
+//             - SCHED_FIFO and SCHED_RR, runtime and period (in ticks) by SCHED_DEADLINE
+int
+do_setsched(int policy, int priority, int runtime, int period) {
+    switch (policy) {
+    case SCHED_NORMAL:
+        break;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        if (priority < 0 || priority > SCHED_PRIO_MAX) {
+            return -E_INVAL;
+        }
+        break;
+    case SCHED_DEADLINE:
+        if (runtime <= 0 || period < runtime) {
+            return -E_INVAL;
+        }
+        break;
+    default:
+        return -E_INVAL;
+    }
+
     bool intr_flag;
     local_intr_save(intr_flag);
-    timer_t __timer, *timer = timer_init(&__timer, current, time);
-    current->state = PROC_SLEEPING;
-    current->wait_state = WT_TIMER;
-    add_timer(timer);
+    {
+        // current is not in any run queue while it runs, so its class may change here
+        current->policy = policy;
+        current->rt_priority = priority;
+        current->dl_runtime = runtime;
+        current->dl_period = period;
+        current->dl_deadline = ticks + period;
+        current->dl_budget = runtime;
+        current->time_slice = 0;
+        current->need_resched = 1;
+    }
     local_intr_restore(intr_flag);
+    return 0;
+}
 
-    schedule();
+// do_schedstat - copy the scheduling counters of process pid (0 for current) to stat
+int
+do_schedstat(int pid, struct schedstat *stat) {
+    struct mm_struct *mm = current->mm;
+    if (mm == NULL) {
+        panic("kernel thread call schedstat!!.\n");
+    }
+    struct proc_struct *proc = current;
+    struct schedstat ss;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        if (pid != 0) {
+            proc = find_proc(pid);
+        }
+        if (proc != NULL) {
+            ss = proc->sched_stat;
+            ss.ss_runs = proc->runs;
+        }
+    }
+    local_intr_restore(intr_flag);
+    if (proc == NULL) {
+        return -E_INVAL;
+    }
 
-    del_timer(timer);
-    return 0;
+    int ret = -E_INVAL;
+    lock_mm(mm);
+    if (copy_to_user(mm, stat, &ss, sizeof(struct schedstat))) {
+        ret = 0;
+    }
+    unlock_mm(mm);
+    return ret;
+}
+
+// do_munmap - unmap [addr, addr + len) from current process's address space
+int
+do_munmap(uintptr_t addr, size_t len) {
+    struct mm_struct *mm = current->mm;
+    if (mm == NULL) {
+        panic("kernel thread call munmap!!.\n");
+    }
+    if (len == 0) {
+        return -E_INVAL;
+    }
+    int ret;
+    lock_mm(mm);
+    {
+        ret = mm_unmap(mm, addr, len);
+    }
+    unlock_mm(mm);
+    return ret;
 }
@@ -6,6 +6,8 @@
 #include <trap.h>
 #include <memlayout.h>
 #include <skew_heap.h>
+#include <schedstat.h>
+#include <mp.h>
 
 
 // process's state in his life cycle
@@ -35,8 +37,8 @@ struct context {
 };
 
 #define PROC_NAME_LEN               50
-#define MAX_PROCESS                 4096
-#define MAX_PID                     (MAX_PROCESS * 2)
+// the process limit is set by proc_init from the free memory, up to MAX_PROCESS_LIMIT
+#define MAX_PROCESS_LIMIT           32768
 
 extern list_entry_t proc_list;
 
@@ -61,12 +63,26 @@ struct proc_struct {
     uint32_t wait_state;                        // waiting state
     struct proc_struct *cptr, *yptr, *optr;     // relations between processes
     struct run_queue *rq;                       // running queue contains Process
+    int cpu;                                    // the cpu it runs on, or ran on last
     list_entry_t run_link;                      // the entry linked in run queue
     int time_slice;                             // time slice for occupying the CPU
     skew_heap_entry_t lab6_run_pool;            // FOR LAB6 ONLY: the entry in the run pool
     uint32_t lab6_stride;                       // FOR LAB6 ONLY: the current stride of the process
     uint32_t lab6_priority;                     // FOR LAB6 ONLY: the priority of process, set by lab6_set_priority(uint32_t)
+    int mlfq_level;                             // the queue of the process in the MLFQ scheduler
+    int nice;                                   // the nice value, NICE_MIN .. NICE_MAX, set by do_setnice
+    uint32_t vruntime;                          // the weighted CPU time of the process in the CFS scheduler
+    int policy;                                 // the scheduling policy, SCHED_NORMAL or a real-time one
+    int rt_priority;                            // the priority of SCHED_FIFO and SCHED_RR, 0 is the highest
+    int dl_runtime, dl_period;                  // SCHED_DEADLINE: may run dl_runtime ticks every dl_period ticks
+    uint32_t dl_deadline;                       // SCHED_DEADLINE: the tick the current period ends at
+    int dl_budget;                              // SCHED_DEADLINE: the ticks left in the current period
+    struct schedstat sched_stat;                // the scheduling counters, see schedstat.h
+    size_t sched_enqueued;                      // the tick it was put into the run queue
+    uint64_t sched_woken;                       // the TSC of its wakeup, 0 if it is not woken up
     struct files_struct *filesp;                // the file related info(pwd, files_count, files_array, fs_semaphore) of process
+    int tgid;                                   // thread group ID, the pid of the thread group leader
+    list_entry_t thread_group;                  // the threads sharing mm with this proc, created by CLONE_THREAD
 };
 
 #define PF_EXITING                  0x00000001      // getting shutdown
@@ -76,13 +92,20 @@ struct proc_struct {
 #define WT_KSEM                      0x00000100                    // wait kernel semaphore
 #define WT_TIMER                    (0x00000002 | WT_INTERRUPTED)  // wait timer
 #define WT_KBD                      (0x00000004 | WT_INTERRUPTED)  // wait the input of keyboard
+#define WT_FUTEX                    (0x00000008 | WT_INTERRUPTED)  // wait user-space futex
+#define WT_THROTTLED                (0x00000010 | WT_INTERRUPTED)  // wait the next period of SCHED_DEADLINE
 
 #define le2proc(le, member)         \
     to_struct((le), struct proc_struct, member)
 
-extern struct proc_struct *idleproc, *initproc, *current;
+extern struct proc_struct *initproc;
+
+// the process running on this cpu, and the idle process of this cpu
+#define current                     (mycpu()->proc)
+#define idleproc                    (mycpu()->idle)
 
 void proc_init(void);
+void idle_init(uintptr_t kstack);
 void proc_run(struct proc_struct *proc);
 int kernel_thread(int (*fn)(void *), void *arg, uint32_t clone_flags);
 
@@ -100,5 +123,15 @@ int do_kill(int pid);
 //FOR LAB6, set the process's priority (bigger value will get more CPU time)
 void lab6_set_priority(uint32_t priority);
 int do_sleep(unsigned int time);
+int do_usleep(unsigned int usec);
+int do_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
+int do_munmap(uintptr_t addr, size_t len);
+struct memstat;
+int do_memstat(struct memstat *stat);
+int do_rsslimit(int limit);
+int do_setnice(int nice);
+int do_setsched(int policy, int priority, int runtime, int period);
+int do_schedstat(int pid, struct schedstat *stat);
+int kstack_cache_drain(void);
 #endif /* !__KERN_PROCESS_PROC_H__ */
 
@@ -0,0 +1,142 @@
+#include <defs.h>
+#include <list.h>
+#include <proc.h>
+#include <assert.h>
+#include <unistd.h>
+#include <cfs_sched.h>
+
+/* *
+ * The completely fair scheduler runs the process with the smallest virtual runtime.
+ * A tick of CPU time adds NICE_0_WEIGHT * NICE_0_WEIGHT / weight to the vruntime of the
+ * running process, so over time every runnable process gets CPU in proportion to the
+ * weight of its nice value. The runnable processes are kept in a skew heap ordered by
+ * vruntime.
+ *
+ * min_vruntime follows the smallest vruntime of the run queue and never goes back. A
+ * process waking up (or a new one) starts no lower than min_vruntime minus half of
+ * CFS_LATENCY, so a long sleeper gets a small bonus but can not hog the CPU to catch up.
+ * */
+
+#define NICE_0_WEIGHT           1024
+// every runnable process should run once in CFS_LATENCY ticks
+#define CFS_LATENCY             20
+#define CFS_MIN_SLICE           1
+#define CFS_SLEEPER_CREDIT      (CFS_LATENCY / 2 * NICE_0_WEIGHT)
+
+/* *
+ * The weight of nice -20 .. 19 from Linux, each step of nice is about 10% CPU time
+ * between two busy processes.
+ * */
+static const int nice_weight[NICE_MAX - NICE_MIN + 1] = {
+     /* -20 */ 88761, 71755, 56483, 46273, 36291,
+     /* -15 */ 29154, 23254, 18705, 14949, 11916,
+     /* -10 */ 9548, 7620, 6100, 4904, 3906,
+     /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+     /*   0 */ 1024, 820, 655, 526, 423,
+     /*   5 */ 335, 272, 215, 172, 137,
+     /*  10 */ 110, 87, 70, 56, 45,
+     /*  15 */ 36, 29, 23, 18, 15,
+};
+
+int
+nice_to_weight(int nice) {
+     assert(nice >= NICE_MIN && nice <= NICE_MAX);
+     return nice_weight[nice - NICE_MIN];
+}
+
+static int
+proc_vruntime_comp_f(void *a, void *b)
+{
+     struct proc_struct *p = le2proc(a, lab6_run_pool);
+     struct proc_struct *q = le2proc(b, lab6_run_pool);
+     int32_t c = p->vruntime - q->vruntime;
+     if (c > 0) return 1;
+     else if (c == 0) return 0;
+     else return -1;
+}
+
+// update_min_vruntime - move min_vruntime up to the smallest vruntime of the run queue
+static void
+update_min_vruntime(struct run_queue *rq, uint32_t vruntime) {
+     if (rq->lab6_run_pool != NULL) {
+          uint32_t leftmost = le2proc(rq->lab6_run_pool, lab6_run_pool)->vruntime;
+          if ((int32_t)(leftmost - vruntime) < 0) {
+               vruntime = leftmost;
+          }
+     }
+     if ((int32_t)(vruntime - rq->cfs_min_vruntime) > 0) {
+          rq->cfs_min_vruntime = vruntime;
+     }
+}
+
+static void
+cfs_init(struct run_queue *rq) {
+     list_init(&(rq->run_list));
+     rq->lab6_run_pool = NULL;
+     rq->proc_num = 0;
+     rq->cfs_load = 0;
+     rq->cfs_min_vruntime = 0;
+}
+
+static void
+cfs_enqueue(struct run_queue *rq, struct proc_struct *proc) {
+     if (proc != current) {
+          // woken up or new, place it near the others
+          uint32_t floor = rq->cfs_min_vruntime;
+          if (proc->runs != 0) {
+               floor -= CFS_SLEEPER_CREDIT;
+          }
+          if ((int32_t)(proc->vruntime - floor) < 0) {
+               proc->vruntime = floor;
+          }
+     }
+     rq->lab6_run_pool =
+          skew_heap_insert(rq->lab6_run_pool, &(proc->lab6_run_pool), proc_vruntime_comp_f);
+     proc->rq = rq;
+     rq->proc_num ++;
+     rq->cfs_load += nice_to_weight(proc->nice);
+}
+
+static void
+cfs_dequeue(struct run_queue *rq, struct proc_struct *proc) {
+     rq->lab6_run_pool =
+          skew_heap_remove(rq->lab6_run_pool, &(proc->lab6_run_pool), proc_vruntime_comp_f);
+     rq->proc_num --;
+     rq->cfs_load -= nice_to_weight(proc->nice);
+}
+
+static struct proc_struct *
+cfs_pick_next(struct run_queue *rq) {
+     if (rq->lab6_run_pool == NULL) return NULL;
+     struct proc_struct *p = le2proc(rq->lab6_run_pool, lab6_run_pool);
+     update_min_vruntime(rq, p->vruntime);
+     // its share of CFS_LATENCY, the run queue still counts it here
+     int weight = nice_to_weight(p->nice);
+     p->time_slice = CFS_LATENCY * weight / rq->cfs_load;
+     if (p->time_slice < CFS_MIN_SLICE) {
+          p->time_slice = CFS_MIN_SLICE;
+     }
+     return p;
+}
+
+static void
+cfs_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
+     proc->vruntime += NICE_0_WEIGHT * NICE_0_WEIGHT / nice_to_weight(proc->nice);
+     update_min_vruntime(rq, proc->vruntime);
+     if (proc->time_slice > 0) {
+          proc->time_slice --;
+     }
+     if (proc->time_slice == 0) {
+          proc->need_resched = 1;
+     }
+}
+
+struct sched_class cfs_sched_class = {
+     .name = "cfs_scheduler",
+     .init = cfs_init,
+     .enqueue = cfs_enqueue,
+     .dequeue = cfs_dequeue,
+     .pick_next = cfs_pick_next,
+     .proc_tick = cfs_proc_tick,
+};
+
@@ -0,0 +1,11 @@
+#ifndef __KERN_SCHEDULE_CFS_SCHED_H__
+#define __KERN_SCHEDULE_CFS_SCHED_H__
+
+#include <sched.h>
+
+extern struct sched_class cfs_sched_class;
+
+int nice_to_weight(int nice);
+
+#endif /* !__KERN_SCHEDULE_CFS_SCHED_H__ */
+
@@ -0,0 +1,178 @@
+#include <defs.h>
+#include <list.h>
+#include <proc.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <mlfq_sched.h>
+
+/* *
+ * The multi-level feedback queue scheduler keeps a round-robin queue for each of the
+ * MLFQ_NR_LEVELS priority levels, level 0 is the highest. Bit i of mlfq_bitmap is set
+ * while queue i is not empty, so pick_next finds the highest non-empty level with one
+ * bit scan.
+ *
+ * A process using up its time slice moves one level down, and gets the longer slice
+ * of that level. A process waking up from a sleep that began before its slice ran out
+ * (an I/O-bound one) moves one level up. Every MLFQ_BOOST_TICKS ticks all the runnable
+ * processes go back to level 0, so the CPU-bound ones are not starved for ever.
+ * */
+
+#define MLFQ_BOOST_TICKS        100
+
+// the time slice of a level, the lower the level the longer the slice
+#define MLFQ_SLICE(rq, level)   ((rq)->max_time_slice * ((level) + 1) / 2 + 1)
+
+static void
+mlfq_init(struct run_queue *rq) {
+     int i;
+     for (i = 0; i < MLFQ_NR_LEVELS; i ++) {
+          list_init(rq->mlfq_queue + i);
+     }
+     rq->mlfq_bitmap = 0;
+     rq->mlfq_boost_ticks = MLFQ_BOOST_TICKS;
+     rq->proc_num = 0;
+}
+
+static void
+mlfq_enqueue(struct run_queue *rq, struct proc_struct *proc) {
+     assert(list_empty(&(proc->run_link)));
+     if (proc != current && proc->time_slice > 0) {
+          // woken up, it went to sleep before its slice ran out
+          if (proc->mlfq_level > 0) {
+               proc->mlfq_level --;
+          }
+          proc->time_slice = 0;
+     }
+     if (proc->time_slice == 0) {
+          proc->time_slice = MLFQ_SLICE(rq, proc->mlfq_level);
+     }
+     list_add_before(rq->mlfq_queue + proc->mlfq_level, &(proc->run_link));
+     rq->mlfq_bitmap |= (1 << proc->mlfq_level);
+     proc->rq = rq;
+     rq->proc_num ++;
+}
+
+static void
+mlfq_dequeue(struct run_queue *rq, struct proc_struct *proc) {
+     assert(!list_empty(&(proc->run_link)) && proc->rq == rq);
+     list_del_init(&(proc->run_link));
+     if (list_empty(rq->mlfq_queue + proc->mlfq_level)) {
+          rq->mlfq_bitmap &= ~(1 << proc->mlfq_level);
+     }
+     rq->proc_num --;
+}
+
+static struct proc_struct *
+mlfq_pick_next(struct run_queue *rq) {
+     if (rq->mlfq_bitmap == 0) {
+          return NULL;
+     }
+     int level = __builtin_ctz(rq->mlfq_bitmap);
+     return le2proc(list_next(rq->mlfq_queue + level), run_link);
+}
+
+// mlfq_boost - move all the runnable processes and the current one back to level 0
+static void
+mlfq_boost(struct run_queue *rq, struct proc_struct *proc) {
+     int i;
+     for (i = 1; i < MLFQ_NR_LEVELS; i ++) {
+          list_entry_t *head = rq->mlfq_queue + i, *le;
+          while ((le = list_next(head)) != head) {
+               list_del(le);
+               list_add_before(rq->mlfq_queue, le);
+               le2proc(le, run_link)->mlfq_level = 0;
+          }
+     }
+     if (!list_empty(rq->mlfq_queue)) {
+          rq->mlfq_bitmap = 1;
+     }
+     proc->mlfq_level = 0;
+}
+
+static void
+mlfq_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
+     if (-- rq->mlfq_boost_ticks == 0) {
+          rq->mlfq_boost_ticks = MLFQ_BOOST_TICKS;
+          mlfq_boost(rq, proc);
+     }
+     if (proc->time_slice > 0) {
+          proc->time_slice --;
+     }
+     if (proc->time_slice == 0) {
+          if (proc->mlfq_level < MLFQ_NR_LEVELS - 1) {
+               proc->mlfq_level ++;
+          }
+          proc->need_resched = 1;
+     }
+}
+
+static struct proc_struct check_procs[3];
+
+// check_mlfq - check the demotion, promotion and boost rules on a private run queue
+void
+check_mlfq(void) {
+     struct run_queue rq;
+     struct proc_struct *a = check_procs, *b = check_procs + 1, *c = check_procs + 2;
+     int i;
+     memset(check_procs, 0, sizeof(check_procs));
+     for (i = 0; i < 3; i ++) {
+          list_init(&(check_procs[i].run_link));
+     }
+     rq.max_time_slice = 5;
+     mlfq_init(&rq);
+
+     mlfq_enqueue(&rq, a);
+     mlfq_enqueue(&rq, b);
+     assert(rq.mlfq_bitmap == 1 && rq.proc_num == 2);
+     assert(a->time_slice == MLFQ_SLICE(&rq, 0));
+     assert(mlfq_pick_next(&rq) == a);
+
+     // a uses up its slice and moves one level down
+     mlfq_dequeue(&rq, a);
+     for (i = MLFQ_SLICE(&rq, 0); i > 0; i --) {
+          assert(!a->need_resched);
+          mlfq_proc_tick(&rq, a);
+     }
+     assert(a->need_resched && a->mlfq_level == 1 && a->time_slice == 0);
+     a->need_resched = 0;
+     mlfq_enqueue(&rq, a);
+     assert(rq.mlfq_bitmap == 3 && a->time_slice == MLFQ_SLICE(&rq, 1));
+     assert(mlfq_pick_next(&rq) == b);
+     mlfq_dequeue(&rq, b);
+     assert(rq.mlfq_bitmap == 2 && mlfq_pick_next(&rq) == a);
+
+     // a sleeps before its slice runs out and moves one level up when woken
+     mlfq_dequeue(&rq, a);
+     mlfq_proc_tick(&rq, a);
+     assert(rq.mlfq_bitmap == 0 && a->time_slice > 0);
+     mlfq_enqueue(&rq, a);
+     assert(a->mlfq_level == 0 && a->time_slice == MLFQ_SLICE(&rq, 0));
+
+     // the boost brings the queued processes and the running b back to level 0
+     c->mlfq_level = MLFQ_NR_LEVELS - 1;
+     mlfq_enqueue(&rq, c);
+     assert(rq.mlfq_bitmap == (1 | (1 << (MLFQ_NR_LEVELS - 1))));
+     b->mlfq_level = 1, b->time_slice = 2;
+     rq.mlfq_boost_ticks = 1;
+     mlfq_proc_tick(&rq, b);
+     assert(rq.mlfq_boost_ticks == MLFQ_BOOST_TICKS && !b->need_resched);
+     assert(b->mlfq_level == 0 && c->mlfq_level == 0 && rq.mlfq_bitmap == 1);
+     assert(mlfq_pick_next(&rq) == a);
+     mlfq_dequeue(&rq, a);
+     assert(mlfq_pick_next(&rq) == c);
+     mlfq_dequeue(&rq, c);
+     assert(rq.mlfq_bitmap == 0 && rq.proc_num == 0 && mlfq_pick_next(&rq) == NULL);
+
+     cprintf("check_mlfq() succeeded!\n");
+}
+
+struct sched_class mlfq_sched_class = {
+     .name = "mlfq_scheduler",
+     .init = mlfq_init,
+     .enqueue = mlfq_enqueue,
+     .dequeue = mlfq_dequeue,
+     .pick_next = mlfq_pick_next,
+     .proc_tick = mlfq_proc_tick,
+};
+
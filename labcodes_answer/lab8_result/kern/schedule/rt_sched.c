@@ -0,0 +1,136 @@
+#include <defs.h>
+#include <list.h>
+#include <proc.h>
+#include <assert.h>
+#include <unistd.h>
+#include <clock.h>
+#include <rt_sched.h>
+
+/* *
+ * The real-time scheduler class is consulted before the time-sharing one, so a
+ * runnable real-time process always runs before the others.
+ *
+ * SCHED_DEADLINE processes come first, the one with the earliest absolute deadline
+ * runs. Each one may run dl_runtime ticks in each dl_period ticks: when it used up its
+ * budget, schedule() throttles it, it sleeps until its deadline, and is woken up into
+ * a new period with a full budget. So an overrunning process gets no more than its
+ * runtime/period share, and can not starve the other processes.
+ *
+ * SCHED_FIFO and SCHED_RR processes come next, by fixed priority (0 is the highest),
+ * with a queue per priority and a bitmap of the non-empty queues. A FIFO process runs
+ * until it blocks or yields, a RR one goes to the tail of its queue every RT_RR_SLICE
+ * ticks.
+ * */
+
+#define RT_RR_SLICE             10
+
+static void
+rt_init(struct run_queue *rq) {
+     int i;
+     for (i = 0; i < RT_NR_PRIO; i ++) {
+          list_init(rq->rt_queue + i);
+     }
+     rq->rt_bitmap = 0;
+     list_init(&(rq->dl_list));
+     rq->proc_num = 0;
+}
+
+// dl_before - the deadline of p is earlier than the one of q
+static inline bool
+dl_before(struct proc_struct *p, struct proc_struct *q) {
+     return (int32_t)(p->dl_deadline - q->dl_deadline) < 0;
+}
+
+static void
+rt_enqueue(struct run_queue *rq, struct proc_struct *proc) {
+     assert(list_empty(&(proc->run_link)));
+     if (proc->policy == SCHED_DEADLINE) {
+          if (proc != current && (int32_t)(proc->dl_deadline - ticks) <= 0) {
+               // woken up after its deadline, start a new period
+               proc->dl_deadline = ticks + proc->dl_period;
+               proc->dl_budget = proc->dl_runtime;
+          }
+          list_entry_t *le = &(rq->dl_list);
+          while ((le = list_next(le)) != &(rq->dl_list)) {
+               if (dl_before(proc, le2proc(le, run_link))) {
+                    break;
+               }
+          }
+          list_add_before(le, &(proc->run_link));
+     }
+     else {
+          if (proc->policy == SCHED_RR && proc->time_slice == 0) {
+               proc->time_slice = RT_RR_SLICE;
+          }
+          list_add_before(rq->rt_queue + proc->rt_priority, &(proc->run_link));
+          rq->rt_bitmap |= (1 << proc->rt_priority);
+     }
+     proc->rq = rq;
+     rq->proc_num ++;
+}
+
+static void
+rt_dequeue(struct run_queue *rq, struct proc_struct *proc) {
+     assert(!list_empty(&(proc->run_link)) && proc->rq == rq);
+     list_del_init(&(proc->run_link));
+     if (proc->policy != SCHED_DEADLINE && list_empty(rq->rt_queue + proc->rt_priority)) {
+          rq->rt_bitmap &= ~(1 << proc->rt_priority);
+     }
+     rq->proc_num --;
+}
+
+static struct proc_struct *
+rt_pick_next(struct run_queue *rq) {
+     if (!list_empty(&(rq->dl_list))) {
+          return le2proc(list_next(&(rq->dl_list)), run_link);
+     }
+     if (rq->rt_bitmap != 0) {
+          int prio = __builtin_ctz(rq->rt_bitmap);
+          return le2proc(list_next(rq->rt_queue + prio), run_link);
+     }
+     return NULL;
+}
+
+static void
+rt_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
+     if (proc->policy == SCHED_DEADLINE) {
+          // schedule() throttles it until the next period
+          if (-- proc->dl_budget <= 0) {
+               proc->need_resched = 1;
+          }
+     }
+     else if (proc->policy == SCHED_RR) {
+          if (proc->time_slice > 0) {
+               proc->time_slice --;
+          }
+          if (proc->time_slice == 0) {
+               proc->need_resched = 1;
+          }
+     }
+}
+
+// rt_preempt - proc would be picked before curr, in the order of rt_pick_next: deadline
+//            - processes by deadline, then FIFO/RR processes by priority, then the others
+bool
+rt_preempt(struct proc_struct *proc, struct proc_struct *curr) {
+     if (proc->policy == SCHED_NORMAL) {
+          return 0;
+     }
+     if (curr->policy == SCHED_NORMAL) {
+          return 1;
+     }
+     if (proc->policy == SCHED_DEADLINE) {
+          return curr->policy != SCHED_DEADLINE || dl_before(proc, curr);
+     }
+     return curr->policy != SCHED_DEADLINE && proc->rt_priority < curr->rt_priority;
+}
+
+struct sched_class rt_sched_class = {
+     .name = "rt_scheduler",
+     .init = rt_init,
+     .enqueue = rt_enqueue,
+     .dequeue = rt_dequeue,
+     .pick_next = rt_pick_next,
+     .proc_tick = rt_proc_tick,
+};
+
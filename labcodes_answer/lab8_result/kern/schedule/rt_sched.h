@@ -0,0 +1,11 @@
+#ifndef __KERN_SCHEDULE_RT_SCHED_H__
+#define __KERN_SCHEDULE_RT_SCHED_H__
+
+#include <sched.h>
+
+extern struct sched_class rt_sched_class;
+
+bool rt_preempt(struct proc_struct *proc, struct proc_struct *curr);
+
+#endif /* !__KERN_SCHEDULE_RT_SCHED_H__ */
+
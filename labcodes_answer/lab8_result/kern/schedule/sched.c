@@ -5,168 +5,576 @@
 #include <stdio.h>
 #include <assert.h>
 #include <default_sched.h>
+#include <mlfq_sched.h>
+#include <cfs_sched.h>
+#include <rt_sched.h>
+#include <clock.h>
+#include <mp.h>
+#include <lapic.h>
 
-static list_entry_t timer_list;
+/* *
+ * The timers are kept in a hierarchical timer wheel. tv1 has a slot for each of the
+ * next TVR_SIZE ticks, and every slot of the level n wheel tvn[n] covers TVR_SIZE *
+ * TVN_SIZE^n ticks. A timer is put into the slot of its expiry tick on the lowest
+ * level that reaches it, and is moved one level down (cascaded) when the lower wheel
+ * wraps around to its slot. So add_timer and del_timer are O(1), and each tick only
+ * looks at one slot of tv1 and, every TVR_SIZE ticks, one slot of each higher level.
+ *
+ * A timer with a sub-tick part (timer->sub) is moved from the wheel to hr_list at its
+ * tick, and the 8253 is set to interrupt at the earliest timer of hr_list in between
+ * two ticks (see clock_set_event).
+ * */
+#define TVN_BITS                6
+#define TVR_BITS                8
+#define TVN_SIZE                (1 << TVN_BITS)
+#define TVR_SIZE                (1 << TVR_BITS)
+#define TVN_MASK                (TVN_SIZE - 1)
+#define TVR_MASK                (TVR_SIZE - 1)
+#define TVN_LEVELS              4
 
+static list_entry_t tv1[TVR_SIZE];
+static list_entry_t tvn[TVN_LEVELS][TVN_SIZE];
+// the timers expiring within the current tick, by timer->sub
+static list_entry_t hr_list;
+// the tick the timer wheel runs next
+static unsigned int timer_jiffies;
+// timer_lock protects the timer wheel, it is taken before the lock of a run queue
+static spinlock_t timer_lock = SPINLOCK_INIT("timer");
+
+/* *
+ * The scheduler classes are stacked: rt_sched_class schedules the processes with a
+ * real-time policy (see do_setsched) and is consulted first, sched_class schedules the
+ * SCHED_NORMAL ones.
+ * */
 static struct sched_class *sched_class;
 
-static struct run_queue *rq;
+// proc_sched_class - the scheduler class of the process
+static inline struct sched_class *
+proc_sched_class(struct proc_struct *proc) {
+    return (proc->policy == SCHED_NORMAL) ? sched_class : &rt_sched_class;
+}
+
+/* *
+ * Each cpu has its own run queue. proc->rq is the run queue a process is in, NULL
+ * while it runs or sleeps, and proc->cpu the cpu it runs or ran on last: a woken
+ * process goes back to the run queue of that cpu, a new one to the least loaded cpu.
+ * The run queues are balanced by moving processes from the busiest one, every
+ * LOAD_BALANCE_INTERVAL ticks, and whenever a cpu would go idle.
+ *
+ * rq->lock protects the run queue and the state of the processes in it. schedule()
+ * holds the lock across the switch, the next process releases it when it returns
+ * from schedule(), or in schedule_tail() if it is a new one.
+ * */
+#define LOAD_BALANCE_INTERVAL   20
+
+static struct run_queue rqs[NCPU];
+
+// this_rq - the run queue of the cpu we run on
+#define this_rq()               (rqs + cpunum())
 
 static inline void
-sched_class_enqueue(struct proc_struct *proc) {
+sched_class_enqueue(struct run_queue *rq, struct proc_struct *proc) {
     if (proc != idleproc) {
-        sched_class->enqueue(rq, proc);
+        proc_sched_class(proc)->enqueue(rq, proc);
     }
 }
 
 static inline void
 sched_class_dequeue(struct proc_struct *proc) {
-    sched_class->dequeue(rq, proc);
+    proc_sched_class(proc)->dequeue(proc->rq, proc);
+    proc->rq = NULL;
 }
 
 static inline struct proc_struct *
-sched_class_pick_next(void) {
-    return sched_class->pick_next(rq);
+sched_class_pick_next(struct run_queue *rq) {
+    struct proc_struct *next;
+    if ((next = rt_sched_class.pick_next(rq)) == NULL) {
+        next = sched_class->pick_next(rq);
+    }
+    return next;
 }
 
 static void
-sched_class_proc_tick(struct proc_struct *proc) {
+sched_class_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
+    if (rq->proc_num > rq->max_proc_num) {
+        rq->max_proc_num = rq->proc_num;
+    }
     if (proc != idleproc) {
-        sched_class->proc_tick(rq, proc);
+        proc->sched_stat.ss_run_ticks ++;
+        proc_sched_class(proc)->proc_tick(rq, proc);
     }
     else {
         proc->need_resched = 1;
     }
 }
 
-static struct run_queue __rq;
+// rq_load - the runnable processes of cpu, the running one included
+static unsigned int
+rq_load(int cpu) {
+    return rqs[cpu].proc_num + (cpus[cpu].proc != cpus[cpu].idle);
+}
+
+// select_cpu - the started cpu with the least load, for a new process
+static int
+select_cpu(void) {
+    int i, best = cpunum();
+    for (i = 0; i < ncpu; i ++) {
+        if (cpus[i].started && rq_load(i) < rq_load(best)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// find_busiest_rq - the run queue of a started cpu with the most runnable processes
+static struct run_queue *
+find_busiest_rq(void) {
+    struct run_queue *busiest = NULL;
+    int i;
+    for (i = 0; i < ncpu; i ++) {
+        if (cpus[i].started && (busiest == NULL || rqs[i].proc_num > busiest->proc_num)) {
+            busiest = rqs + i;
+        }
+    }
+    return busiest;
+}
+
+// load_balance - move a runnable process from the busiest run queue to rq, the locked
+//              - run queue of this cpu, if this cpu goes idle or the busiest one has at
+//              - least two processes more. returns 1 if a process is moved
+static bool
+load_balance(struct run_queue *rq, bool idle) {
+    struct run_queue *busiest = find_busiest_rq();
+    if (busiest == NULL || busiest == rq || busiest->proc_num == 0) {
+        return 0;
+    }
+    if (!idle && busiest->proc_num < rq->proc_num + 2) {
+        return 0;
+    }
+    // rq is locked already, waiting for the other lock could deadlock with its cpu
+    if (!spin_trylock(&(busiest->lock))) {
+        return 0;
+    }
+    bool moved = 0;
+    list_entry_t *le = &proc_list;
+    while ((le = list_next(le)) != &proc_list) {
+        struct proc_struct *proc = le2proc(le, list_link);
+        if (proc->rq == busiest) {
+            sched_class_dequeue(proc);
+            proc->cpu = rq - rqs;
+            sched_class_enqueue(rq, proc);
+            rq->nr_migrations ++;
+            moved = 1;
+            break;
+        }
+    }
+    spin_unlock(&(busiest->lock));
+    return moved;
+}
 
 void
 sched_init(void) {
-    list_init(&timer_list);
+    int i, n;
+    for (i = 0; i < TVR_SIZE; i ++) {
+        list_init(tv1 + i);
+    }
+    for (n = 0; n < TVN_LEVELS; n ++) {
+        for (i = 0; i < TVN_SIZE; i ++) {
+            list_init(tvn[n] + i);
+        }
+    }
+    timer_jiffies = ticks + 1;
+    list_init(&hr_list);
 
+    // build with DEFS+=-DSCHED_MLFQ or DEFS+=-DSCHED_CFS to use another scheduler
+#if defined(SCHED_MLFQ)
+    sched_class = &mlfq_sched_class;
+#elif defined(SCHED_CFS)
+    sched_class = &cfs_sched_class;
+#else
     sched_class = &default_sched_class;
+#endif
 
-    rq = &__rq;
-    rq->max_time_slice = 5;
-    sched_class->init(rq);
+    spin_lock_register(&timer_lock);
+    for (i = 0; i < ncpu; i ++) {
+        struct run_queue *rq = rqs + i;
+        spin_lock_init(&(rq->lock), "runqueue");
+        rq->max_time_slice = 5;
+        rq->balance_ticks = 0;
+        rq->nr_switches = rq->nr_wakeups = rq->nr_migrations = rq->max_proc_num = 0;
+        rt_sched_class.init(rq);
+        sched_class->init(rq);
+        spin_lock_register(&(rq->lock));
+    }
 
     cprintf("sched class: %s\n", sched_class->name);
+#if defined(SCHED_MLFQ)
+    check_mlfq();
+#endif
 }
 
 void
 wakeup_proc(struct proc_struct *proc) {
     assert(proc->state != PROC_ZOMBIE);
     bool intr_flag;
-    local_intr_save(intr_flag);
+    if (proc->state == PROC_UNINIT) {
+        proc->cpu = select_cpu();
+    }
+    struct cpu *c = cpus + proc->cpu;
+    struct run_queue *rq = rqs + proc->cpu;
+    spin_lock_irqsave(&(rq->lock), intr_flag);
     {
         if (proc->state != PROC_RUNNABLE) {
             proc->state = PROC_RUNNABLE;
             proc->wait_state = 0;
-            if (proc != current) {
-                sched_class_enqueue(proc);
+            if (proc != c->proc) {
+                proc->sched_enqueued = ticks;
+                proc->sched_woken = rdtsc();
+                rq->nr_wakeups ++;
+                sched_class_enqueue(rq, proc);
+                // the idle process does not wait for the next tick to run it, and a
+                // real-time process does not wait for one it would be picked before
+                if (c->proc == c->idle || rt_preempt(proc, c->proc)) {
+                    c->proc->need_resched = 1;
+                    if (c != mycpu()) {
+                        lapic_ipi(c->apicid, IRQ_OFFSET + IRQ_RESCHED);
+                    }
+                }
             }
         }
         else {
             warn("wakeup runnable process.\n");
         }
     }
+    spin_unlock_irqrestore(&(rq->lock), intr_flag);
+}
+
+// sched_stat_switch - account the switch from prev to next, in their schedstat and rq
+static void
+sched_stat_switch(struct run_queue *rq, struct proc_struct *prev, struct proc_struct *next) {
+    rq->nr_switches ++;
+    if (prev != idleproc) {
+        if (prev->state == PROC_RUNNABLE) {
+            prev->sched_stat.ss_nivcsw ++;
+        }
+        else {
+            prev->sched_stat.ss_nvcsw ++;
+        }
+    }
+    if (next != idleproc) {
+        next->sched_stat.ss_wait_ticks += ticks - next->sched_enqueued;
+        if (next->sched_woken != 0) {
+            uint32_t us = tsc_to_us(rdtsc() - next->sched_woken);
+            int bucket = (us < 16) ? 0 : (31 - __builtin_clz(us)) - 3;
+            if (bucket >= SCHEDSTAT_NR_BUCKETS) {
+                bucket = SCHEDSTAT_NR_BUCKETS - 1;
+            }
+            next->sched_stat.ss_latency[bucket] ++;
+            next->sched_woken = 0;
+        }
+    }
+}
+
+// dl_throttle - a SCHED_DEADLINE process which used up its budget sleeps until its
+//             - deadline, then it is woken up into a new period (see rt_enqueue)
+static void
+dl_throttle(void) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    timer_t __timer, *timer = timer_init(&__timer, current, current->dl_deadline - ticks);
+    current->state = PROC_SLEEPING;
+    current->wait_state = WT_THROTTLED;
+    add_timer(timer);
     local_intr_restore(intr_flag);
+
+    schedule();
+
+    del_timer(timer);
 }
 
 void
 schedule(void) {
     bool intr_flag;
     struct proc_struct *next;
-    local_intr_save(intr_flag);
+    struct run_queue *rq = this_rq();
+    if (current->policy == SCHED_DEADLINE && current->state == PROC_RUNNABLE
+        && current->dl_budget <= 0) {
+        if ((int32_t)(current->dl_deadline - ticks) > 0) {
+            dl_throttle();
+            return;
+        }
+        // the period is over already, start the next one
+        current->dl_deadline = ticks + current->dl_period;
+        current->dl_budget = current->dl_runtime;
+    }
+    spin_lock_irqsave(&(rq->lock), intr_flag);
     {
         current->need_resched = 0;
         if (current->state == PROC_RUNNABLE) {
-            sched_class_enqueue(current);
+            current->sched_enqueued = ticks;
+            sched_class_enqueue(rq, current);
+        }
+        // an idle cpu steals a process from the busiest run queue
+        if ((next = sched_class_pick_next(rq)) == NULL && load_balance(rq, 1)) {
+            next = sched_class_pick_next(rq);
         }
-        if ((next = sched_class_pick_next()) != NULL) {
+        if (next != NULL) {
             sched_class_dequeue(next);
         }
         if (next == NULL) {
             next = idleproc;
         }
+        next->cpu = cpunum();
+        next->sched_stat.ss_cpus |= 1 << next->cpu;
         next->runs ++;
         if (next != current) {
+            sched_stat_switch(rq, current, next);
             proc_run(next);
         }
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&(this_rq()->lock), intr_flag);
 }
 
+// schedule_tail - release the run queue lock schedule() held across the switch to a new
+//               - process, called by forkret
+void
+schedule_tail(void) {
+    spin_unlock(&(this_rq()->lock));
+}
+
+// internal_add_timer - put the timer into the slot of the wheel its expiry tick falls in
+static void
+internal_add_timer(timer_t *timer) {
+    unsigned int expires = timer->expires, idx = expires - timer_jiffies;
+    list_entry_t *vec;
+    if ((int)idx < 0) {
+        // missed its tick, run it with the next one
+        vec = tv1 + (timer_jiffies & TVR_MASK);
+    }
+    else if (idx < TVR_SIZE) {
+        vec = tv1 + (expires & TVR_MASK);
+    }
+    else {
+        int n = 0;
+        while (n < TVN_LEVELS - 1 && (idx >> (TVR_BITS + (n + 1) * TVN_BITS)) != 0) {
+            n ++;
+        }
+        vec = tvn[n] + ((expires >> (TVR_BITS + n * TVN_BITS)) & TVN_MASK);
+    }
+    list_add_before(vec, &(timer->timer_link));
+}
+
+// cascade - move the timers of slot index of tvn[n] into the lower wheels, returns index
+static int
+cascade(int n, int index) {
+    list_entry_t list, *head = tvn[n] + index, *le;
+    if (list_empty(head)) {
+        return index;
+    }
+    list_add(head, &list);
+    list_del_init(head);
+    while ((le = list_next(&list)) != &list) {
+        list_del_init(le);
+        internal_add_timer(le2timer(le, timer_link));
+    }
+    return index;
+}
+
+// hr_add_timer - put the timer of the current tick into hr_list, in the order of sub
+static void
+hr_add_timer(timer_t *timer) {
+    list_entry_t *le = &hr_list;
+    while ((le = list_next(le)) != &hr_list) {
+        if (le2timer(le, timer_link)->sub > timer->sub) {
+            break;
+        }
+    }
+    list_add_before(le, &(timer->timer_link));
+}
+
+// timer_wakeup - wake up the process of an expired timer
+static void
+timer_wakeup(timer_t *timer) {
+    struct proc_struct *proc = timer->proc;
+    list_del_init(&(timer->timer_link));
+    if (proc->wait_state != 0) {
+        assert(proc->wait_state & WT_INTERRUPTED);
+    }
+    else {
+        warn("process %d's wait_state == 0.\n", proc->pid);
+    }
+    wakeup_proc(proc);
+}
+
+// run_hrtimers - run the expired timers of hr_list, and set the 8253 to interrupt at the
+//              - next one. called with timer_lock held
+static void
+run_hrtimers(void) {
+    if (!list_empty(&hr_list)) {
+        uint32_t now = clock_elapsed();
+        while (!list_empty(&hr_list)) {
+            timer_t *timer = le2timer(list_next(&hr_list), timer_link);
+            assert((int)(timer->expires - ticks) <= 0);
+            if (timer->expires == ticks && timer->sub > now) {
+                clock_set_event(timer->sub);
+                return;
+            }
+            timer_wakeup(timer);
+        }
+    }
+    clock_set_event(0);
+}
+
+// add_timer - start the timer, it expires timer->expires ticks (and timer->sub counts)
+//           - from now
 void
 add_timer(timer_t *timer) {
     bool intr_flag;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&timer_lock, intr_flag);
     {
-        assert(timer->expires > 0 && timer->proc != NULL);
+        assert((timer->expires > 0 || timer->sub > 0) && timer->proc != NULL);
         assert(list_empty(&(timer->timer_link)));
-        list_entry_t *le = list_next(&timer_list);
-        while (le != &timer_list) {
-            timer_t *next = le2timer(le, timer_link);
-            if (timer->expires < next->expires) {
-                next->expires -= timer->expires;
-                break;
+        if (timer->sub != 0) {
+            // the sub-tick part counts from now, make it count from a tick
+            timer->sub += clock_elapsed();
+            for (; timer->sub >= CLOCK_TICK_COUNT; timer->sub -= CLOCK_TICK_COUNT) {
+                timer->expires ++;
             }
-            timer->expires -= next->expires;
-            le = list_next(le);
         }
-        list_add_before(le, &(timer->timer_link));
+        timer->expires += ticks;
+        if (timer->sub != 0 && (int)(timer->expires - timer_jiffies) < 0) {
+            // within the current tick, the wheel has run its slot already
+            hr_add_timer(timer);
+            run_hrtimers();
+        }
+        else {
+            internal_add_timer(timer);
+        }
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&timer_lock, intr_flag);
 }
 
+// del_timer - stop the timer if it has not expired yet
 void
 del_timer(timer_t *timer) {
     bool intr_flag;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&timer_lock, intr_flag);
     {
-        if (!list_empty(&(timer->timer_link))) {
-            if (timer->expires != 0) {
-                list_entry_t *le = list_next(&(timer->timer_link));
-                if (le != &timer_list) {
-                    timer_t *next = le2timer(le, timer_link);
-                    next->expires += timer->expires;
+        list_del_init(&(timer->timer_link));
+    }
+    spin_unlock_irqrestore(&timer_lock, intr_flag);
+}
+
+// run_timers - run the timers of the ticks passed since the last call, called with
+//            - timer_lock held
+static void
+run_timers(void) {
+    while ((int)(ticks - timer_jiffies) >= 0) {
+        int n, index = timer_jiffies & TVR_MASK;
+        if (index == 0) {
+            for (n = 0; n < TVN_LEVELS; n ++) {
+                if (cascade(n, (timer_jiffies >> (TVR_BITS + n * TVN_BITS)) & TVN_MASK) != 0) {
+                    break;
                 }
             }
-            list_del_init(&(timer->timer_link));
+        }
+        timer_jiffies ++;
+
+        list_entry_t *head = tv1 + index, *le;
+        while ((le = list_next(head)) != head) {
+            timer_t *timer = le2timer(le, timer_link);
+            if (timer->sub != 0) {
+                list_del_init(le);
+                hr_add_timer(timer);
+            }
+            else {
+                timer_wakeup(timer);
+            }
         }
     }
-    local_intr_restore(intr_flag);
 }
 
+// run_timer_list - run the timers expired since the last call, and tick the current
+//                - process if nticks ticks passed
 void
-run_timer_list(void) {
+run_timer_list(unsigned int nticks) {
     bool intr_flag;
+    struct run_queue *rq = this_rq();
     local_intr_save(intr_flag);
     {
-        list_entry_t *le = list_next(&timer_list);
-        if (le != &timer_list) {
-            timer_t *timer = le2timer(le, timer_link);
-            assert(timer->expires != 0);
-            timer->expires --;
-            while (timer->expires == 0) {
-                le = list_next(le);
-                struct proc_struct *proc = timer->proc;
-                if (proc->wait_state != 0) {
-                    assert(proc->wait_state & WT_INTERRUPTED);
-                }
-                else {
-                    warn("process %d's wait_state == 0.\n", proc->pid);
-                }
-                wakeup_proc(proc);
-                del_timer(timer);
-                if (le == &timer_list) {
+        spin_lock(&timer_lock);
+        run_timers();
+        run_hrtimers();
+        spin_unlock(&timer_lock);
+
+        if (nticks != 0) {
+            spin_lock(&(rq->lock));
+            sched_class_proc_tick(rq, current);
+            if ((rq->balance_ticks += nticks) >= LOAD_BALANCE_INTERVAL) {
+                rq->balance_ticks = 0;
+                load_balance(rq, 0);
+            }
+            spin_unlock(&(rq->lock));
+        }
+    }
+    local_intr_restore(intr_flag);
+}
+
+// timer_next_event - the time from the last tick until the next timer may expire, at
+//                  - most max ticks, in 8253 counts. the idle process halts until then.
+uint32_t
+timer_next_event(unsigned int max) {
+    uint32_t until;
+    unsigned int n = 1;
+    bool intr_flag;
+    spin_lock_irqsave(&timer_lock, intr_flag);
+    {
+        // catch up with the ticks the idle process woke up early in
+        run_timers();
+        run_hrtimers();
+        if (!list_empty(&hr_list)) {
+            until = le2timer(list_next(&hr_list), timer_link)->sub;
+        }
+        else {
+            for (; n < max; n ++) {
+                unsigned int index = (timer_jiffies + n - 1) & TVR_MASK;
+                // a cascade may bring in timers of the higher levels
+                if (index == 0 || !list_empty(tv1 + index)) {
                     break;
                 }
-                timer = le2timer(le, timer_link);
             }
+            until = n * CLOCK_TICK_COUNT;
         }
-        sched_class_proc_tick(current);
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&timer_lock, intr_flag);
+    return until;
 }
+
+// print_schedstat - print the counters of the run queues and the scheduling counters of
+//                 - all the processes, the "sched" command of the kernel monitor
+void
+print_schedstat(void) {
+    int i;
+    for (i = 0; i < ncpu; i ++) {
+        if (cpus[i].started) {
+            struct run_queue *rq = rqs + i;
+            cprintf("run queue %d: %u switches, %u wakeups, %u migrations, %u queued, "
+                    "%u queued at most\n", i, rq->nr_switches, rq->nr_wakeups,
+                    rq->nr_migrations, rq->proc_num, rq->max_proc_num);
+        }
+    }
+    cprintf("%5s %-15s %8s %8s %8s %8s %8s  latency (<16us, <32us, ...)\n",
+            "pid", "name", "runs", "run", "wait", "vcsw", "ivcsw");
+    list_entry_t *le = &proc_list;
+    while ((le = list_next(le)) != &proc_list) {
+        struct proc_struct *proc = le2proc(le, list_link);
+        struct schedstat *ss = &(proc->sched_stat);
+        cprintf("%5d %-15s %8d %8u %8u %8u %8u ", proc->pid, proc->name, proc->runs,
+                ss->ss_run_ticks, ss->ss_wait_ticks, ss->ss_nvcsw, ss->ss_nivcsw);
+        for (i = 0; i < SCHEDSTAT_NR_BUCKETS; i ++) {
+            cprintf(" %u", ss->ss_latency[i]);
+        }
+        cprintf("\n");
+    }
+}
+
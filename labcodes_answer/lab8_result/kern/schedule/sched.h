@@ -4,11 +4,18 @@
 #include <defs.h>
 #include <list.h>
 #include <skew_heap.h>
+#include <spinlock.h>
+#include <unistd.h>
+#include <clock.h>
 
 struct proc_struct;
 
+// expires is the number of ticks from now for add_timer, and becomes the tick the
+// timer expires at while it is in the timer wheel. sub adds the 8253 counts of a part
+// of a tick, it counts from the tick the timer expires at once the timer is added
 typedef struct {
     unsigned int expires;
+    uint32_t sub;
     struct proc_struct *proc;
     list_entry_t timer_link;
 } timer_t;
@@ -19,11 +26,21 @@ to_struct((le), timer_t, member)
 static inline timer_t *
 timer_init(timer_t *timer, struct proc_struct *proc, int expires) {
     timer->expires = expires;
+    timer->sub = 0;
     timer->proc = proc;
     list_init(&(timer->timer_link));
     return timer;
 }
 
+// timer_init_us - a timer expiring usec microseconds from now, rounded up to a count
+static inline timer_t *
+timer_init_us(timer_t *timer, struct proc_struct *proc, unsigned int usec) {
+    timer_init(timer, proc, usec / CLOCK_TICK_US);
+    usec %= CLOCK_TICK_US;
+    timer->sub = (usec * CLOCK_TICK_COUNT + CLOCK_TICK_US - 1) / CLOCK_TICK_US;
+    return timer;
+}
+
 struct run_queue;
 
 // The introduction of scheduling classes is borrrowed from Linux, and makes the 
@@ -42,29 +59,50 @@ struct sched_class {
     struct proc_struct *(*pick_next)(struct run_queue *rq);
     // dealer of the time-tick
     void (*proc_tick)(struct run_queue *rq, struct proc_struct *proc);
-    /* for SMP support in the future
-     *  load_balance
-     *     void (*load_balance)(struct rq* rq);
-     *  get some proc from this rq, used in load_balance,
-     *  return value is the num of gotten proc
-     *  int (*get_proc)(struct rq* rq, struct proc* procs_moved[]);
-     */
+    // the load balancing between the per-cpu run queues is done in sched.c, with
+    // dequeue and enqueue
 };
 
+#define MLFQ_NR_LEVELS          8
+#define RT_NR_PRIO              (SCHED_PRIO_MAX + 1)
+
 struct run_queue {
+    spinlock_t lock;
     list_entry_t run_list;
     unsigned int proc_num;
     int max_time_slice;
     // For LAB6 ONLY
     skew_heap_entry_t *lab6_run_pool;
+    // the queues of the MLFQ scheduler, and the bitmap of the non-empty ones
+    list_entry_t mlfq_queue[MLFQ_NR_LEVELS];
+    uint32_t mlfq_bitmap;
+    int mlfq_boost_ticks;
+    // the total weight of the queued processes and the vruntime floor of the CFS scheduler
+    unsigned int cfs_load;
+    uint32_t cfs_min_vruntime;
+    // the queues of the real-time scheduler: one per fixed priority with the bitmap of the
+    // non-empty ones, and the SCHED_DEADLINE processes by deadline
+    list_entry_t rt_queue[RT_NR_PRIO];
+    uint32_t rt_bitmap;
+    list_entry_t dl_list;
+    // the ticks since load_balance ran last
+    int balance_ticks;
+    // the counters printed by print_schedstat
+    uint32_t nr_switches;
+    uint32_t nr_wakeups;
+    uint32_t nr_migrations;
+    unsigned int max_proc_num;
 };
 
 void sched_init(void);
 void wakeup_proc(struct proc_struct *proc);
 void schedule(void);
+void schedule_tail(void);
 void add_timer(timer_t *timer);
 void del_timer(timer_t *timer);
-void run_timer_list(void);
+void run_timer_list(unsigned int nticks);
+uint32_t timer_next_event(unsigned int max);
+void print_schedstat(void);
 
 #endif /* !__KERN_SCHEDULE_SCHED_H__ */
 
@@ -0,0 +1,160 @@
+#include <defs.h>
+#include <list.h>
+#include <wait.h>
+#include <sync.h>
+#include <proc.h>
+#include <sched.h>
+#include <vmm.h>
+#include <pmm.h>
+#include <error.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <futex.h>
+
+/* *
+ * futex - fast user-space mutex support
+ *
+ * A user-space lock word is only handed to the kernel when the lock is
+ * contended. do_futex_wait puts current to sleep if the word still holds the
+ * expected value, and do_futex_wake wakes up the processes sleeping on it.
+ *
+ * ucore has no memory shared between mms, so a futex is private to the threads
+ * of a mm (CLONE_VM) and is identified by the mm and the user address of the word.
+ * The key does not change when the page of the word is swapped out or moved off
+ * the zero page. Waiters are hashed on the key into a fixed number of wait queues.
+ * */
+
+#define FUTEX_HASH_SHIFT        6
+#define FUTEX_HASH_SIZE         (1 << FUTEX_HASH_SHIFT)
+#define futex_hashfn(mm, uaddr) (hash32((uintptr_t)(mm) ^ (uaddr), FUTEX_HASH_SHIFT))
+
+typedef struct {
+    struct mm_struct *mm;
+    uintptr_t uaddr;
+    wait_t wait;
+} futex_wait_t;
+
+#define le2fwait(w)             \
+    to_struct((w), futex_wait_t, wait)
+
+static wait_queue_t futex_queue[FUTEX_HASH_SIZE];
+
+void
+futex_init(void) {
+    int i;
+    for (i = 0; i < FUTEX_HASH_SIZE; i ++) {
+        wait_queue_init(futex_queue + i);
+    }
+}
+
+// futex_check - the user word at uaddr must be aligned and writable
+static int
+futex_check(struct mm_struct *mm, uintptr_t uaddr) {
+    if (uaddr % sizeof(int) != 0 || !user_mem_check(mm, uaddr, sizeof(int), 1)) {
+        return -E_INVAL;
+    }
+    return 0;
+}
+
+// futex_fault_in - make the page of the user word at uaddr present and writable, a write
+//                - fault swaps it in, or moves it off the zero page
+static int
+futex_fault_in(struct mm_struct *mm, uintptr_t uaddr) {
+    int ret = 0;
+    lock_mm(mm);
+    pte_t *ptep = get_pte(mm->pgdir, uaddr, 0);
+    if (ptep == NULL || !(*ptep & PTE_P) || !(*ptep & PTE_W)) {
+        // a write fault, present if the pte maps a read-only page (the zero page)
+        uint32_t error_code = 2 | ((ptep != NULL && (*ptep & PTE_P)) ? 1 : 0);
+        if (do_pgfault(mm, error_code, uaddr) != 0) {
+            ret = -E_NO_MEM;
+        }
+    }
+    unlock_mm(mm);
+    return ret;
+}
+
+// do_futex_wait - sleep on uaddr if *uaddr == val, until woken by do_futex_wake,
+//               - or "timeout" ticks (microseconds if timeout_us) passed, 0 means no timeout
+int
+do_futex_wait(uintptr_t uaddr, int val, unsigned int timeout, bool timeout_us) {
+    struct mm_struct *mm = current->mm;
+    int ret;
+    if ((ret = futex_check(mm, uaddr)) != 0) {
+        return ret;
+    }
+
+    bool intr_flag;
+    wait_queue_t *queue = futex_queue + futex_hashfn(mm, uaddr);
+    futex_wait_t __fwait, *fwait = &__fwait;
+    timer_t __timer, *timer = timeout_us ? timer_init_us(&__timer, current, timeout)
+                                         : timer_init(&__timer, current, timeout);
+
+    while (1) {
+        if ((ret = futex_fault_in(mm, uaddr)) != 0) {
+            return ret;
+        }
+        local_intr_save(intr_flag);
+        // the page may be swapped out again while futex_fault_in slept, the word is
+        // only read here, with interrupts off, if that would not fault
+        pte_t *ptep = get_pte(mm->pgdir, uaddr, 0);
+        if (ptep != NULL && (*ptep & PTE_P)) {
+            break;
+        }
+        local_intr_restore(intr_flag);
+    }
+    // the word may be changed by the lock holder since it was checked
+    if (*(volatile int *)uaddr != val) {
+        local_intr_restore(intr_flag);
+        return -E_BUSY;
+    }
+    fwait->mm = mm, fwait->uaddr = uaddr;
+    wait_current_set(queue, &(fwait->wait), WT_FUTEX);
+    if (timeout != 0) {
+        add_timer(timer);
+    }
+    local_intr_restore(intr_flag);
+
+    schedule();
+
+    local_intr_save(intr_flag);
+    wait_current_del(queue, &(fwait->wait));
+    local_intr_restore(intr_flag);
+    if (timeout != 0) {
+        del_timer(timer);
+    }
+
+    if (fwait->wait.wakeup_flags == WT_FUTEX) {
+        return 0;
+    }
+    return (current->flags & PF_EXITING) ? -E_KILLED : -E_TIMEOUT;
+}
+
+// do_futex_wake - wake up at most nr processes sleeping on uaddr,
+//               - return the number of processes woken up
+int
+do_futex_wake(uintptr_t uaddr, int nr) {
+    struct mm_struct *mm = current->mm;
+    int ret;
+    if ((ret = futex_check(mm, uaddr)) != 0) {
+        return ret;
+    }
+
+    bool intr_flag;
+    wait_queue_t *queue = futex_queue + futex_hashfn(mm, uaddr);
+    local_intr_save(intr_flag);
+    {
+        wait_t *wait = wait_queue_first(queue), *next;
+        while (wait != NULL && ret < nr) {
+            next = wait_queue_next(queue, wait);
+            if (le2fwait(wait)->mm == mm && le2fwait(wait)->uaddr == uaddr) {
+                wakeup_wait(queue, wait, WT_FUTEX, 1);
+                ret ++;
+            }
+            wait = next;
+        }
+    }
+    local_intr_restore(intr_flag);
+    return ret;
+}
+
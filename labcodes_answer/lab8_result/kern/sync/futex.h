@@ -0,0 +1,11 @@
+#ifndef __KERN_SYNC_FUTEX_H__
+#define __KERN_SYNC_FUTEX_H__
+
+#include <defs.h>
+
+void futex_init(void);
+int do_futex_wait(uintptr_t uaddr, int val, unsigned int timeout, bool timeout_us);
+int do_futex_wake(uintptr_t uaddr, int nr);
+
+#endif /* !__KERN_SYNC_FUTEX_H__ */
+
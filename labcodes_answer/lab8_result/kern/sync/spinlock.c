@@ -0,0 +1,100 @@
+#include <defs.h>
+#include <list.h>
+#include <stdio.h>
+#include <assert.h>
+#include <atomic.h>
+#include <sync.h>
+#include <spinlock.h>
+#include <mp.h>
+
+// the locks registered by spin_lock_register
+static list_entry_t spinlock_list = {&spinlock_list, &spinlock_list};
+
+void
+spin_lock_init(spinlock_t *lock, const char *name) {
+    lock->next = lock->owner = 0;
+    lock->cpu = -1;
+    lock->name = name;
+    lock->acquired = lock->contended = lock->spins = 0;
+    list_init(&(lock->lock_link));
+}
+
+// spin_lock_register - list the lock in print_spinlocks, the lock must never be freed
+void
+spin_lock_register(spinlock_t *lock) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        list_add_before(&spinlock_list, &(lock->lock_link));
+    }
+    local_intr_restore(intr_flag);
+}
+
+// spin_holding - the lock is held by this cpu
+bool
+spin_holding(spinlock_t *lock) {
+    return spin_is_locked(lock) && lock->cpu == cpunum();
+}
+
+// spin_lock - take the lock, spinning while another cpu holds it. the counters are
+//           - updated once the lock is held, so the cpus do not race on them
+void
+spin_lock(spinlock_t *lock) {
+    if (spin_holding(lock)) {
+        panic("spin_lock: %s is held already by cpu %d.\n", lock->name, lock->cpu);
+    }
+    uint32_t spins = 0;
+    int ticket = xadd(&(lock->next), 1);
+    while (lock->owner != ticket) {
+        spins ++;
+        cpu_relax();
+    }
+    lock->cpu = cpunum();
+    lock->acquired ++;
+    if (spins != 0) {
+        lock->contended ++;
+        lock->spins += spins;
+    }
+}
+
+// spin_trylock - take the lock if it is free, returns 1 on success
+bool
+spin_trylock(spinlock_t *lock) {
+    int owner = lock->owner;
+    if (lock->next != owner || cmpxchg(&(lock->next), owner, owner + 1) != owner) {
+        return 0;
+    }
+    lock->cpu = cpunum();
+    lock->acquired ++;
+    return 1;
+}
+
+// spin_unlock - release the lock, which this cpu must hold. the lock taken by schedule()
+//             - is released by the next process, which runs on the same cpu
+void
+spin_unlock(spinlock_t *lock) {
+    if (!spin_holding(lock)) {
+        panic("spin_unlock: %s is not held by cpu %d.\n", lock->name, cpunum());
+    }
+    lock->cpu = -1;
+    asm volatile ("" ::: "memory");
+    lock->owner ++;
+}
+
+void
+print_spinlocks(void) {
+    cprintf("%-16s %10s %10s %10s %6s\n", "lock", "acquired", "contended", "spins", "cpu");
+    list_entry_t *le = &spinlock_list;
+    while ((le = list_next(le)) != &spinlock_list) {
+        spinlock_t *lock = to_struct(le, spinlock_t, lock_link);
+        int cpu = lock->cpu;
+        cprintf("%-16s %10u %10u %10u ", lock->name, lock->acquired, lock->contended, lock->spins);
+        if (cpu < 0) {
+            cprintf("%6s\n", "-");
+        }
+        else {
+            cprintf("%6d\n", cpu);
+        }
+    }
+}
+
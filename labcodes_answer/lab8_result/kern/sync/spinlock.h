@@ -0,0 +1,55 @@
+#ifndef __KERN_SYNC_SPINLOCK_H__
+#define __KERN_SYNC_SPINLOCK_H__
+
+#include <defs.h>
+#include <list.h>
+
+/* *
+ * A ticket spinlock: an acquirer takes the next ticket, and spins until the owner
+ * count reaches it, so the cpus get the lock in the order they asked for it. The lock
+ * records the cpu holding it: taking a lock the same cpu holds already would spin
+ * forever, so spin_lock panics on it, and only another cpu is waited for. Every lock
+ * counts how often it was taken, and how often and how long it was waited for,
+ * spin_lock_register puts a long-lived lock on the list printed by print_spinlocks
+ * (the "locks" command of the kernel monitor).
+ *
+ * A spinlock does not disable interrupts, use spin_lock_irqsave (sync.h) for the data
+ * used by interrupt handlers too.
+ * */
+typedef struct spinlock {
+    volatile int next;              // the ticket the next acquirer takes
+    volatile int owner;             // the ticket holding the lock
+    volatile int cpu;               // the cpu holding the lock, -1 if it is free
+    const char *name;
+    uint32_t acquired;              // the times the lock was taken
+    uint32_t contended;             // the times it was found held by another cpu
+    uint32_t spins;                 // the loops spent waiting for it
+    list_entry_t lock_link;         // the entry in the list of registered locks
+} spinlock_t;
+
+#define SPINLOCK_INIT(lockname)     {.next = 0, .owner = 0, .cpu = -1, .name = (lockname)}
+
+static inline void cpu_relax(void) __attribute__((always_inline));
+
+// cpu_relax - the body of a spin loop, it tells the cpu that we spin
+static inline void
+cpu_relax(void) {
+    asm volatile ("pause" ::: "memory");
+}
+
+void spin_lock_init(spinlock_t *lock, const char *name);
+bool spin_holding(spinlock_t *lock);
+void spin_lock_register(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+void print_spinlocks(void);
+
+// spin_is_locked - the lock is held
+static inline bool
+spin_is_locked(spinlock_t *lock) {
+    return lock->next != lock->owner;
+}
+
+#endif /* !__KERN_SYNC_SPINLOCK_H__ */
+
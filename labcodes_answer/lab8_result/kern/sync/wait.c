@@ -11,60 +11,67 @@ wait_init(wait_t *wait, struct proc_struct *proc) {
     list_init(&(wait->wait_link));
 }
 
+// the list of a wait queue is only touched with queue->lock held, the lock is never held
+// across a wakeup_proc
 void
 wait_queue_init(wait_queue_t *queue) {
+    spin_lock_init(&(queue->lock), "waitqueue");
     list_init(&(queue->wait_head));
 }
 
 void
 wait_queue_add(wait_queue_t *queue, wait_t *wait) {
+    bool intr_flag;
     assert(list_empty(&(wait->wait_link)) && wait->proc != NULL);
+    spin_lock_irqsave(&(queue->lock), intr_flag);
     wait->wait_queue = queue;
     list_add_before(&(queue->wait_head), &(wait->wait_link));
+    spin_unlock_irqrestore(&(queue->lock), intr_flag);
 }
 
 void
 wait_queue_del(wait_queue_t *queue, wait_t *wait) {
+    bool intr_flag;
     assert(!list_empty(&(wait->wait_link)) && wait->wait_queue == queue);
+    spin_lock_irqsave(&(queue->lock), intr_flag);
     list_del_init(&(wait->wait_link));
+    spin_unlock_irqrestore(&(queue->lock), intr_flag);
+}
+
+// wait_queue_get - the wait one step away from "from", NULL if the step reaches the head
+static wait_t *
+wait_queue_get(wait_queue_t *queue, list_entry_t *(*step)(list_entry_t *), list_entry_t *from) {
+    bool intr_flag;
+    wait_t *wait = NULL;
+    spin_lock_irqsave(&(queue->lock), intr_flag);
+    list_entry_t *le = step(from);
+    if (le != &(queue->wait_head)) {
+        wait = le2wait(le, wait_link);
+    }
+    spin_unlock_irqrestore(&(queue->lock), intr_flag);
+    return wait;
 }
 
 wait_t *
 wait_queue_next(wait_queue_t *queue, wait_t *wait) {
     assert(!list_empty(&(wait->wait_link)) && wait->wait_queue == queue);
-    list_entry_t *le = list_next(&(wait->wait_link));
-    if (le != &(queue->wait_head)) {
-        return le2wait(le, wait_link);
-    }
-    return NULL;
+    return wait_queue_get(queue, list_next, &(wait->wait_link));
 }
 
 wait_t *
 wait_queue_prev(wait_queue_t *queue, wait_t *wait) {
     assert(!list_empty(&(wait->wait_link)) && wait->wait_queue == queue);
-    list_entry_t *le = list_prev(&(wait->wait_link));
-    if (le != &(queue->wait_head)) {
-        return le2wait(le, wait_link);
-    }
-    return NULL;
+    return wait_queue_get(queue, list_prev, &(wait->wait_link));
 }
 
 wait_t *
 wait_queue_first(wait_queue_t *queue) {
-    list_entry_t *le = list_next(&(queue->wait_head));
-    if (le != &(queue->wait_head)) {
-        return le2wait(le, wait_link);
-    }
-    return NULL;
+    return wait_queue_get(queue, list_next, &(queue->wait_head));
 }
 
 wait_t *
 wait_queue_last(wait_queue_t *queue) {
-    list_entry_t *le = list_prev(&(queue->wait_head));
-    if (le != &(queue->wait_head)) {
-        return le2wait(le, wait_link);
-    }
-    return NULL;
+    return wait_queue_get(queue, list_prev, &(queue->wait_head));
 }
 
 bool
@@ -2,8 +2,10 @@
 #define __KERN_SYNC_WAIT_H__
 
 #include <list.h>
+#include <spinlock.h>
 
 typedef struct {
+    spinlock_t lock;
     list_entry_t wait_head;
 } wait_queue_t;
 
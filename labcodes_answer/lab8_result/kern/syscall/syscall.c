@@ -10,6 +10,9 @@
 #include <stat.h>
 #include <dirent.h>
 #include <sysfile.h>
+#include <error.h>
+#include <futex.h>
+#include <memstat.h>
 
 static int
 sys_exit(uint32_t arg[]) {
@@ -24,6 +27,17 @@ sys_fork(uint32_t arg[]) {
     return do_fork(0, stack, tf);
 }
 
+static int
+sys_clone(uint32_t arg[]) {
+    struct trapframe *tf = current->tf;
+    uint32_t clone_flags = (uint32_t)arg[0];
+    uintptr_t stack = (uintptr_t)arg[1];
+    if (stack == 0) {
+        stack = tf->tf_esp;
+    }
+    return do_fork(clone_flags, stack, tf);
+}
+
 static int
 sys_wait(uint32_t arg[]) {
     int pid = (int)arg[0];
@@ -55,6 +69,72 @@ sys_getpid(uint32_t arg[]) {
     return current->pid;
 }
 
+static int
+sys_mmap(uint32_t arg[]) {
+    uintptr_t *addr_store = (uintptr_t *)arg[0];
+    size_t len = (size_t)arg[1];
+    uint32_t mmap_flags = (uint32_t)arg[2];
+    return do_mmap(addr_store, len, mmap_flags);
+}
+
+static int
+sys_munmap(uint32_t arg[]) {
+    uintptr_t addr = (uintptr_t)arg[0];
+    size_t len = (size_t)arg[1];
+    return do_munmap(addr, len);
+}
+
+static int
+sys_futex(uint32_t arg[]) {
+    uintptr_t uaddr = (uintptr_t)arg[0];
+    int op = (int)arg[1];
+    int val = (int)arg[2];
+    unsigned int timeout = (unsigned int)arg[3];
+    switch (op) {
+    case FUTEX_WAIT:
+        return do_futex_wait(uaddr, val, timeout, 0);
+    case FUTEX_WAIT_US:
+        return do_futex_wait(uaddr, val, timeout, 1);
+    case FUTEX_WAKE:
+        return do_futex_wake(uaddr, val);
+    }
+    return -E_INVAL;
+}
+
+static int
+sys_memstat(uint32_t arg[]) {
+    struct memstat *stat = (struct memstat *)arg[0];
+    return do_memstat(stat);
+}
+
+static int
+sys_rsslimit(uint32_t arg[]) {
+    int limit = (int)arg[0];
+    return do_rsslimit(limit);
+}
+
+static int
+sys_setnice(uint32_t arg[]) {
+    int nice = (int)arg[0];
+    return do_setnice(nice);
+}
+
+static int
+sys_setsched(uint32_t arg[]) {
+    int policy = (int)arg[0];
+    int priority = (int)arg[1];
+    int runtime = (int)arg[2];
+    int period = (int)arg[3];
+    return do_setsched(policy, priority, runtime, period);
+}
+
+static int
+sys_schedstat(uint32_t arg[]) {
+    int pid = (int)arg[0];
+    struct schedstat *stat = (struct schedstat *)arg[1];
+    return do_schedstat(pid, stat);
+}
+
 static int
 sys_putc(uint32_t arg[]) {
     int c = (int)arg[0];
@@ -86,6 +166,12 @@ sys_sleep(uint32_t arg[]) {
     return do_sleep(time);
 }
 
+static int
+sys_usleep(uint32_t arg[]) {
+    unsigned int usec = (unsigned int)arg[0];
+    return do_usleep(usec);
+}
+
 static int
 sys_open(uint32_t arg[]) {
     const char *path = (const char *)arg[0];
@@ -162,14 +248,24 @@ static int (*syscalls[])(uint32_t arg[]) = {
     [SYS_fork]              sys_fork,
     [SYS_wait]              sys_wait,
     [SYS_exec]              sys_exec,
+    [SYS_clone]             sys_clone,
     [SYS_yield]             sys_yield,
     [SYS_kill]              sys_kill,
     [SYS_getpid]            sys_getpid,
+    [SYS_mmap]              sys_mmap,
+    [SYS_munmap]            sys_munmap,
+    [SYS_futex]             sys_futex,
+    [SYS_memstat]           sys_memstat,
+    [SYS_rsslimit]          sys_rsslimit,
+    [SYS_setnice]           sys_setnice,
+    [SYS_setsched]          sys_setsched,
+    [SYS_schedstat]         sys_schedstat,
     [SYS_putc]              sys_putc,
     [SYS_pgdir]             sys_pgdir,
     [SYS_gettime]           sys_gettime,
     [SYS_lab6_set_priority] sys_lab6_set_priority,
     [SYS_sleep]             sys_sleep,
+    [SYS_usleep]            sys_usleep,
     [SYS_open]              sys_open,
     [SYS_close]             sys_close,
     [SYS_read]              sys_read,
@@ -16,6 +16,9 @@
 #include <sched.h>
 #include <sync.h>
 #include <proc.h>
+#include <pmm.h>
+#include <mp.h>
+#include <lapic.h>
 
 #define TICK_NUM 100
 
@@ -63,6 +66,12 @@ idt_init(void) {
         SETGATE(idt[i], 0, GD_KTEXT, __vectors[i], DPL_KERNEL);
     }
     SETGATE(idt[T_SYSCALL], 1, GD_KTEXT, __vectors[T_SYSCALL], DPL_USER);
+    idt_load();
+}
+
+/* idt_load - load the IDT on the cpu we run on, all the cpus share it */
+void
+idt_load(void) {
     lidt(&idt_pd);
 }
 
@@ -94,7 +103,7 @@ trapname(int trapno) {
     if (trapno < sizeof(excnames)/sizeof(const char * const)) {
         return excnames[trapno];
     }
-    if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16) {
+    if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 32) {
         return "Hardware Interrupt";
     }
     return "(unknown trap)";
@@ -239,9 +248,8 @@ trap_dispatch(struct trapframe *tf) {
          *    Every tick, you should update the system time, iterate the timers, and trigger the timers which are end to call scheduler.
          *    You can use one funcitons to finish all these things.
          */
-        ticks ++;
         assert(current != NULL);
-        run_timer_list();
+        run_timer_list(clock_tick());
         break;
     case IRQ_OFFSET + IRQ_COM1:
         //c = cons_getc();
@@ -264,6 +272,22 @@ trap_dispatch(struct trapframe *tf) {
     case IRQ_OFFSET + IRQ_IDE2:
         /* do nothing */
         break;
+    case IRQ_OFFSET + IRQ_LTIMER:
+        // the tick of an application processor, only the boot cpu counts the ticks
+        lapic_eoi();
+        run_timer_list(1);
+        break;
+    case IRQ_OFFSET + IRQ_RESCHED:
+        // wakeup_proc has set need_resched already
+        lapic_eoi();
+        break;
+    case IRQ_OFFSET + IRQ_ERROR:
+        cprintf("lapic: error interrupt on cpu %d.\n", cpunum());
+        lapic_eoi();
+        break;
+    case IRQ_OFFSET + IRQ_SPURIOUS:
+        // not acknowledged
+        break;
     default:
         print_trapframe(tf);
         if (current != NULL) {
@@ -283,6 +307,19 @@ trap_dispatch(struct trapframe *tf) {
  * */
 void
 trap(struct trapframe *tf) {
+    // another cpu waits for this flush, and may hold the kernel lock meanwhile
+    if (tf->tf_trapno == IRQ_OFFSET + IRQ_TLB) {
+        tlb_flush_pending();
+        lapic_eoi();
+        return;
+    }
+    // take the kernel lock, unless the trap came from kernel code holding it already
+    bool locked = 0;
+    if (!spin_holding(&kernel_lock)) {
+        lock_kernel();
+        locked = 1;
+    }
+
     // dispatch based on what type of trap occurred
     // used for previous projects
     if (current == NULL) {
@@ -307,5 +344,9 @@ trap(struct trapframe *tf) {
             }
         }
     }
+    // release the kernel lock when going back to user mode, which kernel_execve does too
+    if (locked || !trap_in_kernel(tf)) {
+        unlock_kernel();
+    }
 }
 
@@ -35,6 +35,10 @@
 #define IRQ_COM1                4
 #define IRQ_IDE1                14
 #define IRQ_IDE2                15
+// the interrupts of the local APICs, see lapic.c
+#define IRQ_LTIMER              16  // the tick of an application processor
+#define IRQ_RESCHED             17  // another cpu queued a process for this one
+#define IRQ_TLB                 18  // another cpu asked for a TLB flush
 #define IRQ_ERROR               19
 #define IRQ_SPURIOUS            31
 
@@ -81,6 +85,7 @@ struct trapframe {
 } __attribute__((packed));
 
 void idt_init(void);
+void idt_load(void);
 void print_trapframe(struct trapframe *tf);
 void print_regs(struct pushregs *regs);
 bool trap_in_kernel(struct trapframe *tf);
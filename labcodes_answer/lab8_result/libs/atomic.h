@@ -9,6 +9,9 @@ static inline void change_bit(int nr, volatile void *addr) __attribute__((always
 static inline bool test_and_set_bit(int nr, volatile void *addr) __attribute__((always_inline));
 static inline bool test_and_clear_bit(int nr, volatile void *addr) __attribute__((always_inline));
 static inline bool test_bit(int nr, volatile void *addr) __attribute__((always_inline));
+static inline int xchg(volatile int *addr, int newval) __attribute__((always_inline));
+static inline int cmpxchg(volatile int *addr, int oldval, int newval) __attribute__((always_inline));
+static inline int xadd(volatile int *addr, int val) __attribute__((always_inline));
 
 /* *
  * set_bit - Atomically set a bit in memory
@@ -78,5 +81,44 @@ test_and_clear_bit(int nr, volatile void *addr) {
     asm volatile ("btrl %2, %1; sbbl %0, %0" : "=r" (oldbit), "=m" (*(volatile long *)addr) : "Ir" (nr) : "memory");
     return oldbit != 0;
 }
+
+/* *
+ * xchg - Atomically exchange the value in memory and return its old value
+ * @addr:   the address of the value
+ * @newval: the value to store
+ * */
+static inline int
+xchg(volatile int *addr, int newval) {
+    int oldval;
+    asm volatile ("xchgl %0, %1" : "=r" (oldval), "+m" (*addr) : "0" (newval) : "memory");
+    return oldval;
+}
+
+/* *
+ * cmpxchg - Atomically store @newval if the value in memory equals @oldval
+ * @addr:   the address of the value
+ * @oldval: the value expected in memory
+ * @newval: the value to store
+ *
+ * Returns the value found in memory, the store succeeded iff it is @oldval.
+ * */
+static inline int
+cmpxchg(volatile int *addr, int oldval, int newval) {
+    int prev;
+    asm volatile ("lock; cmpxchgl %2, %1" : "=a" (prev), "+m" (*addr) : "r" (newval), "0" (oldval) : "memory");
+    return prev;
+}
+
+/* *
+ * xadd - Atomically add @val to the value in memory and return its old value
+ * @addr:   the address of the value
+ * @val:    the value to add
+ * */
+static inline int
+xadd(volatile int *addr, int val) {
+    asm volatile ("lock; xaddl %0, %1" : "+r" (val), "+m" (*addr) : : "memory");
+    return val;
+}
+
 #endif /* !__LIBS_ATOMIC_H__ */
 
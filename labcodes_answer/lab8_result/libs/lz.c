@@ -0,0 +1,128 @@
+#include <defs.h>
+#include <string.h>
+#include <lz.h>
+
+/* *
+ * A small LZ77 compressor, for data up to 64KB.
+ *
+ * The compressed data is a sequence of tokens, each starting with a control byte c:
+ *   c <  0x80 : a literal run, the next c + 1 bytes are copied as they are;
+ *   c >= 0x80 : a match, (c & 0x7F) + LZ_MIN_MATCH bytes are copied from the output
+ *               written so far, starting offset bytes back. offset follows as 2 bytes,
+ *               low byte first, and the copy may overlap itself (eg. a run of zeros).
+ * Matches are found with a hash table of the last position of every 3-byte prefix.
+ * */
+
+#define LZ_MIN_MATCH                3
+#define LZ_MAX_MATCH                (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERAL              0x80
+#define LZ_MAX_OFFSET               0xFFFF
+
+static inline uint32_t
+lz_hash(const uint8_t *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// lz_emit_literals - write the literal runs for src[0, n), return the new op, or 0 if dst is full
+static size_t
+lz_emit_literals(const uint8_t *src, size_t n, uint8_t *dst, size_t op, size_t dstlen) {
+    while (n > 0) {
+        size_t k = (n < LZ_MAX_LITERAL) ? n : LZ_MAX_LITERAL;
+        if (op + 1 + k > dstlen) {
+            return 0;
+        }
+        dst[op ++] = k - 1;
+        memcpy(dst + op, src, k);
+        op += k, src += k, n -= k;
+    }
+    return op;
+}
+
+/* *
+ * lz_compress - compress src[0, srclen) into dst
+ * @work:   a workspace of LZ_WORK_SIZE bytes
+ *
+ * Returns the compressed length, or 0 if it would be more than dstlen
+ * (or src is too long).
+ * */
+size_t
+lz_compress(const void *src, size_t srclen, void *dst, size_t dstlen, void *work) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    // the position + 1 of the last occurrence of each hash, 0 for none
+    uint16_t *htab = work;
+    size_t ip = 0, anchor = 0, op = 0;
+
+    if (srclen > LZ_MAX_OFFSET) {
+        return 0;
+    }
+    memset(htab, 0, LZ_WORK_SIZE);
+    while (ip + LZ_MIN_MATCH <= srclen) {
+        uint32_t h = lz_hash(s + ip);
+        size_t ref = htab[h];
+        htab[h] = ip + 1;
+        if (ref == 0 || memcmp(s + ref - 1, s + ip, LZ_MIN_MATCH) != 0) {
+            ip ++;
+            continue;
+        }
+        ref --;
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < srclen && len < LZ_MAX_MATCH && s[ref + len] == s[ip + len]) {
+            len ++;
+        }
+        if (anchor < ip && (op = lz_emit_literals(s + anchor, ip - anchor, d, op, dstlen)) == 0) {
+            return 0;
+        }
+        if (op + 3 > dstlen) {
+            return 0;
+        }
+        d[op ++] = 0x80 | (len - LZ_MIN_MATCH);
+        d[op ++] = (ip - ref) & 0xFF;
+        d[op ++] = (ip - ref) >> 8;
+        ip += len, anchor = ip;
+    }
+    if (anchor < srclen && (op = lz_emit_literals(s + anchor, srclen - anchor, d, op, dstlen)) == 0) {
+        return 0;
+    }
+    return op;
+}
+
+/* *
+ * lz_decompress - decompress src[0, srclen) into dst
+ *
+ * Returns the decompressed length, or -1 if src is corrupted or does not fit into dstlen.
+ * */
+int
+lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    size_t ip = 0, op = 0;
+    while (ip < srclen) {
+        uint8_t c = s[ip ++];
+        if (c < 0x80) {
+            size_t n = c + 1;
+            if (ip + n > srclen || op + n > dstlen) {
+                return -1;
+            }
+            memcpy(d + op, s + ip, n);
+            ip += n, op += n;
+        }
+        else {
+            size_t len = (c & 0x7F) + LZ_MIN_MATCH, off;
+            if (ip + 2 > srclen) {
+                return -1;
+            }
+            off = s[ip] | (s[ip + 1] << 8);
+            ip += 2;
+            if (off == 0 || off > op || op + len > dstlen) {
+                return -1;
+            }
+            for (; len > 0; len --, op ++) {
+                d[op] = d[op - off];
+            }
+        }
+    }
+    return op;
+}
+
@@ -0,0 +1,14 @@
+#ifndef __LIBS_LZ_H__
+#define __LIBS_LZ_H__
+
+#include <defs.h>
+
+#define LZ_HASH_BITS                10
+// the size of the workspace lz_compress needs
+#define LZ_WORK_SIZE                ((1 << LZ_HASH_BITS) * sizeof(uint16_t))
+
+size_t lz_compress(const void *src, size_t srclen, void *dst, size_t dstlen, void *work);
+int lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen);
+
+#endif /* !__LIBS_LZ_H__ */
+
@@ -0,0 +1,15 @@
+#ifndef __LIBS_MEMSTAT_H__
+#define __LIBS_MEMSTAT_H__
+
+#include <defs.h>
+
+// the memory usage of a process, all counted in pages
+struct memstat {
+    size_t ms_rss;                      // resident pages, the shared zero page is not counted
+    size_t ms_swap;                     // pages swapped out
+    size_t ms_pgtable;                  // page tables, the kernel memory of the address space
+    size_t ms_rss_limit;                // resident limit, 0 if unlimited
+};
+
+#endif /* !__LIBS_MEMSTAT_H__ */
+
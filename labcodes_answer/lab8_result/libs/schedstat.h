@@ -0,0 +1,22 @@
+#ifndef __LIBS_SCHEDSTAT_H__
+#define __LIBS_SCHEDSTAT_H__
+
+#include <defs.h>
+
+#define SCHEDSTAT_NR_BUCKETS            12
+
+// the scheduling counters of a process
+struct schedstat {
+    uint32_t ss_runs;                   // times it was picked to run
+    uint32_t ss_run_ticks;              // ticks it was running
+    uint32_t ss_wait_ticks;             // ticks it waited in a run queue
+    uint32_t ss_nvcsw;                  // switches away because it blocked
+    uint32_t ss_nivcsw;                 // switches away while runnable, preempted or yielding
+    uint32_t ss_cpus;                   // the cpus it ran on, bit i for cpu i
+    // the wakeup-to-run latencies: bucket 0 counts those below 16us, bucket i those in
+    // [2^(i+3), 2^(i+4)) us, and the last bucket all the longer ones too
+    uint32_t ss_latency[SCHEDSTAT_NR_BUCKETS];
+};
+
+#endif /* !__LIBS_SCHEDSTAT_H__ */
+
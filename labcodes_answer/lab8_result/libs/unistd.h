@@ -12,11 +12,18 @@
 #define SYS_yield           10
 #define SYS_sleep           11
 #define SYS_kill            12
+#define SYS_usleep          13
 #define SYS_gettime         17
 #define SYS_getpid          18
 #define SYS_mmap            20
 #define SYS_munmap          21
 #define SYS_shmem           22
+#define SYS_futex           23
+#define SYS_memstat         24
+#define SYS_rsslimit        25
+#define SYS_setnice         26
+#define SYS_setsched        27
+#define SYS_schedstat       28
 #define SYS_putc            30
 #define SYS_pgdir           31
 #define SYS_open            100
@@ -37,6 +44,26 @@
 #define CLONE_THREAD        0x00000200  // thread group
 #define CLONE_FS            0x00000800  // set if shared between processes
 
+/* SYS_mmap flags */
+#define MMAP_WRITE          0x00000100  // the mapped area is writable
+#define MMAP_STACK          0x00000200  // the mapped area is used as a stack
+
+/* SYS_setnice range */
+#define NICE_MIN            -20         // the most CPU time
+#define NICE_MAX            19          // the least CPU time
+
+/* SYS_setsched policies */
+#define SCHED_NORMAL        0           // time-sharing, by the default scheduler class
+#define SCHED_FIFO          1           // fixed priority, runs until it blocks or yields
+#define SCHED_RR            2           // fixed priority, round-robin within a priority
+#define SCHED_DEADLINE      3           // earliest deadline first, runtime ticks per period
+#define SCHED_PRIO_MAX      31          // the lowest SCHED_FIFO/SCHED_RR priority, 0 is the highest
+
+/* SYS_futex operations */
+#define FUTEX_WAIT          0           // sleep if the word still holds the expected value
+#define FUTEX_WAKE          1           // wake up the processes sleeping on the word
+#define FUTEX_WAIT_US       2           // FUTEX_WAIT with the timeout in microseconds
+
 /* VFS flags */
 // flags for open: choose one of these
 #define O_RDONLY            0           // open for reading only
@@ -128,6 +128,9 @@ run_qemu() {
     if [ "$brkfun" ]; then
         qemuextra="-S $qemugdb"
     fi
+    if [ -n "$smp" ]; then
+        qemuextra="$qemuextra -smp $smp"
+    fi
 
     if [ -z "$timeout" ] || [ $timeout -le 0 ]; then
         timeout=$default_timeout;
@@ -246,14 +249,15 @@ check_regexps() {
 }
 
 run_test() {
-    # usage: run_test [-tag <tag>] [-prog <prog>] [-Ddef...] [-check <check>] checkargs ...
+    # usage: run_test [-tag <tag>] [-prog <prog>] [-smp <cpus>] [-Ddef...] [-check <check>] checkargs ...
     tag=
     prog=
+    smp=
     check=check_regexps
     while true; do
         select=
         case $1 in
-            -tag|-prog)
+            -tag|-prog|-smp)
                 select=`expr substr $1 2 ${#1}`
                 eval $select='$2'
                 ;;
@@ -293,6 +297,7 @@ run_test() {
 quick_run() {
     # usage: quick_run <tag> [-Ddef...]
     tag="$1"
+    smp=
     shift
     defs=
     while expr "x$1" : "x-D.*" > /dev/null; do
@@ -333,10 +338,9 @@ default_check() {
     'check_alloc_page() succeeded!'                             \
     'check_pgdir() succeeded!'                                  \
     'check_boot_pgdir() succeeded!'				\
-    'PDE(0e0) c0000000-f8000000 38000000 urw'                   \
-    '  |-- PTE(38000) c0000000-f8000000 38000000 -rw'           \
+    'PDE(0e0) c0000000-f8000000 38000000 -rwL'                  \
     'PDE(001) fac00000-fb000000 00400000 -rw'                   \
-    '  |-- PTE(000e0) faf00000-fafe0000 000e0000 urw'           \
+    '  |-- PTE(000e0) faf00000-fafe0000 000e0000 -rwL'          \
     '  |-- PTE(00001) fafeb000-fafec000 00001000 -rw'		\
     'check_slab() succeeded!'					\
     'check_vma_struct() succeeded!'                             \
@@ -347,14 +351,44 @@ default_check() {
     'page fault at 0x00002000: K/W [no page found].'            \
     'page fault at 0x00003000: K/W [no page found].'            \
     'page fault at 0x00004000: K/W [no page found].'            \
-    'write Virt Page e in fifo_check_swap'			\
+    'write Virt Page e in lru_check_swap'			\
     'page fault at 0x00005000: K/W [no page found].'		\
-    'page fault at 0x00001000: K/W [no page found]'		\
-    'page fault at 0x00002000: K/W [no page found].'		\
-    'page fault at 0x00003000: K/W [no page found].'		\
-    'page fault at 0x00004000: K/W [no page found].'		\
+    'page fault at 0x00001000: K/R [no page found].'		\
+    'page fault at 0x00002000: K/R [no page found].'		\
+    'page fault at 0x00004000: K/R [no page found].'		\
+    'page fault at 0x00003000: K/R [no page found].'		\
+    'page fault at 0x00005000: K/R [no page found].'		\
+    'check_zswap() succeeded!'					\
     'check_swap() succeeded!'					\
-    '++ setup timer interrupts'
+    '++ setup timer interrupts'					\
+    'check_proc_hash() succeeded!'
+}
+
+clock_check() {
+    pts=7
+    check_regexps "$@"
+
+    pts=3
+    quick_check 'check output'                                  \
+    'SWAP: manager = enhanced clock swap manager'               \
+    'check_zswap() succeeded!'                                  \
+    'page fault at 0x00001000: K/W [no page found].'            \
+    'page fault at 0x00002000: K/W [no page found].'            \
+    'page fault at 0x00003000: K/W [no page found].'            \
+    'page fault at 0x00004000: K/W [no page found].'            \
+    'write Virt Page e in clock_check_swap'                     \
+    'page fault at 0x00005000: K/W [no page found].'            \
+    'write Virt Page d in clock_check_swap'                     \
+    'page fault at 0x00004000: K/R [no page found].'            \
+    'read Virt Page a in clock_check_swap'                      \
+    'page fault at 0x00001000: K/R [no page found].'            \
+    'read Virt Page c in clock_check_swap'                      \
+    'page fault at 0x00003000: K/R [no page found].'            \
+    'read Virt Page e in clock_check_swap'                      \
+    'page fault at 0x00005000: K/R [no page found].'            \
+    'check_swap() succeeded!'                                   \
+    '++ setup timer interrupts'                                 \
+    'check_proc_hash() succeeded!'
 }
 
 ## check now!!
@@ -415,6 +449,12 @@ run_test -prog 'hello' -check default_check
       - 'I am process .*'                                       \
         'hello pass.'
 
+run_test -tag 'hello-clock' -prog 'hello' -DSWAP_CLOCK -check clock_check             \
+      - 'kernel_execve: pid = ., name = "hello".*'               \
+        'Hello world!!.'                                        \
+      - 'I am process .*'                                       \
+        'hello pass.'
+
 run_test -prog 'testbss' -check default_check                                        \
       - 'kernel_execve: pid = ., name = "testbss".*'             \
         'Making sure bss works right...'                        \
@@ -435,13 +475,12 @@ run_test -prog 'pgdir' -check default_check
         '  |-- PTE(00001) 00802000-00803000 00001000 urw'       \
         'PDE(001) afc00000-b0000000 00400000 urw'               \
         '  |-- PTE(00004) afffc000-b0000000 00004000 urw'       \
-        'PDE(0e0) c0000000-f8000000 38000000 urw'               \
-        '  |-- PTE(38000) c0000000-f8000000 38000000 -rw'       \
+        'PDE(0e0) c0000000-f8000000 38000000 -rwL'              \
         'pgdir pass.'
 
 run_test -prog 'yield' -check default_check                                          \
       - 'kernel_execve: pid = ., name = "yield".*'               \
-        'Hello, I am process 2.'                                \
+        'Hello, I am process 3.'                                \
       - 'Back in process ., iteration 0.'                       \
       - 'Back in process ., iteration 1.'                       \
       - 'Back in process ., iteration 2.'                       \
@@ -551,6 +590,92 @@ run_test -prog 'forktree'    -check default_check               \
         'all user-mode processes have quit.'                    \
         'init check memory pass.'
 
+pts=10
+run_test -prog 'threadtest'  -check default_check               \
+      - 'kernel_execve: pid = ., name = "threadtest".*'          \
+        'thread ok.'                                            \
+        'thread 0 done.'                                        \
+        'thread 3 done.'                                        \
+        'threadtest pass.'                                      \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -prog 'futextest'   -check default_check               \
+      - 'kernel_execve: pid = ., name = "futextest".*'           \
+        'futex syscall ok.'                                     \
+        'futex on the zero page ok.'                            \
+        'futextest pass.'                                       \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -prog 'rsstest'     -check default_check               \
+      - 'kernel_execve: pid = ., name = "rsstest".*'             \
+        'rss limit ok.'                                         \
+        'rss fork ok.'                                          \
+        'rsstest pass.'                                         \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -prog 'nicetest'    -check default_check               \
+      - 'kernel_execve: pid = ., name = "nicetest".*'            \
+        'setnice ok.'                                           \
+        'nicetest pass.'                                        \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -tag 'nicetest-cfs' -prog 'nicetest' -DSCHED_CFS        \
+         -check default_check                                   \
+        'sched class: cfs_scheduler'                            \
+      - 'kernel_execve: pid = ., name = "nicetest".*'            \
+        'setnice ok.'                                           \
+        'nice weighted result: 1 2 3'                           \
+        'nicetest pass.'                                        \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -prog 'rttest'      -check default_check               \
+      - 'kernel_execve: pid = ., name = "rttest".*'              \
+        'setsched ok.'                                          \
+        'fifo parent runs first.'                               \
+        'child runs after the fifo parent.'                     \
+        'woken fifo parent preempts the child.'                 \
+        'deadline parent is throttled.'                         \
+        'rttest pass.'                                          \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -prog 'schedtest'   -check default_check               \
+      - 'kernel_execve: pid = ., name = "schedtest".*'           \
+        'schedtest pass.'                                       \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -tag 'smptest-smp2' -prog 'smptest' -smp 2               \
+         -check default_check                                   \
+        'mp: 2 cpus found.'                                     \
+        'smp: cpu 1 (apic 1) started.'                          \
+        'smp: 2 cpus online.'                                   \
+      - 'kernel_execve: pid = ., name = "smptest".*'             \
+        'smptest: ran on 2 cpus.'                               \
+        'smptest pass.'                                         \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
 pts=20
 timeout=150
 run_test -prog 'priority'      -check default_check             \
@@ -562,6 +687,31 @@ run_test -prog 'priority'      -check default_check             \
         'init check memory pass.'                               \
     ! - 'user panic at .*'
 
+pts=10
+run_test -tag 'spin-mlfq' -prog 'spin' -DSCHED_MLFQ              \
+         -check default_check                                   \
+        'sched class: mlfq_scheduler'                           \
+        'check_mlfq() succeeded!'                               \
+      - 'kernel_execve: pid = ., name = "spin".*'                \
+        'I am the child. spinning ...'                          \
+        'kill returns 0'                                        \
+        'wait returns 0'                                        \
+        'spin may pass.'                                        \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
+pts=10
+run_test -tag 'priority-mlfq' -prog 'priority' -DSCHED_MLFQ      \
+         -check default_check                                   \
+        'sched class: mlfq_scheduler'                           \
+      - 'kernel_execve: pid = ., name = "priority".*'            \
+        'main: fork ok,now need to wait pids.'                  \
+        'stride sched correct result: 1 1 1 1 1'                \
+        'all user-mode processes have quit.'                    \
+        'init check memory pass.'                               \
+    ! - 'user panic at .*'
+
 pts=20
 timeout=240
 
@@ -572,6 +722,7 @@ run_test -prog 'sleep'         -check default_check             \
         'sleep 7 x 100 slices.'                                 \
         'sleep 10 x 100 slices.'                                \
       - 'use 1... msecs.'                                       \
+        'usleep 20 x 1000 us ok.'                               \
         'sleep pass.'                                           \
         'all user-mode processes have quit.'                    \
         'init check memory pass.'                               \
@@ -623,9 +774,9 @@ run_test -prog 'matrix'     -check default_check                \
         'No.4 philosopher_condvar quit'                                \
       - 'kernel_execve: pid = ., name = "matrix".*'              \
         'fork ok.'                                              \
-        'pid 13 done!.'                                         \
-        'pid 17 done!.'                                         \
-        'pid 23 done!.'                                         \
+        'pid 14 done!.'                                         \
+        'pid 18 done!.'                                         \
+        'pid 24 done!.'                                         \
         'matrix pass.'                                          \
         'all user-mode processes have quit.'                    \
         'init check memory pass.'                               \
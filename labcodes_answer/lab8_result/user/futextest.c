@@ -0,0 +1,77 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <thread.h>
+#include <lock.h>
+
+#define NTHREAD     4
+#define NLOOP       50
+#define PGSIZE      4096
+
+static lock_t counter_lock = INIT_LOCK;
+static volatile int counter = 0;
+
+int
+worker(void *arg) {
+    int i;
+    for (i = 0; i < NLOOP; i ++) {
+        lock(&counter_lock);
+        int val = counter;
+        // give up cpu inside the critical section, so other threads contend for the lock
+        yield();
+        counter = val + 1;
+        unlock(&counter_lock);
+    }
+    return 0;
+}
+
+static volatile int *fresh;
+
+int
+waker(void *arg) {
+    int i;
+    for (i = 0; i < 3; i ++) {
+        yield();
+    }
+    // the first write moves the word from the zero page to a page of its own
+    *fresh = 1;
+    assert(futex_wake(fresh, 1) == 1);
+    return 0;
+}
+
+int
+main(void) {
+    int i;
+    volatile int word = 1;
+    assert(futex_wait(&word, 0, 0) != 0);
+    assert(futex_wait(&word, 1, 10) != 0);
+    assert(futex_wait_us(&word, 1, 500) != 0);
+    assert(futex_wake(&word, 1) == 0);
+    cprintf("futex syscall ok.\n");
+
+    // a word only read so far maps the zero page, the waiter and the waker must
+    // still get the same key
+    uintptr_t base = 0;
+    assert(mmap(&base, PGSIZE, MMAP_WRITE) == 0);
+    fresh = (volatile int *)base;
+    assert(*fresh == 0);
+    thread_t tid;
+    assert(thread_create(waker, NULL, &tid) == 0);
+    assert(futex_wait(fresh, 0, 100) == 0 && *fresh == 1);
+    assert(thread_join(&tid, NULL) == 0);
+    assert(munmap(base, PGSIZE) == 0);
+    cprintf("futex on the zero page ok.\n");
+
+    thread_t tids[NTHREAD];
+    for (i = 0; i < NTHREAD; i ++) {
+        assert(thread_create(worker, NULL, &tids[i]) == 0);
+    }
+    for (i = 0; i < NTHREAD; i ++) {
+        assert(thread_join(&tids[i], NULL) == 0);
+    }
+    assert(counter == NTHREAD * NLOOP);
+
+    cprintf("futextest pass.\n");
+    return 0;
+}
+
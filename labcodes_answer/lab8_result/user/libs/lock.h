@@ -5,9 +5,18 @@
 #include <atomic.h>
 #include <ulib.h>
 
+/* *
+ * A futex based mutex. The lock word is:
+ *   0 - unlocked
+ *   1 - locked, no waiter
+ *   2 - locked, and some processes may sleep on it
+ * The uncontended lock/unlock never enter the kernel. A contended lock()
+ * sleeps in futex_wait and is woken precisely by the unlock().
+ * */
+
 #define INIT_LOCK           {0}
 
-typedef volatile bool lock_t;
+typedef volatile int lock_t;
 
 static inline void
 lock_init(lock_t *l) {
@@ -16,26 +25,28 @@ lock_init(lock_t *l) {
 
 static inline bool
 try_lock(lock_t *l) {
-    return test_and_set_bit(0, l);
+    return cmpxchg(l, 0, 1) != 0;
 }
 
 static inline void
 lock(lock_t *l) {
-    if (try_lock(l)) {
-        int step = 0;
-        do {
-            yield();
-            if (++ step == 100) {
-                step = 0;
-                sleep(10);
-            }
-        } while (try_lock(l));
+    int c;
+    if ((c = cmpxchg(l, 0, 1)) != 0) {
+        if (c != 2) {
+            c = xchg(l, 2);
+        }
+        while (c != 0) {
+            futex_wait(l, 2, 0);
+            c = xchg(l, 2);
+        }
     }
 }
 
 static inline void
 unlock(lock_t *l) {
-    test_and_clear_bit(0, l);
+    if (xchg(l, 0) == 2) {
+        futex_wake(l, 1);
+    }
 }
 
 #endif /* !__USER_LIBS_LOCK_H__ */
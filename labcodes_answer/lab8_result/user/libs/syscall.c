@@ -84,11 +84,56 @@ sys_sleep(unsigned int time) {
     return syscall(SYS_sleep, time);
 }
 
+int
+sys_usleep(unsigned int usec) {
+    return syscall(SYS_usleep, usec);
+}
+
 size_t
 sys_gettime(void) {
     return syscall(SYS_gettime);
 }
 
+int
+sys_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags) {
+    return syscall(SYS_mmap, addr_store, len, mmap_flags);
+}
+
+int
+sys_munmap(uintptr_t addr, size_t len) {
+    return syscall(SYS_munmap, addr, len);
+}
+
+int
+sys_futex(uintptr_t uaddr, int op, int val, unsigned int timeout) {
+    return syscall(SYS_futex, uaddr, op, val, timeout);
+}
+
+int
+sys_memstat(struct memstat *stat) {
+    return syscall(SYS_memstat, stat);
+}
+
+int
+sys_rsslimit(int limit) {
+    return syscall(SYS_rsslimit, limit);
+}
+
+int
+sys_setnice(int nice) {
+    return syscall(SYS_setnice, nice);
+}
+
+int
+sys_setsched(int policy, int priority, int runtime, int period) {
+    return syscall(SYS_setsched, policy, priority, runtime, period);
+}
+
+int
+sys_schedstat(int pid, struct schedstat *stat) {
+    return syscall(SYS_schedstat, pid, stat);
+}
+
 int
 sys_exec(const char *name, int argc, const char **argv) {
     return syscall(SYS_exec, name, argc, argv);
@@ -11,7 +11,20 @@ int sys_getpid(void);
 int sys_putc(int c);
 int sys_pgdir(void);
 int sys_sleep(unsigned int time);
+int sys_usleep(unsigned int usec);
 size_t sys_gettime(void);
+int sys_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
+int sys_munmap(uintptr_t addr, size_t len);
+int sys_futex(uintptr_t uaddr, int op, int val, unsigned int timeout);
+
+struct memstat;
+
+int sys_memstat(struct memstat *stat);
+int sys_rsslimit(int limit);
+int sys_setnice(int nice);
+int sys_setsched(int policy, int priority, int runtime, int period);
+struct schedstat;
+int sys_schedstat(int pid, struct schedstat *stat);
 
 struct stat;
 struct dirent;
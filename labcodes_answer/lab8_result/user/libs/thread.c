@@ -0,0 +1,56 @@
+#include <defs.h>
+#include <unistd.h>
+#include <error.h>
+#include <ulib.h>
+#include <thread.h>
+
+/* *
+ * thread_create - create a thread running fn(arg) in the address space of
+ * the caller. The stack of the thread is mapped by mmap, and it is shared
+ * with the caller through CLONE_VM, so no page of the caller is copied.
+ * */
+int
+thread_create(int (*fn)(void *), void *arg, thread_t *tidp) {
+    if (fn == NULL || tidp == NULL) {
+        return -E_INVAL;
+    }
+    int ret;
+    uintptr_t stack = 0;
+    if ((ret = mmap(&stack, THREAD_STACKSIZE, MMAP_WRITE | MMAP_STACK)) != 0) {
+        return ret;
+    }
+    assert(stack != 0);
+
+    if ((ret = clone(CLONE_VM | CLONE_THREAD, stack + THREAD_STACKSIZE, fn, arg)) < 0) {
+        munmap(stack, THREAD_STACKSIZE);
+        return ret;
+    }
+
+    tidp->pid = ret;
+    tidp->stack = (void *)stack;
+    return 0;
+}
+
+/* *
+ * thread_join - block until the thread exits, then release its stack.
+ * Only the creator of a thread can join it, as it is the parent.
+ * */
+int
+thread_join(thread_t *tidp, int *exit_code) {
+    int ret = -E_INVAL;
+    if (tidp != NULL) {
+        if ((ret = waitpid(tidp->pid, exit_code)) == 0) {
+            munmap((uintptr_t)(tidp->stack), THREAD_STACKSIZE);
+        }
+    }
+    return ret;
+}
+
+int
+thread_kill(thread_t *tidp) {
+    if (tidp != NULL) {
+        return kill(tidp->pid);
+    }
+    return -E_INVAL;
+}
+
@@ -5,6 +5,7 @@
 #include <stat.h>
 #include <string.h>
 #include <lock.h>
+#include <unistd.h>
 
 static lock_t fork_lock = INIT_LOCK;
 
@@ -72,6 +73,11 @@ sleep(unsigned int time) {
     return sys_sleep(time);
 }
 
+int
+usleep(unsigned int usec) {
+    return sys_usleep(usec);
+}
+
 unsigned int
 gettime_msec(void) {
     return (unsigned int)sys_gettime();
@@ -85,3 +91,53 @@ __exec(const char *name, const char **argv) {
     }
     return sys_exec(name, argc, argv);
 }
+
+int
+mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags) {
+    return sys_mmap(addr_store, len, mmap_flags);
+}
+
+int
+munmap(uintptr_t addr, size_t len) {
+    return sys_munmap(addr, len);
+}
+
+int
+futex_wait(volatile int *uaddr, int val, unsigned int timeout) {
+    return sys_futex((uintptr_t)uaddr, FUTEX_WAIT, val, timeout);
+}
+
+int
+futex_wait_us(volatile int *uaddr, int val, unsigned int usec) {
+    return sys_futex((uintptr_t)uaddr, FUTEX_WAIT_US, val, usec);
+}
+
+int
+futex_wake(volatile int *uaddr, int nr) {
+    return sys_futex((uintptr_t)uaddr, FUTEX_WAKE, nr, 0);
+}
+
+int
+memstat(struct memstat *stat) {
+    return sys_memstat(stat);
+}
+
+int
+rsslimit(int limit) {
+    return sys_rsslimit(limit);
+}
+
+int
+setnice(int nice) {
+    return sys_setnice(nice);
+}
+
+int
+setsched(int policy, int priority, int runtime, int period) {
+    return sys_setsched(policy, priority, runtime, period);
+}
+
+int
+schedstat(int pid, struct schedstat *stat) {
+    return sys_schedstat(pid, stat);
+}
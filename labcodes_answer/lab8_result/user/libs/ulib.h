@@ -34,8 +34,22 @@ int kill(int pid);
 int getpid(void);
 void print_pgdir(void);
 int sleep(unsigned int time);
+int usleep(unsigned int usec);
 unsigned int gettime_msec(void);
 int __exec(const char *name, const char **argv);
+int mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
+int munmap(uintptr_t addr, size_t len);
+int clone(uint32_t clone_flags, uintptr_t stack, int (*fn)(void *), void *arg);
+int futex_wait(volatile int *uaddr, int val, unsigned int timeout);
+int futex_wait_us(volatile int *uaddr, int val, unsigned int usec);
+int futex_wake(volatile int *uaddr, int nr);
+struct memstat;
+int memstat(struct memstat *stat);
+int rsslimit(int limit);
+int setnice(int nice);
+int setsched(int policy, int priority, int runtime, int period);
+struct schedstat;
+int schedstat(int pid, struct schedstat *stat);
 
 #define __exec0(name, path, ...)                \
 ({ const char *argv[] = {path, ##__VA_ARGS__, NULL}; __exec(name, argv); })
@@ -0,0 +1,56 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define NCHILD      3
+// run for MAX_TIME msecs, long enough for the CFS weights to show
+#define MAX_TIME    2000
+
+// the weights of nice 0, 3 and 5 are about 3 : 1.5 : 1
+static const int nices[NCHILD] = {0, 3, 5};
+
+static void
+spin_delay(void) {
+    int i;
+    volatile int j;
+    for (i = 0; i != 200; i ++) {
+        j = !j;
+    }
+}
+
+int
+main(void) {
+    assert(setnice(NICE_MIN - 1) != 0);
+    assert(setnice(NICE_MAX + 1) != 0);
+    assert(setnice(NICE_MIN) == 0 && setnice(NICE_MAX) == 0 && setnice(0) == 0);
+    cprintf("setnice ok.\n");
+
+    int i, pids[NCHILD], acc[NCHILD];
+    int start = gettime_msec();
+    for (i = 0; i < NCHILD; i ++) {
+        if ((pids[i] = fork()) == 0) {
+            assert(setnice(nices[i]) == 0);
+            int n = 0;
+            while (1) {
+                spin_delay();
+                if (++ n % 4000 == 0 && gettime_msec() > start + MAX_TIME) {
+                    exit(n);
+                }
+            }
+        }
+        assert(pids[i] > 0);
+    }
+    for (i = 0; i < NCHILD; i ++) {
+        assert(waitpid(pids[i], &acc[i]) == 0 && acc[i] > 0);
+    }
+    assert(wait() != 0);
+
+    // CPU time is given in proportion to the weight only by the CFS scheduler
+    cprintf("nice weighted result:");
+    for (i = 0; i < NCHILD; i ++) {
+        cprintf(" %d", (acc[0] * 2 / acc[i] + 1) / 2);
+    }
+    cprintf("\n");
+    cprintf("nicetest pass.\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <memstat.h>
+
+#define PGSIZE      4096
+#define NPAGE       64
+#define LIMIT       16
+
+static void
+touch(uintptr_t base, bool write) {
+    int i;
+    for (i = 0; i < NPAGE; i ++) {
+        volatile int *p = (volatile int *)(base + i * PGSIZE);
+        if (write) {
+            *p = i;
+        }
+        assert(*p == i);
+    }
+}
+
+// fill - fill the pages with the pseudo random words of seed, they do not compress, so
+//        they are written to the swap disk
+static void
+fill(uintptr_t base, uint32_t seed, bool write) {
+    int i;
+    for (i = 0; i < NPAGE * PGSIZE / sizeof(uint32_t); i ++) {
+        volatile uint32_t *p = (volatile uint32_t *)base + i;
+        seed = seed * 1103515245 + 12345;
+        if (write) {
+            *p = seed;
+        }
+        assert(*p == seed);
+    }
+}
+
+int
+main(void) {
+    struct memstat ms;
+    uintptr_t base = 0;
+    assert(mmap(&base, NPAGE * PGSIZE, MMAP_WRITE) == 0);
+
+    touch(base, 1);
+    assert(memstat(&ms) == 0);
+    assert(ms.ms_rss >= NPAGE && ms.ms_rss_limit == 0);
+    cprintf("rss %d pages, swap %d pages, page tables %d pages.\n", ms.ms_rss, ms.ms_swap, ms.ms_pgtable);
+
+    // the pages over the limit go to swap at once, and come back intact
+    assert(rsslimit(LIMIT) == 0);
+    assert(memstat(&ms) == 0);
+    assert(ms.ms_rss <= LIMIT && ms.ms_swap >= NPAGE - LIMIT);
+    touch(base, 0);
+    assert(memstat(&ms) == 0);
+    assert(ms.ms_rss <= LIMIT);
+    cprintf("rss limit ok.\n");
+
+    assert(rsslimit(-1) != 0);
+    assert(rsslimit(0) == 0);
+    touch(base, 0);
+    assert(memstat(&ms) == 0);
+    assert(ms.ms_rss >= NPAGE && ms.ms_rss_limit == 0);
+
+    // the child has its own pages at the same addresses, the swap slots of the two
+    // processes must not be mixed up
+    int pid;
+    if ((pid = fork()) == 0) {
+        fill(base, 2, 1);
+        assert(rsslimit(LIMIT) == 0);
+        yield();
+        fill(base, 2, 0);
+        exit(0);
+    }
+    assert(pid > 0);
+    fill(base, 1, 1);
+    assert(rsslimit(LIMIT) == 0);
+    yield();
+    fill(base, 1, 0);
+    assert(waitpid(pid, NULL) == 0);
+    assert(rsslimit(0) == 0);
+    cprintf("rss fork ok.\n");
+
+    assert(munmap(base, NPAGE * PGSIZE) == 0);
+    cprintf("rsstest pass.\n");
+    return 0;
+}
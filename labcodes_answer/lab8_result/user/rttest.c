@@ -0,0 +1,69 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define LOOPS       2000000
+
+static void
+spin(void) {
+    volatile int i;
+    for (i = 0; i < LOOPS; i ++) {
+    }
+}
+
+int
+main(void) {
+    assert(setsched(SCHED_FIFO, -1, 0, 0) != 0);
+    assert(setsched(SCHED_RR, SCHED_PRIO_MAX + 1, 0, 0) != 0);
+    assert(setsched(SCHED_DEADLINE, 0, 0, 10) != 0);
+    assert(setsched(SCHED_DEADLINE, 0, 20, 10) != 0);
+    assert(setsched(SCHED_DEADLINE + 1, 0, 0, 0) != 0);
+    cprintf("setsched ok.\n");
+
+    // a FIFO process is not preempted by the child of the same priority
+    int pid;
+    assert(setsched(SCHED_FIFO, 0, 0, 0) == 0);
+    if ((pid = fork()) == 0) {
+        cprintf("child runs after the fifo parent.\n");
+        exit(0);
+    }
+    assert(pid > 0);
+    spin();
+    cprintf("fifo parent runs first.\n");
+    assert(waitpid(pid, NULL) == 0);
+
+    // the parent wakes up while the child of a lower priority spins, and preempts it
+    if ((pid = fork()) == 0) {
+        assert(setsched(SCHED_FIFO, SCHED_PRIO_MAX, 0, 0) == 0);
+        int i;
+        for (i = 0; i < 100; i ++) {
+            spin();
+        }
+        exit(0);
+    }
+    assert(pid > 0);
+    sleep(2);
+    assert(kill(pid) == 0);
+    int exit_code;
+    assert(waitpid(pid, &exit_code) == 0 && exit_code != 0);
+    cprintf("woken fifo parent preempts the child.\n");
+
+    // a deadline process that spins is throttled to 2 ticks in 10, the normal child
+    // runs in the rest and exits before the parent kills it
+    assert(setsched(SCHED_DEADLINE, 0, 2, 10) == 0);
+    if ((pid = fork()) == 0) {
+        exit(0);
+    }
+    assert(pid > 0);
+    unsigned int start = gettime_msec();
+    while (gettime_msec() - start < 500) {
+        spin();
+    }
+    kill(pid);
+    assert(waitpid(pid, &exit_code) == 0 && exit_code == 0);
+    assert(setsched(SCHED_NORMAL, 0, 0, 0) == 0);
+    cprintf("deadline parent is throttled.\n");
+    cprintf("rttest pass.\n");
+    return 0;
+}
+
@@ -0,0 +1,32 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <schedstat.h>
+
+#define NSLEEP      5
+#define NYIELD      5
+
+int
+main(void) {
+    struct schedstat ss;
+    int i, nr;
+    assert(schedstat(-1, &ss) != 0);
+
+    for (i = 0; i < NSLEEP; i ++) {
+        sleep(2);
+    }
+    for (i = 0; i < NYIELD; i ++) {
+        yield();
+    }
+    assert(schedstat(0, &ss) == 0);
+    cprintf("runs %d, run %d, wait %d, vcsw %d, ivcsw %d.\n", ss.ss_runs,
+            ss.ss_run_ticks, ss.ss_wait_ticks, ss.ss_nvcsw, ss.ss_nivcsw);
+    assert(ss.ss_nvcsw >= NSLEEP && ss.ss_runs >= NSLEEP);
+
+    for (nr = 0, i = 0; i < SCHEDSTAT_NR_BUCKETS; i ++) {
+        nr += ss.ss_latency[i];
+    }
+    assert(nr >= NSLEEP);
+    cprintf("schedtest pass.\n");
+    return 0;
+}
+
@@ -14,7 +14,7 @@ sleepy(int pid) {
 int
 main(void) {
     unsigned int time = gettime_msec();
-    int pid1, exit_code;
+    int i, pid1, exit_code;
 
     if ((pid1 = fork()) == 0) {
         sleepy(pid1);
@@ -22,6 +22,14 @@ main(void) {
     
     assert(waitpid(pid1, &exit_code) == 0 && exit_code == 0);
     cprintf("use %04d msecs.\n", gettime_msec() - time);
+
+    // a sleep finer than a tick is not rounded up to the next tick
+    time = gettime_msec();
+    for (i = 0; i < 20; i ++) {
+        assert(usleep(1000) == 0);
+    }
+    assert(gettime_msec() - time < 10);
+    cprintf("usleep 20 x 1000 us ok.\n");
     cprintf("sleep pass.\n");
     return 0;
 }
@@ -0,0 +1,51 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <schedstat.h>
+
+#define NCHILD      4
+// run for MAX_TIME msecs, long enough for the run queues to be balanced
+#define MAX_TIME    1000
+
+static void
+spin_delay(void) {
+    int i;
+    volatile int j;
+    for (i = 0; i != 200; i ++) {
+        j = !j;
+    }
+}
+
+int
+main(void) {
+    int i, pids[NCHILD], cpus = 0;
+    int start = gettime_msec();
+    for (i = 0; i < NCHILD; i ++) {
+        if ((pids[i] = fork()) == 0) {
+            int n = 0;
+            while (1) {
+                spin_delay();
+                if (++ n % 4000 == 0 && gettime_msec() > start + MAX_TIME) {
+                    struct schedstat ss;
+                    assert(schedstat(0, &ss) == 0 && ss.ss_cpus != 0);
+                    exit(ss.ss_cpus);
+                }
+            }
+        }
+        assert(pids[i] > 0);
+    }
+    for (i = 0; i < NCHILD; i ++) {
+        int mask;
+        assert(waitpid(pids[i], &mask) == 0 && mask != 0);
+        cpus |= mask;
+    }
+    assert(wait() != 0);
+
+    // the cpus any of the children ran on
+    int nr = 0;
+    for (; cpus != 0; cpus >>= 1) {
+        nr += cpus & 1;
+    }
+    cprintf("smptest: ran on %d cpus.\n", nr);
+    cprintf("smptest pass.\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <thread.h>
+
+#define NTHREAD     4
+#define NSLICE      1000
+
+static int data[NTHREAD * NSLICE];
+static int partial[NTHREAD];
+
+int
+sum_slice(void *arg) {
+    int id = (int)arg, i, sum = 0;
+    for (i = id * NSLICE; i < (id + 1) * NSLICE; i ++) {
+        sum += data[i];
+    }
+    partial[id] = sum;
+    yield();
+    cprintf("thread %d done.\n", id);
+    return 0xbee + id;
+}
+
+int
+main(void) {
+    int i, sum = 0;
+    for (i = 0; i < NTHREAD * NSLICE; i ++) {
+        data[i] = i;
+    }
+
+    thread_t tids[NTHREAD];
+    for (i = 0; i < NTHREAD; i ++) {
+        assert(thread_create(sum_slice, (void *)i, &tids[i]) == 0);
+    }
+    cprintf("thread ok.\n");
+
+    for (i = 0; i < NTHREAD; i ++) {
+        int exit_code;
+        assert(thread_join(&tids[i], &exit_code) == 0 && exit_code == 0xbee + i);
+        sum += partial[i];
+    }
+    assert(sum == (NTHREAD * NSLICE) * (NTHREAD * NSLICE - 1) / 2);
+
+    cprintf("threadtest pass.\n");
+    return 0;
+}
+